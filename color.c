@@ -2,10 +2,12 @@
 
 #include "color.h"
 
+#include "simd.h"
 #include "util.h"
 
 #include <math.h>
 #include <stdio.h>
+#include <string.h>
 
 
 static float get_cmin(const color_t *c) {
@@ -36,8 +38,8 @@ void color_from_hsv(color_t *c, float hue, float saturation, float value) {
 }
 
 
-void color_from_random(color_t *c) {
-  color_from_rgb(c, rand_normal(), rand_normal(), rand_normal());
+void color_from_random(rng_t *rng, color_t *c) {
+  color_from_rgb(c, rand_normal(rng), rand_normal(rng), rand_normal(rng));
 }
 
 
@@ -100,27 +102,27 @@ void color_set_v(color_t *c, float value) {
 }
 
 
-void color_jitter_hsv(color_t *c, float max_jitter) {
-  float h = color_h(c);
-  float s = color_s(c);
-  float v = color_v(c);
+void color_jitter_hsv(rng_t *rng, color_t *c, float max_jitter) {
+  float h, s, v;
 
-  h = jitter_with_wrap(h, max_jitter, 0.0f, 1.0f);
-  s = jitter_with_cap(s, max_jitter, 0.0f, 1.0f);
-  v = jitter_with_cap(v, max_jitter, 0.0f, 1.0f);
+  rgb_to_hsv_n(&c->red, &c->green, &c->blue, &h, &s, &v, 1);
 
-  color_from_hsv(c, h, s, v);
+  h = jitter_with_wrap(rng, h, max_jitter, 0.0f, 1.0f);
+  s = jitter_with_cap(rng, s, max_jitter, 0.0f, 1.0f);
+  v = jitter_with_cap(rng, v, max_jitter, 0.0f, 1.0f);
+
+  hsv_to_rgb_n(&h, &s, &v, &c->red, &c->green, &c->blue, 1);
 }
 
 
-void color_from_jittered_hsv_color(color_t *dest, color_t source, float hue_radius, float saturation_radius, float value_radius) {
+void color_from_jittered_hsv_color(rng_t *rng, color_t *dest, color_t source, float hue_radius, float saturation_radius, float value_radius) {
   float h = color_h(&source);
   float s = color_s(&source);
   float v = color_v(&source);
 
-  h = jitter_with_wrap(h, hue_radius, 0, 1);
-  s = jitter_with_cap(s, saturation_radius, 0, 1);
-  v = jitter_with_cap(s, value_radius, 0, 1);
+  h = jitter_with_wrap(rng, h, hue_radius, 0, 1);
+  s = jitter_with_cap(rng, s, saturation_radius, 0, 1);
+  v = jitter_with_cap(rng, s, value_radius, 0, 1);
 
   color_from_hsv(dest, h, s, v);
 }
@@ -175,79 +177,112 @@ float color_hsv_cone_distance(const color_t *c1, const color_t *c2) {
 }
 
 
-float rgb_to_hue(float red, float green, float blue) { 
-  float M;
-  float m;
+/* Four colors at a time, without branches, so that whole images go through quickly.  A gray has
+   no hue of its own and is given 0. */
+static inline void rgb_to_hsv_v4(v4sf red, v4sf green, v4sf blue, v4sf *hue, v4sf *saturation, v4sf *value) {
+  v4sf M = v4sf_max(v4sf_max(red, green), blue);
+  v4sf m = v4sf_min(v4sf_min(red, green), blue);
+  v4sf zero = v4sf_splat(0.0f);
+  v4sf one = v4sf_splat(1.0f);
+  v4sf range = v4sf_select(M > m, M - m, one);
 
-  float r;
-  float g;
-  float b;
+  v4sf r = (M - red) / range;
+  v4sf g = (M - green) / range;
+  v4sf b = (M - blue) / range;
 
-  float hue;
+  v4sf h = v4sf_select(red == M, b - g, v4sf_select(green == M, v4sf_splat(2.0f) + r - b, v4sf_splat(4.0f) + g - r));
+  h /= v4sf_splat(6.0f);
+  h += v4sf_select(h < zero, one, zero);
+  h -= v4sf_select(h >= one, one, zero);
 
-  M = fmaxf(fmaxf(red, green), blue);
-  m = fminf(fminf(red, green), blue);
+  *hue = h;
+  *saturation = v4sf_select(M == zero, zero, (M - m) / v4sf_select(M == zero, one, M));
+  *value = M;
+}
 
-  r = (M - red) / (M - m);
-  g = (M - green) / (M - m);
-  b = (M - blue) / (M - m);
 
-  if (red == M) {
-    hue = b - g;
-  } else if (green == M) {
-    hue = 2.0f + r - b;
-  } else {
-    hue = 4.0f + g - r;
-  }
-  hue /= 6.0f;
+static inline void hsv_to_rgb_v4(v4sf hue, v4sf saturation, v4sf value, v4sf *red, v4sf *green, v4sf *blue) {
+  v4sf zero = v4sf_splat(0.0f);
+  v4sf hue_prime = hue * v4sf_splat(6.0f);
+
+  hue_prime = v4sf_select(hue_prime == v4sf_splat(6.0f), zero, hue_prime);
+
+  v4sf chroma = value * saturation;
+  /* fmodf(hue_prime, 2), which truncates the same way. */
+  v4sf half_turns = __builtin_convertvector(__builtin_convertvector(hue_prime * v4sf_splat(0.5f), v4si), v4sf);
+  v4sf within_two = hue_prime - v4sf_splat(2.0f) * half_turns;
+  v4sf x = chroma * (v4sf_splat(1.0f) - v4sf_max(within_two - v4sf_splat(1.0f), v4sf_splat(1.0f) - within_two));
+  v4sf m = value - chroma;
+
+  /* Which sixth of the hue circle each color is in. */
+  v4si below_1 = hue_prime < v4sf_splat(1.0f);
+  v4si below_2 = hue_prime < v4sf_splat(2.0f);
+  v4si below_3 = hue_prime < v4sf_splat(3.0f);
+  v4si below_4 = hue_prime < v4sf_splat(4.0f);
+  v4si below_5 = hue_prime < v4sf_splat(5.0f);
+  v4si sixth_0 = below_1;
+  v4si sixth_1 = below_2 & ~below_1;
+  v4si sixth_2 = below_3 & ~below_2;
+  v4si sixth_3 = below_4 & ~below_3;
+  v4si sixth_4 = below_5 & ~below_4;
+  v4si sixth_5 = ~below_5;
+
+  *red = v4sf_select(sixth_0 | sixth_5, chroma, v4sf_select(sixth_1 | sixth_4, x, zero)) + m;
+  *green = v4sf_select(sixth_1 | sixth_2, chroma, v4sf_select(sixth_0 | sixth_3, x, zero)) + m;
+  *blue = v4sf_select(sixth_3 | sixth_4, chroma, v4sf_select(sixth_2 | sixth_5, x, zero)) + m;
+}
 
-  if (hue < 0.0f) hue += 1.0f;
-  if (hue >= 1.0f) hue -= 1.0f;
 
-  return hue;
+/* Runs a four-color kernel over arrays of any length, going through a padded copy for the last
+   few. */
+#define COLOR_KERNEL_N(kernel, in_0, in_1, in_2, out_0, out_1, out_2, count)          \
+  do {                                                                                \
+    size_t i_ = 0;                                                                    \
+    for (;  i_ + 4 <= (count);  i_ += 4) {                                            \
+      v4sf a_, b_, c_;                                                                \
+      kernel(v4sf_load(&(in_0)[i_]), v4sf_load(&(in_1)[i_]), v4sf_load(&(in_2)[i_]),  \
+             &a_, &b_, &c_);                                                          \
+      v4sf_store(&(out_0)[i_], a_);                                                   \
+      v4sf_store(&(out_1)[i_], b_);                                                   \
+      v4sf_store(&(out_2)[i_], c_);                                                   \
+    }                                                                                 \
+    if (i_ < (count)) {                                                               \
+      float tail_[6][4] = { { 0 } };                                                  \
+      size_t left_ = (count) - i_;                                                    \
+      v4sf a_, b_, c_;                                                                \
+      memcpy(tail_[0], &(in_0)[i_], left_ * sizeof(float));                           \
+      memcpy(tail_[1], &(in_1)[i_], left_ * sizeof(float));                           \
+      memcpy(tail_[2], &(in_2)[i_], left_ * sizeof(float));                           \
+      kernel(v4sf_load(tail_[0]), v4sf_load(tail_[1]), v4sf_load(tail_[2]),           \
+             &a_, &b_, &c_);                                                          \
+      v4sf_store(tail_[3], a_);                                                       \
+      v4sf_store(tail_[4], b_);                                                       \
+      v4sf_store(tail_[5], c_);                                                       \
+      memcpy(&(out_0)[i_], tail_[3], left_ * sizeof(float));                          \
+      memcpy(&(out_1)[i_], tail_[4], left_ * sizeof(float));                          \
+      memcpy(&(out_2)[i_], tail_[5], left_ * sizeof(float));                          \
+    }                                                                                 \
+  } while (0)
+
+
+void rgb_to_hsv_n(const float *red, const float *green, const float *blue, float *hue, float *saturation, float *value, size_t count) {
+  COLOR_KERNEL_N(rgb_to_hsv_v4, red, green, blue, hue, saturation, value, count);
 }
 
 
-void hsv_to_rgb(float *rgb, float hue, float saturation, float value) {
-  float chroma;
-  float hue_prime;
-  float x;
-  float m;
-
-  hue_prime = hue * 6.0f;
-  if (hue_prime == 6.0f) {
-    hue_prime = 0.0f;
-  }
+void hsv_to_rgb_n(const float *hue, const float *saturation, const float *value, float *red, float *green, float *blue, size_t count) {
+  COLOR_KERNEL_N(hsv_to_rgb_v4, hue, saturation, value, red, green, blue, count);
+}
 
-  chroma = value * saturation;
-
-  x = chroma * (1.0f - fabsf(fmodf(hue_prime, 2.0f) - 1.0f));
-
-  rgb[0] = rgb[1] = rgb[2] = 0.0f;
-
-  if (hue_prime < 1.0f) {
-    rgb[0] = chroma;
-    rgb[1] = x;
-  } else if (hue_prime < 2.0f) {
-    rgb[0] = x;
-    rgb[1] = chroma;
-  } else if (hue_prime < 3.0f) {
-    rgb[1] = chroma;
-    rgb[2] = x;
-  } else if (hue_prime < 4.0f) {
-    rgb[1] = x;
-    rgb[2] = chroma;
-  } else if (hue_prime < 5.0f) {
-    rgb[0] = x;
-    rgb[2] = chroma;
-  } else {
-    rgb[0] = chroma;
-    rgb[2] = x;
-  }
 
-  m = value - chroma;
+float rgb_to_hue(float red, float green, float blue) {
+  float hue, saturation, value;
 
-  rgb[0] += m;
-  rgb[1] += m;
-  rgb[2] += m;
+  rgb_to_hsv_n(&red, &green, &blue, &hue, &saturation, &value, 1);
+  return hue;
+}
+
+
+void hsv_to_rgb(float *rgb, float hue, float saturation, float value) {
+  hsv_to_rgb_n(&hue, &saturation, &value, &rgb[0], &rgb[1], &rgb[2], 1);
 }
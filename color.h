@@ -3,6 +3,8 @@
 #define COLOR_H
 
 
+#include "rng.h"
+
 #include <math.h>
 #include <stddef.h>
 
@@ -15,7 +17,7 @@ typedef struct {
 
 void color_from_rgb(color_t *c, float red, float green, float blue);
 void color_from_hsv(color_t *c, float hue, float saturation, float value);
-void color_random(color_t *c);
+void color_from_random(rng_t *rng, color_t *c);
 
 color_t color_copy(const color_t *src);
 
@@ -37,8 +39,8 @@ void color_set_h(color_t *c, float hue);
 void color_set_s(color_t *c, float saturation);
 void color_set_v(color_t *c, float value);
 
-void color_jitter_hsv(color_t *c, float max_jitter);
-void color_from_jittered_hsv_color(color_t *dest, color_t source, float hue_radius, float saturation_radius, float value_radius);
+void color_jitter_hsv(rng_t *rng, color_t *c, float max_jitter);
+void color_from_jittered_hsv_color(rng_t *rng, color_t *dest, color_t source, float hue_radius, float saturation_radius, float value_radius);
 
 void color_scale_value(color_t *c, float scale);
 
@@ -53,11 +55,16 @@ void color_hsv_cone_coords(const color_t *c, float *x, float *y, float *z);
 float color_hsv_cone_distance(const color_t *c1, const color_t *c2);
 
 
-/* Returns the hue in the range (0..1] */
+/* Returns the hue in the range [0..1), or 0 for a gray. */
 float rgb_to_hue(float red, float green, float blue);
 
 /* rgb must be an array of at least 3 floats. */
 void hsv_to_rgb(float *rgb, float hue, float saturation, float value);
 
+/* Convert count colors at once, each held as one element of three channel arrays, with hues in
+   the range [0..1).  An output array may be the input array that it replaces. */
+void rgb_to_hsv_n(const float *red, const float *green, const float *blue, float *hue, float *saturation, float *value, size_t count);
+void hsv_to_rgb_n(const float *hue, const float *saturation, const float *value, float *red, float *green, float *blue, size_t count);
+
 
 #endif
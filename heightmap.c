@@ -2,63 +2,345 @@
 #include "heightmap.h"
 
 #include "color.h"
+#include "simd.h"
 #include "util.h"
 
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+
+
+#define HUE_CHUNK (256)  /* rainbow heightmap pixels converted at a time */
+
+
+static float sample_to_float(const void *samples, image_sample_type_t type, size_t index) {
+  switch (type) {
+    case IMAGE_SAMPLE_U8:
+      return ((const uint8_t *) samples)[index] / 255.0f;
+    case IMAGE_SAMPLE_U16:
+      return ((const uint16_t *) samples)[index] / 65535.0f;
+    case IMAGE_SAMPLE_FLOAT:
+    default:
+      return ((const float *) samples)[index];
+  }
+}
+
+
+/* Reduces RGB samples to a single depth channel. */
+static int samples_to_depth(image_samples_t *samples) {
+  image_sample_type_t type = samples->type;
+  void *rgb = samples->data;
+  size_t count = samples->width * samples->height;
+
+  float red = sample_to_float(rgb, type, 0);
+  float green = sample_to_float(rgb, type, 1);
+  float blue = sample_to_float(rgb, type, 2);
+
+  if ((red != green) || (red != blue)) {
+    /* A rainbow heightmap.  The depth is the hue, except for grays. */
+    float *hues;
+
+    if ((hues = malloc(count * sizeof(*hues))) == NULL) {
+      PERROR("hue allocation");
+      return -1;
+    }
+
+    for (size_t start = 0;  start < count;  start += HUE_CHUNK) {
+      float red[HUE_CHUNK];
+      float green[HUE_CHUNK];
+      float blue[HUE_CHUNK];
+      size_t chunk = count - start < HUE_CHUNK ? count - start : HUE_CHUNK;
+
+      for (size_t i = 0;  i < chunk;  i++) {
+        red[i] = sample_to_float(rgb, type, 3 * (start + i));
+        green[i] = sample_to_float(rgb, type, 3 * (start + i) + 1);
+        blue[i] = sample_to_float(rgb, type, 3 * (start + i) + 2);
+      }
+      /* Only the hue is wanted, so the saturation and value land on the inputs. */
+      rgb_to_hsv_n(red, green, blue, &hues[start], green, blue, chunk);
+
+      /* Grays (black and white included) have no hue, so they're put at the farthest depth, as
+         black is in a grayscale heightmap. */
+      for (size_t i = 0;  i < chunk;  i++) {
+        if (green[i] == 0.0f) {
+          hues[start + i] = 0.0f;
+        }
+      }
+    }
+
+    image_samples_release(samples);
+
+    samples->type = IMAGE_SAMPLE_FLOAT;
+    samples->data = hues;
+  } else if (samples->mapping) {
+    /* A grayscale heightmap mapped from the file, which is read-only.  Copy out just one
+       channel, at the file's own bit depth. */
+    size_t sample_size = image_sample_size(type);
+    void *gray;
+
+    if ((gray = malloc(count * sample_size)) == NULL) {
+      PERROR("sample allocation");
+      return -1;
+    }
+
+    for (size_t i = 0;  i < count;  i++) {
+      memcpy((char *) gray + i * sample_size, (char *) rgb + 3 * i * sample_size, sample_size);
+    }
+
+    image_samples_release(samples);
+
+    samples->data = gray;
+  } else {
+    /* A grayscale heightmap.  Keep just one channel, at the file's own bit depth. */
+    size_t sample_size = image_sample_size(type);
+    void *shrunk;
+
+    for (size_t i = 1;  i < count;  i++) {
+      memcpy((char *) rgb + i * sample_size, (char *) rgb + 3 * i * sample_size, sample_size);
+    }
+
+    if ((shrunk = realloc(rgb, count * sample_size)) != NULL) {
+      samples->data = shrunk;
+    }
+  }
+
+  samples->channels = 1;
+
+  return 0;
+}
 
 
 heightmap_t *heightmap_read(const char *filename) {
   heightmap_t *heightmap;
-  float pixel[4];
 
-  if ((heightmap = malloc(sizeof(*heightmap))) == NULL) {
+  if ((heightmap = calloc(1, sizeof(*heightmap))) == NULL) {
     PERROR("struct allocation");
     return NULL;
   }
 
-  if ((heightmap->image = image_read(filename)) == NULL) {
-    free(heightmap);
-    return NULL;
-  }
+  if (image_read_native_samples(filename, &heightmap->samples) == -1) {
+    image_samples_t *samples = &heightmap->samples;
+
+    if (errno != ENOTSUP) {
+      PERROR("reading heightmap");
+      free(heightmap);
+      return NULL;
+    }
 
-  heightmap->reflected = 0;
+    /* Not a format we can read ourselves, so let MagickWand decode it. */
+    if ((samples->data = image_read_samples(filename, "RGB", &samples->type, &samples->width, &samples->height)) == NULL) {
+      free(heightmap);
+      return NULL;
+    }
+    samples->channels = 3;
+  }
 
-  image_get_pixel(heightmap->image, pixel, 0, 0);
+  heightmap->width = heightmap->samples.width;
+  heightmap->height = heightmap->samples.height;
 
-  heightmap->rainbow = ((pixel[0] != pixel[1]) || (pixel[0] != pixel[2]));
+  if (heightmap->samples.channels == 3 && samples_to_depth(&heightmap->samples) == -1) {
+    heightmap_destroy(heightmap);
+    return NULL;
+  }
 
   return heightmap;
 }
 
+
 void heightmap_destroy(heightmap_t *heightmap) {
-  image_destroy(heightmap->image);
+  image_samples_release(&heightmap->samples);
+  free(heightmap->separations);
   free(heightmap);
 }
 
-float heightmap_get(const heightmap_t *heightmap, float x, size_t y) {
-  float pixel[4];
 
-  if (heightmap->reflected) {
-    x = image_get_width(heightmap->image) - x;
+/* The arithmetic here is spelled out so that the table and the vector pass below both produce
+   exactly the same separations. */
+static float separation_dof(float separation_min, float separation_max) {
+  return 2.0 * (separation_max - separation_min) / (2.0 * separation_max - separation_min);
+}
+
+static float separation_for_height(float h, float dof, float separation_max) {
+  float dof_h = dof * h;
+  return (1.0 - dof_h) * 2.0 * separation_max / (2.0 - dof_h);
+}
+
+
+static void separations_from_table(float *separations, const void *samples, image_sample_type_t type, size_t count, const float *table) {
+  if (type == IMAGE_SAMPLE_U8) {
+    const uint8_t *s = samples;
+    for (size_t i = 0;  i < count;  i++) {
+      separations[i] = table[s[i]];
+    }
+  } else {
+    const uint16_t *s = samples;
+    for (size_t i = 0;  i < count;  i++) {
+      separations[i] = table[s[i]];
+    }
+  }
+}
+
+
+/* Works in place if separations == heights. */
+static void separations_from_heights(float *separations, const float *heights, size_t count, float dof, float separation_max) {
+  v4sf dof_v = v4sf_splat(dof);
+  v2df one = v2df_splat(1.0);
+  v2df two = v2df_splat(2.0);
+  v2df max_v = v2df_splat(separation_max);
+  size_t i;
+
+  for (i = 0;  i + 4 <= count;  i += 4) {
+    v4sf dof_h = dof_v * v4sf_load(&heights[i]);
+    v2sf low = { dof_h[0], dof_h[1] };
+    v2sf high = { dof_h[2], dof_h[3] };
+    v2df dof_h_low = __builtin_convertvector(low, v2df);
+    v2df dof_h_high = __builtin_convertvector(high, v2df);
+    v2sf sep_low = __builtin_convertvector((one - dof_h_low) * two * max_v / (two - dof_h_low), v2sf);
+    v2sf sep_high = __builtin_convertvector((one - dof_h_high) * two * max_v / (two - dof_h_high), v2sf);
+    v4sf sep = { sep_low[0], sep_low[1], sep_high[0], sep_high[1] };
+    v4sf_store(&separations[i], sep);
+  }
+
+  for (;  i < count;  i++) {
+    separations[i] = separation_for_height(heights[i], dof, separation_max);
+  }
+}
+
+
+static int compute_separations(float *separations, const void *samples, image_sample_type_t type, size_t count, float separation_min, float separation_max) {
+  float dof = separation_dof(separation_min, separation_max);
+
+  if (type == IMAGE_SAMPLE_FLOAT) {
+    separations_from_heights(separations, samples, count, dof, separation_max);
+  } else {
+    /* There are few enough distinct sample values to compute each one's separation just once. */
+    size_t table_size = type == IMAGE_SAMPLE_U8 ? 256 : 65536;
+    float max_sample = (float) (table_size - 1);
+    float *table;
+
+    if ((table = malloc(table_size * sizeof(*table))) == NULL) {
+      PERROR("separation table allocation");
+      return -1;
+    }
+
+    for (size_t i = 0;  i < table_size;  i++) {
+      table[i] = separation_for_height(i / max_sample, dof, separation_max);
+    }
+
+    separations_from_table(separations, samples, type, count, table);
+
+    free(table);
+  }
+
+  return 0;
+}
+
+
+int heightmap_compute_separations(heightmap_t *heightmap, float separation_min, float separation_max) {
+  image_samples_t *samples = &heightmap->samples;
+  size_t count = heightmap->width * heightmap->height;
+  float *separations;
+
+  if (samples->data == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (samples->type == IMAGE_SAMPLE_FLOAT && samples->mapping == NULL) {
+    /* Same size as the samples, so reuse their storage. */
+    separations = samples->data;
+  } else if ((separations = malloc(count * sizeof(*separations))) == NULL) {
+    PERROR("separation allocation");
+    return -1;
   }
 
-  image_get_pixel(heightmap->image, pixel, (size_t) x, y);
+  if (compute_separations(separations, samples->data, samples->type, count, separation_min, separation_max) == -1) {
+    if (separations != samples->data) {
+      free(separations);
+    }
+    return -1;
+  }
 
-  if (heightmap->rainbow) {
-    return rgb_to_hue(pixel[0], pixel[1], pixel[2]);
+  if (separations == samples->data) {
+    samples->data = NULL;  /* now owned by separations */
   } else {
-    return pixel[0];
+    image_samples_release(samples);
   }
+
+  free(heightmap->separations);
+  heightmap->separations = separations;
+  heightmap->separation_first_row = 0;
+  heightmap->separation_row_count = heightmap->height;
+
+  return 0;
 }
 
-void heightmap_set_reflected(heightmap_t *heightmap, int reflected) {
-  heightmap->reflected = reflected;
+
+int heightmap_compute_separation_rows(heightmap_t *heightmap, float separation_min, float separation_max, size_t first_row, size_t row_count) {
+  image_samples_t *samples = &heightmap->samples;
+  size_t count = heightmap->width * row_count;
+  size_t sample_size = image_sample_size(samples->type);
+
+  if (samples->data == NULL || first_row + row_count > heightmap->height) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (heightmap->separations == NULL || row_count != heightmap->separation_row_count) {
+    float *separations;
+
+    if ((separations = realloc(heightmap->separations, count * sizeof(*separations))) == NULL) {
+      PERROR("separation allocation");
+      return -1;
+    }
+    heightmap->separations = separations;
+    heightmap->separation_row_count = row_count;
+  }
+
+  heightmap->separation_first_row = first_row;
+
+  return compute_separations(heightmap->separations, (const char *) samples->data + first_row * heightmap->width * sample_size,
+                             samples->type, count, separation_min, separation_max);
+}
+
+
+float heightmap_get_separation(const heightmap_t *heightmap, float x, size_t y, int reflected) {
+  if (reflected) {
+    x = heightmap->width - x;
+  }
+
+  return heightmap->separations[(y - heightmap->separation_first_row) * heightmap->width + (size_t) x];
 }
 
+
+int heightmap_separation_rows_equal(const heightmap_t *a, const heightmap_t *b, size_t y) {
+  const float *a_row = &a->separations[(y - a->separation_first_row) * a->width];
+  const float *b_row = &b->separations[(y - b->separation_first_row) * b->width];
+
+  return memcmp(a_row, b_row, a->width * sizeof(*a_row)) == 0;
+}
+
+
 size_t heightmap_get_width(const heightmap_t *heightmap) {
-  return image_get_width(heightmap->image);
+  return heightmap->width;
 }
 
+
 size_t heightmap_get_height(const heightmap_t *heightmap) {
-  return image_get_height(heightmap->image);
+  return heightmap->height;
+}
+
+
+size_t heightmap_get_memory_size(const heightmap_t *heightmap) {
+  size_t size = 0;
+
+  /* Mapped samples live in the page cache, and don't count against our own memory. */
+  if (heightmap->samples.data && heightmap->samples.mapping == NULL) {
+    size += heightmap->width * heightmap->height * image_sample_size(heightmap->samples.type);
+  }
+  if (heightmap->separations) {
+    size += heightmap->width * heightmap->separation_row_count * sizeof(*heightmap->separations);
+  }
+
+  return size;
 }
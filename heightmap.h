@@ -1,24 +1,48 @@
-
 #ifndef HEIGHTMAP_H
 #define HEIGHTMAP_H
 
 #include "image.h"
+#include "image_reader.h"
 
 typedef struct heightmap_tag {
-  image_t *image;
-  int reflected;
-  int rainbow;
+  size_t width;
+  size_t height;
+
+  /* One depth sample per pixel (channels is always 1), as decoded from the file or mapped
+     straight from it.  Only kept until the separations have been computed. */
+  image_samples_t samples;
+
+  /* The stereogram separation, in pixels, for each pixel of separation_row_count rows starting at
+     separation_first_row. */
+  float *separations;
+  size_t separation_first_row;
+  size_t separation_row_count;
 } heightmap_t;
 
 heightmap_t *heightmap_read(const char *filename);
 
 void heightmap_destroy(heightmap_t *heightmap);
 
-float heightmap_get(const heightmap_t *heightmap, float x, size_t y);
+/* Converts every depth sample into the separation, in pixels, that the stereogram needs at that
+   pixel, and frees the samples.  This has to happen before heightmap_get_separation() is used. */
+int heightmap_compute_separations(heightmap_t *heightmap, float separation_min, float separation_max);
+
+/* Like heightmap_compute_separations(), but only for row_count rows starting at first_row, and
+   the samples are kept so that later calls can move on to other rows.  Only those rows may then
+   be passed to heightmap_get_separation(). */
+int heightmap_compute_separation_rows(heightmap_t *heightmap, float separation_min, float separation_max, size_t first_row, size_t row_count);
 
-void heightmap_set_reflected(heightmap_t *heightmap, int reflected);
+/* If reflected is nonzero, x is measured from the right edge of the heightmap instead of the left. */
+float heightmap_get_separation(const heightmap_t *heightmap, float x, size_t y, int reflected);
+
+/* Returns whether row y has the same separations in both heightmaps, which must be the same width
+   and have separations computed for that row.  Rows with the same separations render the same. */
+int heightmap_separation_rows_equal(const heightmap_t *a, const heightmap_t *b, size_t y);
 
 size_t heightmap_get_width(const heightmap_t *heightmap);
 size_t heightmap_get_height(const heightmap_t *heightmap);
 
+/* Returns how many bytes of samples and separations the heightmap is currently holding. */
+size_t heightmap_get_memory_size(const heightmap_t *heightmap);
+
 #endif
@@ -1,11 +1,18 @@
 
 #include "color.h"
 #include "image.h"
+#include "image_reader.h"
+#include "image_writer.h"
 #include "perlin.h"
+#include "raster.h"
+#include "simd.h"
+#include "thread_pool.h"
 #include "util.h"
 
 #include <errno.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -33,21 +40,65 @@
 #define PERLIN_INNER_OPACITY (0.8f)
 #define PERLIN_OUTER_OPACITY (0.8f)
 
+#define PIXEL_CHUNK (256)  /* pixels converted to floats and back at a time */
 
-void image_init(void) {
+/* Noise is Poisson distributed with a mean of this times the sample value, scaled back down by
+   the same, like ImageMagick's Poisson noise. */
+#define NOISE_POISSON_SCALE (12.5f)
+#define NOISE_POISSON_MAX_COUNT (64)  /* where to stop counting, should rounding never get there */
+
+#define NOISE_RNG_STREAM (2)  /* of the job seed; the texture has 0 and the pattern 1 */
+
+/* This much of the bottom of a Perlin texture fades into the noise above its top, so that it tiles
+   vertically. */
+#define PERLIN_SEAM_FRACTION (0.25f)
+
+
+/* What objects and dots are drawn over: ImageMagick's "gray", which they used to be drawn on. */
+static const float random_background[4] = { 126.0f / 255.0f, 126.0f / 255.0f, 126.0f / 255.0f, 1.0f };
+
+
+/* MagickWand takes a while to start up, and isn't needed at all when every file involved is one
+   we can read and write ourselves, so it's only started the first time a wand is needed. */
+static pthread_once_t magick_once = PTHREAD_ONCE_INIT;
+static int magick_started = 0;
+
+
+static void start_magick(void) {
   MagickWandGenesis();
+  magick_started = 1;
+}
+
+
+static MagickWand *new_magick_wand(void) {
+  pthread_once(&magick_once, start_magick);
+  return NewMagickWand();
+}
+
+
+static PixelWand *new_pixel_wand(void) {
+  pthread_once(&magick_once, start_magick);
+  return NewPixelWand();
 }
 
 
 void image_close(void) {
-  MagickWandTerminus();
+  if (magick_started) {
+    MagickWandTerminus();
+  }
 }
 
 
-typedef int (*draw_object_t)(DrawingWand *draw, PixelWand *pixel, float x, float y, float min_radius, float max_radius, size_t width);
+/* Adds a random object at (x, y) to list, built on shape's colors and outline. */
+typedef int (*add_object_t)(raster_list_t *list, raster_shape_t *shape, rng_t *rng, float x, float y, float min_radius, float max_radius, size_t width, size_t height);
 
 
 image_t *image_create(size_t width, size_t height) {
+  return image_create_with_format(width, height, IMAGE_FORMAT_RGBA_FLOAT);
+}
+
+
+image_t *image_create_with_format(size_t width, size_t height, image_pixel_format_t format) {
   image_t *image;
 
   if ((image = malloc(sizeof(*image))) == NULL) {
@@ -57,8 +108,9 @@ image_t *image_create(size_t width, size_t height) {
 
   image->width = width;
   image->height = height;
+  image->format = format;
 
-  if ((image->pixels = calloc(4 * width * height, sizeof(*image->pixels))) == NULL) {
+  if ((image->pixels = calloc(width * height, image_pixel_size(format))) == NULL) {
     free(image);
     return NULL;
   }
@@ -67,14 +119,101 @@ image_t *image_create(size_t width, size_t height) {
 }
 
 
+int image_convert(image_t *image, image_pixel_format_t format) {
+  image_load_pixel_t load = image_pixel_loader(image->format);
+  image_store_pixel_t store = image_pixel_storer(format);
+  void *pixels;
+
+  if (format.type == image->format.type && format.channels == image->format.channels) {
+    return 0;
+  }
+
+  if ((pixels = malloc(image->width * image->height * image_pixel_size(format))) == NULL) {
+    PERROR("pixel allocation");
+    return -1;
+  }
+
+  for (size_t y = 0;  y < image->height;  y++) {
+    const void *in = image_get_row(image, y);
+    void *out = (char *) pixels + y * image->width * image_pixel_size(format);
+
+    for (size_t x = 0;  x < image->width;  x++) {
+      float pixel[4];
+      load(in, x, pixel);
+      store(out, x, pixel);
+    }
+  }
+
+  free(image->pixels);
+  image->pixels = pixels;
+  image->format = format;
+
+  return 0;
+}
+
+
+image_t *image_copy(const image_t *image) {
+  image_t *copy;
+
+  if ((copy = image_create_with_format(image->width, image->height, image->format)) == NULL) return NULL;
+
+  memcpy(copy->pixels, image->pixels, image->width * image->height * image_pixel_size(image->format));
+
+  return copy;
+}
+
+
 void image_destroy(image_t *image) {
   free(image->pixels);
   free(image);
 }
 
 
+/* MagickWand has no half storage type, so half images go through a float copy. */
+static int magick_storage(image_pixel_format_t format, StorageType *storage, const char **map) {
+  *map = format.channels == 4 ? "RGBA" : "RGB";
+
+  switch (format.type) {
+    case IMAGE_SAMPLE_U8:
+      *storage = CharPixel;
+      return 0;
+    case IMAGE_SAMPLE_U16:
+      *storage = ShortPixel;
+      return 0;
+    case IMAGE_SAMPLE_FLOAT:
+      *storage = FloatPixel;
+      return 0;
+    case IMAGE_SAMPLE_HALF:
+    default:
+      return -1;
+  }
+}
+
+
 static int magic_wand_to_allocated_image(MagickWand *wand, image_t *image) {
-  return MagickExportImagePixels(wand, 0, 0, image->width, image->height, "RGBA", FloatPixel, image->pixels) == MagickFalse ? -1 : 0;
+  StorageType storage;
+  const char *map;
+  image_t *copy;
+  int retval = 0;
+
+  if (magick_storage(image->format, &storage, &map) == 0) {
+    return MagickExportImagePixels(wand, 0, 0, image->width, image->height, map, storage, image->pixels) == MagickFalse ? -1 : 0;
+  }
+
+  if ((copy = image_create(image->width, image->height)) == NULL) return -1;
+
+  if (MagickExportImagePixels(wand, 0, 0, image->width, image->height, "RGBA", FloatPixel, copy->pixels) == MagickFalse
+      || image_convert(copy, image->format) == -1) {
+    retval = -1;
+  } else {
+    void *pixels = image->pixels;
+    image->pixels = copy->pixels;
+    copy->pixels = pixels;
+  }
+
+  image_destroy(copy);
+
+  return retval;
 }
 
 
@@ -94,12 +233,52 @@ static image_t *magic_wand_to_new_image(MagickWand *wand) {
 }
 
 
+static image_t *samples_to_new_image(const image_samples_t *samples) {
+  image_t *image;
+  size_t count = samples->width * samples->height;
+
+  if ((image = image_create(samples->width, samples->height)) == NULL) return NULL;
+
+  for (size_t i = 0;  i < count;  i++) {
+    float *pixel = (float *) image->pixels + 4 * i;
+
+    for (size_t c = 0;  c < 3;  c++) {
+      /* Gray samples go into all three channels. */
+      size_t index = samples->channels * i + (samples->channels == 3 ? c : 0);
+
+      switch (samples->type) {
+        case IMAGE_SAMPLE_U8:
+          pixel[c] = ((const uint8_t *) samples->data)[index] / 255.0f;
+          break;
+        case IMAGE_SAMPLE_U16:
+          pixel[c] = ((const uint16_t *) samples->data)[index] / 65535.0f;
+          break;
+        case IMAGE_SAMPLE_FLOAT:
+        default:
+          pixel[c] = ((const float *) samples->data)[index];
+          break;
+      }
+    }
+    pixel[3] = 1.0f;
+  }
+
+  return image;
+}
+
+
 image_t *image_read(const char *filename) {
   image_t *image = NULL;
+  image_samples_t samples;
 
   MagickWand *wand;
 
-  if ((wand = NewMagickWand()) == NULL) {
+  if (image_read_native_samples(filename, &samples) == 0) {
+    image = samples_to_new_image(&samples);
+    image_samples_release(&samples);
+    return image;
+  }
+
+  if ((wand = new_magick_wand()) == NULL) {
     PERROR("MagickWand creation");
     return NULL;
   }
@@ -117,294 +296,498 @@ image_t *image_read(const char *filename) {
 }
 
 
-static MagickWand *image_to_wand(image_t *image) {
+void *image_read_samples(const char *filename, const char *channels, image_sample_type_t *type, size_t *width, size_t *height) {
   MagickWand *wand;
-  PixelWand *bgcolor;
+  StorageType storage;
+  size_t depth;
+  void *samples = NULL;
 
-  if ((wand = NewMagickWand()) == NULL) {
-    return NULL;
-  }
-  if ((bgcolor = NewPixelWand()) == NULL) {
-    DestroyMagickWand(wand);
+  if ((wand = new_magick_wand()) == NULL) {
+    PERROR("MagickWand creation");
     return NULL;
   }
 
-  if (PixelSetColor(bgcolor, "black") == MagickFalse) {
-    DestroyPixelWand(bgcolor);
-    DestroyMagickWand(wand);
-    return NULL;
+  if (MagickReadImage(wand, filename) == MagickFalse) {
+    PERROR("reading image");
+    goto cleanup;
   }
 
-  if (MagickNewImage(wand, image->width, image->height, bgcolor) == MagickFalse) {
-    DestroyPixelWand(bgcolor);
-    DestroyMagickWand(wand);
-    return NULL;
+  *width = MagickGetImageWidth(wand);
+  *height = MagickGetImageHeight(wand);
+
+  depth = MagickGetImageDepth(wand);
+  if (depth <= 8) {
+    *type = IMAGE_SAMPLE_U8;
+    storage = CharPixel;
+  } else if (depth <= 16) {
+    *type = IMAGE_SAMPLE_U16;
+    storage = ShortPixel;
+  } else {
+    *type = IMAGE_SAMPLE_FLOAT;
+    storage = FloatPixel;
   }
 
-  DestroyPixelWand(bgcolor);
+  if ((samples = malloc(*width * *height * strlen(channels) * image_sample_size(*type))) == NULL) {
+    PERROR("sample allocation");
+    goto cleanup;
+  }
 
-  if (MagickImportImagePixels(wand, 0, 0, image->width, image->height, "RGBA", FloatPixel, image->pixels) == MagickFalse) {
-    DestroyMagickWand(wand);
-    return NULL;
+  if (MagickExportImagePixels(wand, 0, 0, *width, *height, channels, storage, samples) == MagickFalse) {
+    PERROR("exporting samples");
+    free(samples);
+    samples = NULL;
   }
 
-  return wand;
-}
+ cleanup:
+  DestroyMagickWand(wand);
 
+  return samples;
+}
 
-static MagickWand *drawing_wand_to_magic_wand(DrawingWand *draw, size_t width, size_t height) {
-  MagickWand *wand = NULL;
-  PixelWand *color = NULL;
 
-  MagickWand *retval = NULL;
+size_t image_sample_size(image_sample_type_t type) {
+  switch (type) {
+    case IMAGE_SAMPLE_U8:
+      return sizeof(uint8_t);
+    case IMAGE_SAMPLE_U16:
+    case IMAGE_SAMPLE_HALF:
+      return sizeof(uint16_t);
+    case IMAGE_SAMPLE_FLOAT:
+    default:
+      return sizeof(float);
+  }
+}
 
-  if ((wand = NewMagickWand()) == NULL) goto bad;
-  if ((color = NewPixelWand()) == NULL) goto bad;
 
-  if (PixelSetColor(color, "gray") == MagickFalse) goto bad;
+size_t image_pixel_size(image_pixel_format_t format) {
+  return format.channels * image_sample_size(format.type);
+}
 
-  if (MagickNewImage(wand, width, height, color) == MagickFalse) goto bad;
-  if (!MagickSetSize(wand, width, height)) goto bad;
 
-  if (MagickDrawImage(wand, draw) == MagickFalse) goto bad;
+float image_half_to_float(uint16_t h) {
+  uint32_t sign = (uint32_t) (h & 0x8000) << 16;
+  int exponent = (h >> 10) & 0x1f;
+  uint32_t mantissa = h & 0x3ff;
+  uint32_t bits;
+  float f;
 
-  retval = wand;
+  if (exponent == 0x1f) {
+    bits = sign | 0x7f800000 | (mantissa << 13);  /* infinity or NaN */
+  } else if (exponent != 0) {
+    bits = sign | ((uint32_t) (exponent - 15 + 127) << 23) | (mantissa << 13);
+  } else if (mantissa == 0) {
+    bits = sign;
+  } else {
+    /* Subnormal in half precision, but normal in single. */
+    exponent = 1;
+    while (!(mantissa & 0x400)) {
+      mantissa <<= 1;
+      exponent--;
+    }
+    bits = sign | ((uint32_t) (exponent - 15 + 127) << 23) | ((mantissa & 0x3ff) << 13);
+  }
 
- cleanup:
-  if (color) DestroyPixelWand(color);
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
 
-  return retval;
 
- bad:
-  retval = NULL;
-  if (wand) DestroyMagickWand(wand);
-  goto cleanup;
-}
+/* Rounds to the nearest half, ties to even. */
+static uint16_t float_to_half(float f) {
+  uint32_t bits;
+  uint16_t sign;
+  uint32_t mantissa;
+  int exponent;
+  uint32_t half;
+  uint32_t rest;
+  uint32_t halfway;
+  int shift;
 
+  memcpy(&bits, &f, sizeof(bits));
 
-static image_t *drawing_wand_to_image(DrawingWand *draw, size_t width, size_t height) {
-  MagickWand *wand = NULL;
-  image_t *image;
+  sign = (bits >> 16) & 0x8000;
+  mantissa = bits & 0x7fffff;
+  exponent = (int) ((bits >> 23) & 0xff) - 127 + 15;
 
-  if ((wand = drawing_wand_to_magic_wand(draw, width, height)) == NULL) return NULL;
+  if (exponent == 0xff - 127 + 15) {
+    return sign | 0x7c00 | (mantissa ? 0x200 : 0);  /* infinity or NaN */
+  }
+  if (exponent >= 0x1f) {
+    return sign | 0x7c00;  /* too big, so infinity */
+  }
 
-  image = magic_wand_to_new_image(wand);
+  if (exponent <= 0) {
+    /* Subnormal in half precision, or too small even for that. */
+    if (exponent < -10) {
+      return sign;
+    }
+    mantissa |= 0x800000;
+    shift = 14 - exponent;
+    half = mantissa >> shift;
+  } else {
+    shift = 13;
+    half = ((uint32_t) exponent << 10) | (mantissa >> shift);
+  }
 
-  DestroyMagickWand(wand);
+  /* A carry out of the mantissa correctly bumps the exponent. */
+  rest = mantissa & ((1u << shift) - 1);
+  halfway = 1u << (shift - 1);
+  if (rest > halfway || (rest == halfway && (half & 1))) {
+    half++;
+  }
 
-  return image;
+  return sign | half;
 }
 
 
-int image_write(image_t *image, const char *filename) {
-  MagickWand *wand;
-
-  if ((wand = image_to_wand(image)) == NULL) {
-    return -1;
+static inline float load_sample(const void *row, size_t index, image_sample_type_t type) {
+  switch (type) {
+    case IMAGE_SAMPLE_U8:
+      return ((const uint8_t *) row)[index] / 255.0f;
+    case IMAGE_SAMPLE_U16:
+      return ((const uint16_t *) row)[index] / 65535.0f;
+    case IMAGE_SAMPLE_HALF:
+      return image_half_to_float(((const uint16_t *) row)[index]);
+    case IMAGE_SAMPLE_FLOAT:
+    default:
+      return ((const float *) row)[index];
   }
+}
 
-  if (MagickWriteImage(wand, filename) == MagickFalse) {
-    DestroyMagickWand(wand);
-    return -1;
-  } 
-
-  DestroyMagickWand(wand);
 
-  return 0;
+static inline void store_sample(void *row, size_t index, image_sample_type_t type, float value) {
+  switch (type) {
+    case IMAGE_SAMPLE_U8:
+      ((uint8_t *) row)[index] = (uint8_t) (cap_float(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+      break;
+    case IMAGE_SAMPLE_U16:
+      ((uint16_t *) row)[index] = (uint16_t) (cap_float(value, 0.0f, 1.0f) * 65535.0f + 0.5f);
+      break;
+    case IMAGE_SAMPLE_HALF:
+      ((uint16_t *) row)[index] = float_to_half(value);
+      break;
+    case IMAGE_SAMPLE_FLOAT:
+    default:
+      ((float *) row)[index] = value;
+      break;
+  }
 }
 
 
-void image_get_pixel(const image_t *image, float *pixel, size_t x, size_t y) {
-  size_t base;
-
-  /* Sanity check. */
-  if (x >= image->width) {
-    fprintf(stderr, "x = %lu is outside the image, width = %lu\n", x, image->width);
-    exit(1);
+/* Each format gets its own kernels, with the sample type and channel count fixed at compile
+   time so that the switches above fold away.  The row kernels run the whole loop inside, so a
+   run of pixels costs one call rather than one per pixel. */
+#define PIXEL_KERNELS(name, type, channels)                                          \
+  static void load_##name(const void *row, size_t x, float *pixel) {                  \
+    for (int i = 0;  i < (channels);  i++) {                                          \
+      pixel[i] = load_sample(row, (channels) * x + i, (type));                        \
+    }                                                                                 \
+    if ((channels) == 3) {                                                            \
+      pixel[3] = 1.0f;                                                                \
+    }                                                                                 \
+  }                                                                                   \
+  static void store_##name(void *row, size_t x, const float *pixel) {                 \
+    for (int i = 0;  i < (channels);  i++) {                                          \
+      store_sample(row, (channels) * x + i, (type), pixel[i]);                        \
+    }                                                                                 \
+  }                                                                                   \
+  static void load_row_##name(const void *row, size_t x, size_t count, float *pixels) { \
+    for (size_t p = 0;  p < count;  p++) {                                            \
+      for (int i = 0;  i < (channels);  i++) {                                        \
+        pixels[4 * p + i] = load_sample(row, (channels) * (x + p) + i, (type));       \
+      }                                                                               \
+      if ((channels) == 3) {                                                          \
+        pixels[4 * p + 3] = 1.0f;                                                     \
+      }                                                                               \
+    }                                                                                 \
+  }                                                                                   \
+  static void store_row_##name(void *row, size_t x, size_t count, const float *pixels) { \
+    for (size_t p = 0;  p < count;  p++) {                                            \
+      for (int i = 0;  i < (channels);  i++) {                                        \
+        store_sample(row, (channels) * (x + p) + i, (type), pixels[4 * p + i]);       \
+      }                                                                               \
+    }                                                                                 \
   }
-  if (y >= image->height) {
-    fprintf(stderr, "y = %lu is outside the image, height = %lu\n", y, image->height);
+
+PIXEL_KERNELS(rgb8, IMAGE_SAMPLE_U8, 3)
+PIXEL_KERNELS(rgba8, IMAGE_SAMPLE_U8, 4)
+PIXEL_KERNELS(rgb16, IMAGE_SAMPLE_U16, 3)
+PIXEL_KERNELS(rgba16, IMAGE_SAMPLE_U16, 4)
+PIXEL_KERNELS(rgbh, IMAGE_SAMPLE_HALF, 3)
+PIXEL_KERNELS(rgbah, IMAGE_SAMPLE_HALF, 4)
+PIXEL_KERNELS(rgbf, IMAGE_SAMPLE_FLOAT, 3)
+PIXEL_KERNELS(rgbaf, IMAGE_SAMPLE_FLOAT, 4)
+
+
+static const struct {
+  const char *name;
+  image_pixel_format_t format;
+  image_load_pixel_t load;
+  image_store_pixel_t store;
+  image_load_row_t load_row;
+  image_store_row_t store_row;
+} pixel_formats[] = {
+  { "rgb8",   { IMAGE_SAMPLE_U8,    3 }, load_rgb8,   store_rgb8,   load_row_rgb8,   store_row_rgb8 },
+  { "rgba8",  { IMAGE_SAMPLE_U8,    4 }, load_rgba8,  store_rgba8,  load_row_rgba8,  store_row_rgba8 },
+  { "rgb16",  { IMAGE_SAMPLE_U16,   3 }, load_rgb16,  store_rgb16,  load_row_rgb16,  store_row_rgb16 },
+  { "rgba16", { IMAGE_SAMPLE_U16,   4 }, load_rgba16, store_rgba16, load_row_rgba16, store_row_rgba16 },
+  { "rgbh",   { IMAGE_SAMPLE_HALF,  3 }, load_rgbh,   store_rgbh,   load_row_rgbh,   store_row_rgbh },
+  { "rgbah",  { IMAGE_SAMPLE_HALF,  4 }, load_rgbah,  store_rgbah,  load_row_rgbah,  store_row_rgbah },
+  { "rgbf",   { IMAGE_SAMPLE_FLOAT, 3 }, load_rgbf,   store_rgbf,   load_row_rgbf,   store_row_rgbf },
+  { "rgbaf",  { IMAGE_SAMPLE_FLOAT, 4 }, load_rgbaf,  store_rgbaf,  load_row_rgbaf,  store_row_rgbaf },
+};
+
+#define PIXEL_FORMAT_COUNT (sizeof(pixel_formats) / sizeof(pixel_formats[0]))
+
+
+/* The table is ordered so that this is just arithmetic, since it's on the per-pixel path of
+   image_get_pixel() and image_set_pixel(). */
+static size_t pixel_format_index(image_pixel_format_t format) {
+  size_t index = 2 * (size_t) format.type + (format.channels == 4);
+
+  if (index >= PIXEL_FORMAT_COUNT || (format.channels != 3 && format.channels != 4)) {
+    fprintf(stderr, "Unknown pixel format (type %d, %u channels)\n", format.type, format.channels);
     exit(1);
   }
 
-  base = 4 * (y * image->width + x);
-
-  pixel[0] = image->pixels[base];
-  pixel[1] = image->pixels[base + 1];
-  pixel[2] = image->pixels[base + 2];
-  pixel[3] = image->pixels[base + 3];
+  return index;
 }
 
 
-void image_set_pixel(image_t *image, const float *pixel, size_t x, size_t y) {
-  size_t base;
-
-  base = 4 * (y * image->width + x);
-
-  image->pixels[base] = pixel[0];
-  image->pixels[base + 1] = pixel[1];
-  image->pixels[base + 2] = pixel[2];
-  image->pixels[base + 3] = pixel[3];
+image_load_pixel_t image_pixel_loader(image_pixel_format_t format) {
+  return pixel_formats[pixel_format_index(format)].load;
 }
 
 
-void image_set_pixel_color(image_t *image, color_t color, size_t x, size_t y) {
-  float pixel[4] = { color.red, color.green, color.blue, 1 };
-  image_set_pixel(image, pixel, x, y);
+image_store_pixel_t image_pixel_storer(image_pixel_format_t format) {
+  return pixel_formats[pixel_format_index(format)].store;
 }
 
 
-size_t image_get_width(const image_t *image) {
-  return image->width;
+image_load_row_t image_row_loader(image_pixel_format_t format) {
+  return pixel_formats[pixel_format_index(format)].load_row;
 }
 
 
-size_t image_get_height(const image_t *image) {
-  return image->height;
+image_store_row_t image_row_storer(image_pixel_format_t format) {
+  return pixel_formats[pixel_format_index(format)].store_row;
 }
 
 
-static int set_fill_color(DrawingWand *draw, PixelWand *pixel, color_t color) {
-  char color_string[32];
-
-  color_magick_string(&color, color_string, sizeof(color_string));
+int image_pixel_format_from_name(image_pixel_format_t *format, const char *name) {
+  for (size_t i = 0;  i < PIXEL_FORMAT_COUNT;  i++) {
+    if (!strcmp(name, pixel_formats[i].name)) {
+      *format = pixel_formats[i].format;
+      return 0;
+    }
+  }
 
-  if (PixelSetColor(pixel, color_string) == MagickFalse) return -1;
+  return -1;
+}
 
-  DrawSetFillColor(draw, pixel);
 
-  return 0;
+void *image_get_row(const image_t *image, size_t y) {
+  return (char *) image->pixels + y * image->width * image_pixel_size(image->format);
 }
 
 
-int draw_ellipse(DrawingWand *draw, float x, float y, float rx, float ry) {
-  DrawSetFillOpacity(draw, 1.0);
-
-  DrawEllipse(draw, x, y, rx, ry, 0.0, 360.0);
+static MagickWand *image_to_wand(image_t *image) {
+  MagickWand *wand;
+  PixelWand *bgcolor;
 
-  DrawSetFillOpacity(draw, 0.0);
+  if ((wand = new_magick_wand()) == NULL) {
+    return NULL;
+  }
+  if ((bgcolor = new_pixel_wand()) == NULL) {
+    DestroyMagickWand(wand);
+    return NULL;
+  }
 
-  for (size_t i = 1;  i < OBJECT_CONCENTRIC_OUTLINE_COUNT;  ++i) {
-    float scale = (float) i / (float) OBJECT_CONCENTRIC_OUTLINE_COUNT;
-    DrawEllipse(draw, x, y, rx * scale, ry * scale, 0.0, 360.0);
+  if (PixelSetColor(bgcolor, "black") == MagickFalse) {
+    DestroyPixelWand(bgcolor);
+    DestroyMagickWand(wand);
+    return NULL;
   }
 
-  return 0;
-}
+  if (MagickNewImage(wand, image->width, image->height, bgcolor) == MagickFalse) {
+    DestroyPixelWand(bgcolor);
+    DestroyMagickWand(wand);
+    return NULL;
+  }
 
+  DestroyPixelWand(bgcolor);
 
-int draw_random_ellipse(DrawingWand *draw, PixelWand *pixel, float x, float y, float min_radius, float max_radius, size_t width) {
-  float rx, ry;
+  StorageType storage;
+  const char *map;
+  MagickBooleanType imported;
 
-  rx = rand_in_range(min_radius, max_radius);
-  ry = rand_in_range(min_radius, max_radius);
+  if (magick_storage(image->format, &storage, &map) == 0) {
+    imported = MagickImportImagePixels(wand, 0, 0, image->width, image->height, map, storage, image->pixels);
+  } else {
+    image_t *copy;
 
-  if (draw_ellipse(draw, x, y, rx, ry) == -1) return -1;
+    if ((copy = image_create(image->width, image->height)) == NULL) {
+      DestroyMagickWand(wand);
+      return NULL;
+    }
+    for (size_t y = 0;  y < image->height;  y++) {
+      image_load_pixel_t load = image_pixel_loader(image->format);
+      const void *row = image_get_row(image, y);
 
-  if (x - rx < 0.0) {
-    if (draw_ellipse(draw, x + (float) width, y, rx, ry) == -1) return -1;
+      for (size_t x = 0;  x < image->width;  x++) {
+        load(row, x, (float *) copy->pixels + 4 * (y * image->width + x));
+      }
+    }
+    imported = MagickImportImagePixels(wand, 0, 0, image->width, image->height, "RGBA", FloatPixel, copy->pixels);
+    image_destroy(copy);
   }
-  if (x + rx >= width) {
-    if (draw_ellipse(draw, x - (float) width, y, rx, ry) == -1) return -1;
+
+  if (imported == MagickFalse) {
+    DestroyMagickWand(wand);
+    return NULL;
   }
 
-  return 0;
+  return wand;
 }
 
 
-int polygon_falls_left(size_t count, const PointInfo *points) {
-  size_t i;
+int image_write(image_t *image, const char *filename) {
+  MagickWand *wand;
+
+  if (image_writer_supports(filename)) {
+    image_writer_t *writer;
 
-  for (i = 0;  i < count;  ++i) {
-    if (points[i].x < 0) {
-      return 1;
+    if ((writer = image_writer_open(filename, image->width, image->height)) == NULL) {
+      return -1;
+    }
+    if (image_writer_write_rows(writer, image) == -1) {
+      image_writer_close(writer);
+      return -1;
     }
+    return image_writer_close(writer);
   }
 
+  if ((wand = image_to_wand(image)) == NULL) {
+    return -1;
+  }
+
+  if (MagickWriteImage(wand, filename) == MagickFalse) {
+    DestroyMagickWand(wand);
+    return -1;
+  } 
+
+  DestroyMagickWand(wand);
+
   return 0;
 }
 
 
-int polygon_falls_right(size_t count, const PointInfo *points, size_t end) {
-  size_t i;
-
-  for (i = 0;  i < count;  ++i) {
-    if (points[i].x >= end) {
-      return 1;
-    }
+void image_get_pixel(const image_t *image, float *pixel, size_t x, size_t y) {
+  /* Sanity check. */
+  if (x >= image->width) {
+    fprintf(stderr, "x = %lu is outside the image, width = %lu\n", x, image->width);
+    exit(1);
+  }
+  if (y >= image->height) {
+    fprintf(stderr, "y = %lu is outside the image, height = %lu\n", y, image->height);
+    exit(1);
   }
 
-  return 0;
+  image_pixel_loader(image->format)(image_get_row(image, y), x, pixel);
 }
 
 
-void shift_polygon(PointInfo *dest, size_t count, const PointInfo *src, int offset) {
-  size_t i;
-
-  for (i = 0;  i < count;  ++i) {
-    dest[i].x = src[i].x + offset;
-    dest[i].y = src[i].y;
-  }
+void image_set_pixel(image_t *image, const float *pixel, size_t x, size_t y) {
+  image_pixel_storer(image->format)(image_get_row(image, y), x, pixel);
 }
 
 
-void scale_polygon(PointInfo *dest, size_t count, const PointInfo *src, float x, float y, float scale) {
-  for (size_t i = 0;  i < count;  ++i) {
-    dest[i].x = x + scale * (src[i].x - x);
-    dest[i].y = y + scale * (src[i].y - y);
-  }
+void image_set_pixel_color(image_t *image, color_t color, size_t x, size_t y) {
+  float pixel[4] = { color.red, color.green, color.blue, 1 };
+  image_set_pixel(image, pixel, x, y);
 }
 
 
-int draw_polygon(DrawingWand *draw, PointInfo *points, size_t point_count, float x, float y) {
-  PointInfo temp_points[30];
+size_t image_get_width(const image_t *image) {
+  return image->width;
+}
 
-  DrawSetFillOpacity(draw, 1.0);
 
-  DrawPolygon(draw, point_count, points);
+size_t image_get_height(const image_t *image) {
+  return image->height;
+}
 
-  DrawSetFillOpacity(draw, 0.0);
 
-  for (size_t i = 1;  i < OBJECT_CONCENTRIC_OUTLINE_COUNT;  ++i) {
-    float scale = (float) i / (float) OBJECT_CONCENTRIC_OUTLINE_COUNT;
-    scale_polygon(temp_points, point_count, points, x, y, scale);
-    DrawPolygon(draw, point_count, temp_points);
+/* Adds shape, along with copies a width or a height away wherever it (outline included) crosses
+   an edge, so that the texture tiles both ways. */
+static int add_wrapped_shape(raster_list_t *list, raster_shape_t *shape, float left, float top, float right, float bottom, size_t width, size_t height) {
+  float margin = 0.5f * shape->outline_width;
+  int wrap_x = left - margin < 0.0f ? 1 : (right + margin >= width ? -1 : 0);
+  int wrap_y = top - margin < 0.0f ? 1 : (bottom + margin >= height ? -1 : 0);
+
+  for (int i = 0;  i <= abs(wrap_x);  i++) {
+    for (int j = 0;  j <= abs(wrap_y);  j++) {
+      raster_shape_t copy = *shape;
+      float offset_x = (float) (i * wrap_x) * width;
+      float offset_y = (float) (j * wrap_y) * height;
+
+      copy.center_x += offset_x;
+      copy.center_y += offset_y;
+      for (size_t k = 0;  k < copy.point_count;  k++) {
+        copy.points[k][0] += offset_x;
+        copy.points[k][1] += offset_y;
+      }
+      if (raster_list_add(list, &copy) == -1) return -1;
+    }
   }
 
   return 0;
 }
 
 
-int draw_random_polygon(DrawingWand *draw, PixelWand *pixel, float x, float y, float min_radius, float max_radius, size_t width) {
-  size_t point_count;
-  size_t i;
-  PointInfo points[30];
-  PointInfo temp_points[30];
-  float radius;
+static int add_random_ellipse(raster_list_t *list, raster_shape_t *shape, rng_t *rng, float x, float y, float min_radius, float max_radius, size_t width, size_t height) {
+  float rx, ry;
 
-  point_count = (size_t) rand_in_range_int(3, 8);
+  rx = rand_in_range(rng, min_radius, max_radius);
+  ry = rand_in_range(rng, min_radius, max_radius);
 
-  float angle_offset = rand_normal() * 2.0f * M_PI;
+  shape->type = RASTER_SHAPE_ELLIPSE;
+  shape->center_x = x;
+  shape->center_y = y;
+  shape->radius_x = rx;
+  shape->radius_y = ry;
+  shape->point_count = 0;
 
-  for (i = 0;  i < point_count;  ++i) {
-    float angle = angle_offset + ((float) i / (float) point_count) * 2.0f * M_PI;
-    radius = rand_in_range(min_radius, max_radius);
-    points[i].x = x + radius * cosf(angle);
-    points[i].y = y + radius * sinf(angle);
-  }
+  return add_wrapped_shape(list, shape, x - rx, y - ry, x + rx, y + ry, width, height);
+}
 
-  if (draw_polygon(draw, points, point_count, x, y) == -1) return -1;
 
-  if (polygon_falls_left(point_count, points)) {
-    shift_polygon(temp_points, point_count, points, (int) width);
-    if (draw_polygon(draw, temp_points, point_count, x + width, y) == -1) return -1;
-  }
-  if (polygon_falls_right(point_count, points, width)) {
-    shift_polygon(temp_points, point_count, points, -((int) width));
-    if (draw_polygon(draw, temp_points, point_count, x - width, y) == -1) return -1;
+static int add_random_polygon(raster_list_t *list, raster_shape_t *shape, rng_t *rng, float x, float y, float min_radius, float max_radius, size_t width, size_t height) {
+  size_t point_count;
+  float left = x, top = y, right = x, bottom = y;
+
+  point_count = (size_t) rand_in_range_int(rng, 3, 8);
+
+  float angle_offset = rand_normal(rng) * 2.0f * M_PI;
+
+  shape->type = RASTER_SHAPE_POLYGON;
+  shape->center_x = x;
+  shape->center_y = y;
+  shape->point_count = point_count;
+
+  for (size_t i = 0;  i < point_count;  ++i) {
+    float angle = angle_offset + ((float) i / (float) point_count) * 2.0f * M_PI;
+    float radius = rand_in_range(rng, min_radius, max_radius);
+
+    shape->points[i][0] = x + radius * cosf(angle);
+    shape->points[i][1] = y + radius * sinf(angle);
+    left = fminf(left, shape->points[i][0]);
+    right = fmaxf(right, shape->points[i][0]);
+    top = fminf(top, shape->points[i][1]);
+    bottom = fmaxf(bottom, shape->points[i][1]);
   }
 
-  return 0;
+  return add_wrapped_shape(list, shape, left, top, right, bottom, width, height);
 }
 
 
@@ -414,16 +797,14 @@ static color_t ramp_color_for_row(size_t row, size_t height, const color_ramp_t
 }
 
 
-static image_t *image_create_random_objects(size_t width, size_t height, linear_density_t pixel_density, draw_object_t draw_object) {
-  DrawingWand *draw = NULL;
-  PixelWand *pixel = NULL;
+static image_t *image_create_random_objects(size_t width, size_t height, linear_density_t pixel_density, add_object_t add_object, thread_pool_t *pool, rng_t *rng) {
+  raster_list_t list;
+  raster_shape_t shape;
   size_t object_count;
 
-  image_t *image = NULL;
   image_t *retval = NULL;
 
-  if ((draw = NewDrawingWand()) == NULL) goto bad;
-  if ((pixel = NewPixelWand()) == NULL) goto bad;
+  raster_list_init(&list);
 
   length_t physical_width = length_for_count(pixel_density, width);
   length_t physical_height = length_for_count(pixel_density, height);
@@ -445,53 +826,65 @@ static image_t *image_create_random_objects(size_t width, size_t height, linear_
 
   float object_border_width_pixels = count_per_length(pixel_density, object_border_width);
 
-  if (PixelSetColor(pixel, "black") == MagickFalse) goto bad;
-  DrawSetStrokeColor(draw, pixel);
-  DrawSetStrokeWidth(draw, object_border_width_pixels);
+  memset(&shape, 0, sizeof(shape));
+  shape.fill[3] = 1.0f;
+  shape.outline_count = OBJECT_CONCENTRIC_OUTLINE_COUNT;
+  shape.outline_width = object_border_width_pixels;
+  shape.outline[3] = 1.0f;  /* black */
 
   for (size_t i = 0;  i < object_count;  ++i) {
-    float x = rand_normal() * width;
-    float y = rand_normal() * height;
+    float x = rand_normal(rng) * width;
+    float y = rand_normal(rng) * height;
 
     color_t color;
     color_from_hsv(&color, 0.5, 0.5, 0.5);
-    color_jitter_hsv(&color, COLOR_JITTER_MAX);
+    color_jitter_hsv(rng, &color, COLOR_JITTER_MAX);
 
-    if (set_fill_color(draw, pixel, color) == -1) goto bad;
+    shape.fill[0] = color.red;
+    shape.fill[1] = color.green;
+    shape.fill[2] = color.blue;
 
-    if (draw_object(draw, pixel, x, y, object_radius_min_pixels, object_radius_max_pixels, width) == -1) goto bad;
+    if (add_object(&list, &shape, rng, x, y, object_radius_min_pixels, object_radius_max_pixels, width, height) == -1) goto cleanup;
   }
 
-  if ((image = drawing_wand_to_image(draw, width, height)) == NULL) goto bad;
-
-  retval = image;
+  retval = raster_render(&list, width, height, random_background, pool);
 
  cleanup:
-  if (pixel) DestroyPixelWand(pixel);
-  if (draw) DestroyDrawingWand(draw);
+  raster_list_destroy(&list);
 
   return retval;
-
- bad:
-  if (image) image_destroy(image);
-  retval = NULL;
-  goto cleanup;
 }
 
 
-// Returns NaN on error.
-static float perlin_noise_for_pixel(perlin3d_t *perlin, unsigned texture_width, unsigned row, unsigned col) {
-  // In order to make the texture tileable horizontally, we map the texture row
-  // to a circle in the XZ plane in Perlin space.  (This is why we use 3D perlin
-  // noise instead of 2D.)  We'll make the circumference the same length as the row
-  // so that the noise's horizontal scale matches its vertical.
+// In order to make the texture tileable horizontally, we map the texture row
+// to a circle in the XZ plane in Perlin space.  (This is why we use 3D perlin
+// noise instead of 2D.)  We'll make the circumference the same length as the row
+// so that the noise's horizontal scale matches its vertical.
+//
+// The circle is the same for every row, so it's worked out once: the returned
+// table holds every column's x, then every column's z.  Periodic noise tiles
+// by itself, so for it x is just the column, and there is no z.
+static float *perlin_circle_create(size_t texture_width, noise_kernel_t noise_kernel) {
   float radius = texture_width / (2 * M_PI);
-  float angle_radians = ((float) col / (float) texture_width) * 2 * M_PI;
-  float x = radius * cos(angle_radians);
-  float z = radius * sin(angle_radians);
+  float *circle;
 
-  float point[3] = { x, row, z };
-  return perlin3d_get(perlin, point);
+  if ((circle = malloc(2 * texture_width * sizeof(*circle))) == NULL) {
+    PERROR("perlin circle allocation");
+    return NULL;
+  }
+
+  for (size_t col = 0;  col < texture_width;  col++) {
+    float angle_radians = ((float) col / (float) texture_width) * 2 * M_PI;
+    if (noise_kernel == NOISE_KERNEL_PERIODIC) {
+      circle[col] = col;
+      circle[texture_width + col] = 0;
+    } else {
+      circle[col] = radius * cos(angle_radians);
+      circle[texture_width + col] = radius * sin(angle_radians);
+    }
+  }
+
+  return circle;
 }
 
 
@@ -532,67 +925,157 @@ static void outer_perlin_color_map(float color[4], float input) {
 }
 
 
-static int perlin_color_for_pixel(float color[4], perlin3d_t *perlin, unsigned texture_width, unsigned row, unsigned col, void (*color_map)(float color[4], float input)) {
-  float noise = perlin_noise_for_pixel(perlin, texture_width, row, col);
-  if (isnan(noise)) return -1;
-  color_map(color, noise);
-  return 0;
+/* Lays overlay over dest, weighted by overlay's alpha scaled by overlay_opacity. */
+static inline void blend_pixel(float dest[4], const float overlay[4], float overlay_opacity) {
+  float overlay_alpha = overlay[3] * overlay_opacity;
+  float dest_alpha = 1.0 - overlay_alpha;
+  for (int i = 0;  i < 4;  i++) {
+    dest[i] = (dest_alpha * dest[i]) + (overlay_alpha * overlay[i]);
+  }
 }
 
 
-static int row_render_perlin_noise(image_t *image, unsigned row, perlin3d_t *perlin, void (*color_map)(float color[4], float input)) {
-  for (unsigned col = 0;  col < image->width;  col++) {
-    float color[4];
-    if (perlin_color_for_pixel(color, perlin, image->width, row, col, color_map) == -1) return -1;
-    image_set_pixel(image, color, col, row);
+typedef struct {
+  noise_kernel_t kernel;
+  perlin3d_t perlin;  /* for NOISE_KERNEL_PERLIN3D and NOISE_KERNEL_SIMPLEX */
+  perlin2d_t periodic;  /* for NOISE_KERNEL_PERIODIC */
+  void (*color_map)(float color[4], float input);
+  float opacity;
+} perlin_layer_t;
+
+
+#define PERLIN_LAYER_COUNT 2
+
+
+typedef struct {
+  image_t *image;
+  const perlin_layer_t *layers;  /* bottom first */
+  const float *circle;
+  size_t seam_row;  /* the first row that fades toward the top */
+  float *noise;  /* a row's worth per layer, and one more, per worker */
+} perlin_job_t;
+
+
+static int perlin_layer_init(perlin_layer_t *layer, noise_kernel_t kernel, float scale, size_t width, perlin_seed_t seed) {
+  layer->kernel = kernel;
+
+  if (kernel == NOISE_KERNEL_PERIODIC) {
+    return perlin2d_init(&layer->periodic, scale, (float) width, seed);
   }
+  return perlin3d_init(&layer->perlin, scale, seed);
+}
 
-  return 0;
+
+static void perlin_layer_destroy(perlin_layer_t *layer) {
+  if (layer->kernel != NOISE_KERNEL_PERIODIC) {
+    perlin3d_destroy(&layer->perlin);
+  }
 }
 
 
-static int render_perlin_noise(image_t *image, float perlin_scale, void (*color_map)(float color[4], float input)) {
-  int retval = 0;
-  perlin3d_t perlin;
+static void perlin_layer_get_row(const perlin_layer_t *layer, const float *circle, float y, size_t width, float *noise) {
+  switch (layer->kernel) {
+    case NOISE_KERNEL_PERLIN3D:
+      perlin3d_get_row(&layer->perlin, circle, y, &circle[width], width, noise);
+      break;
+    case NOISE_KERNEL_SIMPLEX:
+      simplex3d_get_row(&layer->perlin, circle, y, &circle[width], width, noise);
+      break;
+    case NOISE_KERNEL_PERIODIC:
+      perlin2d_get_row(&layer->periodic, circle, y, width, noise);
+      break;
+  }
+}
+
+
+/* Works out every layer's noise for the row, then color maps and stacks the layers pixel by
+   pixel, so that the layers never have to be stored as images of their own. */
+static int row_render_perlin_task(void *arg, size_t row, unsigned worker) {
+  const perlin_job_t *job = arg;
+  size_t width = job->image->width;
+  size_t height = job->image->height;
+  float *noise = &job->noise[worker * (PERLIN_LAYER_COUNT + 1) * width];
+  float *above = &noise[PERLIN_LAYER_COUNT * width];
+
+  for (int layer = 0;  layer < PERLIN_LAYER_COUNT;  layer++) {
+    float *layer_noise = &noise[layer * width];
+
+    perlin_layer_get_row(&job->layers[layer], job->circle, (float) row, width, layer_noise);
 
-  if (perlin3d_init(&perlin, perlin_scale, rand()) == -1) return -1;
+    if (row >= job->seam_row) {
+      /* Cross fade toward the noise a texture height up, which the last row meets the top
+         with.  Two independent noises mixed linearly come out flatter, which dividing by the
+         length of the weights puts right. */
+      float t = (float) (row - job->seam_row + 1) / (float) (height - job->seam_row + 1);
+      float gain = 1.0f / sqrtf((1.0f - t) * (1.0f - t) + t * t);
 
-  for (unsigned row = 0;  row < image->height;  row++) {
-    if (row_render_perlin_noise(image, row, &perlin, color_map) == -1) goto bad;
+      perlin_layer_get_row(&job->layers[layer], job->circle, (float) row - (float) height, width, above);
+      for (size_t col = 0;  col < width;  col++) {
+        layer_noise[col] = gain * ((1.0f - t) * layer_noise[col] + t * above[col]);
+      }
+    }
   }
 
- cleanup:
-  perlin3d_destroy(&perlin);
+  for (size_t col = 0;  col < width;  col++) {
+    float pixel[4] = { 0, 0, 0, 0 };
 
-  return retval;
+    for (int layer = 0;  layer < PERLIN_LAYER_COUNT;  layer++) {
+      float color[4];
 
- bad:
-  retval = -1;
-  goto cleanup;
-}
+      job->layers[layer].color_map(color, noise[layer * width + col]);
+      blend_pixel(pixel, color, job->layers[layer].opacity);
+    }
 
+    image_set_pixel(job->image, pixel, col, row);
+  }
 
-static image_t *image_create_perlin(size_t width, size_t height, linear_density_t pixel_density) {
-  image_t *result = NULL;
-  image_t *overlay = NULL;
+  return 0;
+}
 
-  if ((result = image_create(width, height)) == NULL) goto bad;
 
-  if ((overlay = image_create(width, height)) == NULL) goto bad;
+static image_t *image_create_perlin(size_t width, size_t height, linear_density_t pixel_density, noise_kernel_t noise_kernel, rng_t *rng, thread_pool_t *pool) {
+  image_t *result = NULL;
+  float *circle = NULL;
+  float *noise = NULL;
+  perlin_layer_t layers[PERLIN_LAYER_COUNT];
 
   length_t inner_length = length_from_millimeters(PERLIN_INNER_LENGTH_MILLIS);
   length_t outer_length = length_from_millimeters(PERLIN_OUTER_LENGTH_MILLIS);
   float inner_scale = count_per_length(pixel_density, inner_length);
   float outer_scale = count_per_length(pixel_density, outer_length);
 
-  if (render_perlin_noise(overlay, inner_scale, inner_perlin_color_map) == -1) goto bad;
-  image_blend_overlay(result, overlay, PERLIN_INNER_OPACITY);
+  if (perlin_layer_init(&layers[0], noise_kernel, inner_scale, width, rng_next(rng)) == -1) return NULL;
+  layers[0].color_map = inner_perlin_color_map;
+  layers[0].opacity = PERLIN_INNER_OPACITY;
+
+  if (perlin_layer_init(&layers[1], noise_kernel, outer_scale, width, rng_next(rng)) == -1) {
+    perlin_layer_destroy(&layers[0]);
+    return NULL;
+  }
+  layers[1].color_map = outer_perlin_color_map;
+  layers[1].opacity = PERLIN_OUTER_OPACITY;
+
+  if ((result = image_create(width, height)) == NULL) goto bad;
+
+  if ((circle = perlin_circle_create(width, noise_kernel)) == NULL) goto bad;
+
+  if ((noise = malloc(thread_pool_get_thread_count(pool) * (PERLIN_LAYER_COUNT + 1) * width * sizeof(*noise))) == NULL) {
+    PERROR("perlin noise row allocation");
+    goto bad;
+  }
+
+  /* Rows only read the noise tables and write themselves, so any thread can take any row, and
+     the result doesn't depend on which did. */
+  perlin_job_t job = { result, layers, circle, height - (size_t) (PERLIN_SEAM_FRACTION * height), noise };
+
+  if (thread_pool_run(pool, height, row_render_perlin_task, &job) == -1) goto bad;
 
-  if (render_perlin_noise(overlay, outer_scale, outer_perlin_color_map) == -1) goto bad;
-  image_blend_overlay(result, overlay, PERLIN_OUTER_OPACITY);
-  
  cleanup:
-  if (overlay) image_destroy(overlay);
+  free(noise);
+  free(circle);
+  for (int layer = 0;  layer < PERLIN_LAYER_COUNT;  layer++) {
+    perlin_layer_destroy(&layers[layer]);
+  }
 
   return result;
 
@@ -603,15 +1086,13 @@ static image_t *image_create_perlin(size_t width, size_t height, linear_density_
 }
 
 
-static image_t *image_create_random_dots(size_t width, size_t height, linear_density_t pixel_density) {
-  DrawingWand *draw = NULL;
-  PixelWand *color_wand = NULL;
+static image_t *image_create_random_dots(size_t width, size_t height, linear_density_t pixel_density, thread_pool_t *pool, rng_t *rng) {
+  raster_list_t list;
+  raster_shape_t shape;
 
-  image_t *image = NULL;
   image_t *retval = NULL;
 
-  if ((draw = NewDrawingWand()) == NULL) goto bad;
-  if ((color_wand = NewPixelWand()) == NULL) goto bad;
+  raster_list_init(&list);
 
   length_t physical_width = length_for_count(pixel_density, width);
   length_t physical_height = length_for_count(pixel_density, height);
@@ -627,6 +1108,10 @@ static image_t *image_create_random_dots(size_t width, size_t height, linear_den
   float dot_width_pixels = count_per_length(pixel_density, dot_physical_width);
   float dot_height_pixels = count_per_length(pixel_density, dot_physical_height);
 
+  memset(&shape, 0, sizeof(shape));
+  shape.type = RASTER_SHAPE_RECTANGLE;
+  shape.fill[3] = 1.0f;
+
   for (size_t dot_x = 0;  dot_x < dot_count_x;  dot_x++) {
     float x = dot_x * dot_width_pixels;
     for (size_t dot_y = 0;  dot_y < dot_count_y;  dot_y++) {
@@ -634,165 +1119,249 @@ static image_t *image_create_random_dots(size_t width, size_t height, linear_den
 
       color_t color;
       color_from_hsv(&color, 0.5, 0.5, 0.5);
-      color_scale_value(&color, rand_normal());
+      color_scale_value(&color, rand_normal(rng));
 
-      char color_str[30];
-      color_magick_string(&color, color_str, sizeof(color_str));
+      shape.left = x;
+      shape.top = y;
+      shape.right = x + dot_width_pixels;
+      shape.bottom = y + dot_height_pixels;
+      shape.fill[0] = color.red;
+      shape.fill[1] = color.green;
+      shape.fill[2] = color.blue;
 
-      if (PixelSetColor(color_wand, color_str) == MagickFalse) goto bad;
-      DrawSetFillColor(draw, color_wand);
-      DrawRectangle(draw, x, y, x + dot_width_pixels, y + dot_height_pixels);
+      if (raster_list_add(&list, &shape) == -1) goto cleanup;
     }
   }
 
-  if ((image = drawing_wand_to_image(draw, width, height)) == NULL) goto bad;
-
-  retval = image;
+  retval = raster_render(&list, width, height, random_background, pool);
 
  cleanup:
-  if (color_wand) DestroyPixelWand(color_wand);
-  if (draw) DestroyDrawingWand(draw);
+  raster_list_destroy(&list);
 
   return retval;
-
- bad:
-  if (image) image_destroy(image);
-  retval = NULL;
-  goto cleanup;
 }
 
 
-image_t *image_create_random(size_t width, size_t height, linear_density_t pixel_density, pattern_t type) {
+image_t *image_create_random(size_t width, size_t height, linear_density_t pixel_density, pattern_t type, noise_kernel_t noise_kernel, uint64_t seed, thread_pool_t *pool) {
+  rng_t rng;
+
+  rng_seed(&rng, seed);
+
   if (type == PATTERN_TYPE_PERLIN) {
-    return image_create_perlin(width, height, pixel_density);
+    return image_create_perlin(width, height, pixel_density, noise_kernel, &rng, pool);
   }
 
   if (type == PATTERN_TYPE_DOTS) {
-    return image_create_random_dots(width, height, pixel_density);
+    return image_create_random_dots(width, height, pixel_density, pool, &rng);
   }
 
-  draw_object_t draw = NULL;
+  add_object_t add_object = NULL;
   switch (type) {
     case PATTERN_TYPE_POLYGONS:
-      draw = draw_random_polygon;
+      add_object = add_random_polygon;
       break;
     case PATTERN_TYPE_ELLIPSES:
-      draw = draw_random_ellipse;
+      add_object = add_random_ellipse;
       break;
     default:
       errno = EINVAL;
       return NULL;
   }
 
-  return image_create_random_objects(width, height, pixel_density, draw);
+  return image_create_random_objects(width, height, pixel_density, add_object, pool, &rng);
 }
 
 
-int image_add_noise(image_t *image) {
-  MagickWand *wand = NULL;
-  int retval = 0;
+/* A counter-based generator: each number is a hash of its position, so rows can be noised in any
+   order on any thread without sharing state.  The hash is Chris Wellons' lowbias32. */
+static inline v4su noise_hash(v4su x) {
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x;
+}
 
-  if ((wand = image_to_wand(image)) == NULL) goto bad;
-  if (MagickAddNoiseImage(wand, PoissonNoise) == MagickFalse) goto bad;
-  if (magic_wand_to_allocated_image(wand, image) == -1) goto bad;
 
- cleanup:
-  if (wand) DestroyMagickWand(wand);
+typedef struct {
+  image_t *image;
+  uint64_t key;
+} noise_job_t;
 
- return retval;
 
- bad:
-  retval = -1;
-  goto cleanup;
+static int row_add_noise_task(void *arg, size_t row, unsigned worker) {
+  const noise_job_t *job = arg;
+  image_load_row_t load = image_row_loader(job->image->format);
+  image_store_row_t store = image_row_storer(job->image->format);
+  void *pixels = image_get_row(job->image, row);
+  float chunk[4 * PIXEL_CHUNK];
+  uint64_t row_key = job->key ^ (row * 0x9e3779b97f4a7c15);
+  v4su key = { 0, 0, 0, 0 };
+  v4su lanes = { 0, 1, 2, 3 };
+  v4sf rgb = { 1.0f, 1.0f, 1.0f, 0.0f };
+
+  key += (uint32_t) (row_key ^ (row_key >> 32));
+
+  for (size_t start = 0;  start < job->image->width;  start += PIXEL_CHUNK) {
+    size_t count = job->image->width - start < PIXEL_CHUNK ? job->image->width - start : PIXEL_CHUNK;
+
+    load(pixels, start, count, chunk);
+
+    for (size_t i = 0;  i < count;  i++) {
+      size_t x = start + i;
+      float *pixel = &chunk[4 * i];
+      float first[4];
+
+      v4sf value = v4sf_load(pixel);
+      v4sf lambda = v4sf_max(value, v4sf_splat(0.0f)) * v4sf_splat(NOISE_POISSON_SCALE);
+      v4su bits = noise_hash(((v4su) { 4, 4, 4, 4 } * (uint32_t) x + lanes) * 0x9e3779b9u ^ key);
+      /* Alpha is left alone by drawing a 0, which the count stops at straight away. */
+      v4sf u = __builtin_convertvector(bits >> 8, v4sf) * v4sf_splat(1.0f / 16777216.0f) * rgb;
+
+      for (int c = 0;  c < 4;  c++) {
+        first[c] = expf(-lambda[c]);
+      }
+
+      /* Inverts the Poisson distribution's CDF, every channel at once: keep counting up while the
+         draw is above the probability of a count this small. */
+      v4sf probability = v4sf_load(first);
+      v4sf cdf = probability;
+      v4sf events = v4sf_splat(0.0f);
+
+      for (int n = 0;  n < NOISE_POISSON_MAX_COUNT;  n++) {
+        v4si more = u > cdf;
+
+        if (!(more[0] | more[1] | more[2] | more[3])) break;
+
+        v4sf next_events = events + v4sf_splat(1.0f);
+        v4sf next_probability = probability * lambda / next_events;
+
+        events = v4sf_select(more, next_events, events);
+        probability = v4sf_select(more, next_probability, probability);
+        cdf += v4sf_select(more, probability, v4sf_splat(0.0f));
+      }
+
+      v4sf noisy = v4sf_min(events * v4sf_splat(1.0f / NOISE_POISSON_SCALE), v4sf_splat(1.0f));
+
+      pixel[0] = noisy[0];
+      pixel[1] = noisy[1];
+      pixel[2] = noisy[2];
+    }
+
+    store(pixels, start, count, chunk);
+  }
+
+  return 0;
 }
 
 
-int image_scale(image_t *image, size_t width, size_t height) {
-  MagickWand *wand;
-  float *pixels;
+int image_add_noise(image_t *image, uint64_t seed, thread_pool_t *pool) {
+  noise_job_t job = { image, 0 };
+  rng_t rng;
+
+  rng_seed_stream(&rng, seed, NOISE_RNG_STREAM);
+  job.key = rng_next(&rng);
+
+  return thread_pool_run(pool, image->height, row_add_noise_task, &job);
+}
+
+
+int image_scale(image_t *image, size_t width, size_t height, image_filter_t filter, thread_pool_t *pool) {
+  image_t *scaled;
 
   if (image->width == width && image->height == height) {
     /* The image is already at the target dimensions. */
     return 0;
   }
 
-  if ((wand = image_to_wand(image)) == NULL) {
-    return -1;
-  }
-
-  if (MagickScaleImage(wand, width, height) == MagickFalse) {
-    DestroyMagickWand(wand);
-    return -1;
-  }
+  if ((scaled = image_create_with_format(width, height, image->format)) == NULL) return -1;
 
-  if ((pixels = realloc(image->pixels, 4 * width * height * sizeof(*image->pixels))) == NULL) {
-    DestroyMagickWand(wand);
+  if (image_resample(image, scaled, filter, pool) == -1) {
+    image_destroy(scaled);
     return -1;
   }
 
+  free(image->pixels);
   image->width = width;
   image->height = height;
-  image->pixels = pixels;
+  image->pixels = scaled->pixels;
+  free(scaled);
 
-  if (magic_wand_to_allocated_image(wand, image) == -1) {
-    wand = DestroyMagickWand(wand);
-    return -1;
-  }
+  return 0;
+}
 
-  DestroyMagickWand(wand);
 
-  return 0;
+void image_apply_color_ramp(image_t *image, const color_ramp_t *color_ramp, blend_method_t blend_method) {
+  image_apply_color_ramp_band(image, color_ramp, blend_method, 0, image->height);
 }
 
 
-void image_blend_overlay(image_t *dest, image_t *overlay, float overlay_opacity) {
-  size_t row_max = dest->height < overlay->height ? dest->height : overlay->height;
-  size_t col_max = dest->width < overlay->width ? dest->width : overlay->width;
-  for (size_t row = 0;  row < row_max;  row++) {
-    for (size_t col = 0;  col < col_max;  col++) {
-      float dest_pixel[4];
-      float overlay_pixel[4];
-      image_get_pixel(dest, dest_pixel, col, row);
-      image_get_pixel(overlay, overlay_pixel, col, row);
-      float overlay_alpha = overlay_pixel[3] * overlay_opacity;
-      float dest_alpha = 1.0 - overlay_alpha;
-      for (int i = 0;  i < 4;  i++) {
-	dest_pixel[i] = (dest_alpha * dest_pixel[i]) + (overlay_alpha * overlay_pixel[i]);
+/* Blends color into count RGBA pixels, at most PIXEL_CHUNK of them. */
+static void blend_ramp_color(float *pixels, size_t count, color_t color, blend_method_t blend_method) {
+  switch (blend_method) {
+    case BLEND_METHOD_ALPHA:
+      for (size_t i = 0;  i < count;  i++) {
+        float *pixel = &pixels[4 * i];
+        float pixel_alpha = pixel[3];
+        float color_alpha = 1.0 - pixel_alpha;
+        pixel[0] = pixel_alpha * pixel[0] + color_alpha * color.red;
+        pixel[1] = pixel_alpha * pixel[1] + color_alpha * color.green;
+        pixel[2] = pixel_alpha * pixel[2] + color_alpha * color.blue;
+        pixel[3] = 1.0;
+      }
+      break;
+    case BLEND_METHOD_OFFSET: {
+      /* The pixels' hue, saturation and value are shifted by the ramp color's, relative to a
+         middling gray.  The conversions go channel by channel, so they take the whole chunk at
+         once. */
+      float red[PIXEL_CHUNK];
+      float green[PIXEL_CHUNK];
+      float blue[PIXEL_CHUNK];
+      float ramp_hue, ramp_saturation, ramp_value;
+
+      rgb_to_hsv_n(&color.red, &color.green, &color.blue, &ramp_hue, &ramp_saturation, &ramp_value, 1);
+
+      for (size_t i = 0;  i < count;  i++) {
+        red[i] = pixels[4 * i];
+        green[i] = pixels[4 * i + 1];
+        blue[i] = pixels[4 * i + 2];
+      }
+
+      rgb_to_hsv_n(red, green, blue, red, green, blue, count);
+      for (size_t i = 0;  i < count;  i++) {
+        red[i] = wrap_float(red[i] - 0.5 + ramp_hue, 0.0, 1.0);
+        green[i] = cap_float(green[i] - 0.5 + ramp_saturation, 0.0, 1.0);
+        blue[i] = cap_float(blue[i] - 0.5 + ramp_value, 0.0, 1.0);
       }
-      image_set_pixel(dest, dest_pixel, col, row);
+      hsv_to_rgb_n(red, green, blue, red, green, blue, count);
+
+      for (size_t i = 0;  i < count;  i++) {
+        pixels[4 * i] = red[i];
+        pixels[4 * i + 1] = green[i];
+        pixels[4 * i + 2] = blue[i];
+      }
+      break;
     }
   }
 }
 
 
-void image_apply_color_ramp(image_t *image, const color_ramp_t *color_ramp, blend_method_t blend_method) {
+void image_apply_color_ramp_band(image_t *image, const color_ramp_t *color_ramp, blend_method_t blend_method, size_t first_row, size_t full_height) {
+  image_load_row_t load = image_row_loader(image->format);
+  image_store_row_t store = image_row_storer(image->format);
+
   for (size_t row = 0;  row < image->height;  row++) {
-    color_t color = ramp_color_for_row(row, image->height, color_ramp);
-    for (size_t col = 0;  col < image->width;  col++) {
-      float pixel[4];
-      image_get_pixel(image, pixel, col, row);
-      switch (blend_method) {
-        case BLEND_METHOD_ALPHA:
-	  float pixel_alpha = pixel[3];
-	  float color_alpha = 1.0 - pixel_alpha;
-	  pixel[0] = pixel_alpha * pixel[0] + color_alpha * color.red;
-	  pixel[1] = pixel_alpha * pixel[1] + color_alpha * color.green;
-	  pixel[2] = pixel_alpha * pixel[2] + color_alpha * color.blue;
-	  pixel[3] = 1.0;
-	  break;
-        case BLEND_METHOD_OFFSET:
-	  color_t pixel_color;
-	  color_from_rgb(&pixel_color, pixel[0], pixel[1], pixel[2]);
-	  float hue = wrap_float(color_h(&pixel_color) - 0.5 + color_h(&color), 0.0, 1.0);
-	  float sat = cap_float(color_s(&pixel_color) - 0.5 + color_s(&color), 0.0, 1.0);
-	  float val = cap_float(color_v(&pixel_color) - 0.5 + color_v(&color), 0.0, 1.0);
-	  color_from_hsv(&pixel_color, hue, sat, val);
-	  pixel[0] = pixel_color.red;
-	  pixel[1] = pixel_color.green;
-	  pixel[2] = pixel_color.blue;
-	  break;
-      }
-      image_set_pixel(image, pixel, col, row);
+    color_t color = ramp_color_for_row(first_row + row, full_height, color_ramp);
+    void *pixels = image_get_row(image, row);
+
+    for (size_t start = 0;  start < image->width;  start += PIXEL_CHUNK) {
+      float chunk[4 * PIXEL_CHUNK];
+      size_t count = image->width - start < PIXEL_CHUNK ? image->width - start : PIXEL_CHUNK;
+
+      load(pixels, start, count, chunk);
+      blend_ramp_color(chunk, count, color, blend_method);
+      store(pixels, start, count, chunk);
     }
   }
 }
@@ -802,7 +1371,7 @@ int image_color_from_string(color_t *dest, const char *str) {
   int retval = 0;
 
   PixelWand *color;
-  if ((color = NewPixelWand()) == NULL) goto bad;
+  if ((color = new_pixel_wand()) == NULL) goto bad;
   if (PixelSetColor(color, str) == MagickFalse) goto bad;
 
   color_from_rgb(dest, PixelGetRed(color), PixelGetGreen(color), PixelGetBlue(color));
@@ -817,6 +1386,19 @@ int image_color_from_string(color_t *dest, const char *str) {
 }
 
 
+noise_kernel_t image_noise_kernel_from_name(const char *name) {
+  if (!strcmp(name, "perlin3d")) {
+    return NOISE_KERNEL_PERLIN3D;
+  } else if (!strcmp(name, "simplex")) {
+    return NOISE_KERNEL_SIMPLEX;
+  } else if (!strcmp(name, "periodic")) {
+    return NOISE_KERNEL_PERIODIC;
+  } else {
+    return -1;
+  }
+}
+
+
 pattern_t image_pattern_type_from_name(const char *name) {
   if (!strcmp(name, "perlin")) {
     return PATTERN_TYPE_PERLIN;
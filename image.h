@@ -5,18 +5,48 @@
 #include "color.h"
 #include "color_ramp.h"
 #include "metrics.h"
+#include "thread_pool.h"
 
+#include <stdint.h>
 #include <stdlib.h>
 
 
+typedef enum {
+  IMAGE_SAMPLE_U8,
+  IMAGE_SAMPLE_U16,
+  IMAGE_SAMPLE_HALF,  /* IEEE 754 binary16, stored as uint16_t */
+  IMAGE_SAMPLE_FLOAT,
+} image_sample_type_t;
+
+
+/* How an image's pixels are stored.  Pixels always come and go as four floats (RGBA, 0..1) at
+   the interface, and an image without alpha reads back as opaque. */
+typedef struct image_pixel_format_tag {
+  image_sample_type_t type;
+  unsigned channels;  /* 3 for RGB, 4 for RGBA */
+} image_pixel_format_t;
+
+#define IMAGE_FORMAT_RGBA_FLOAT ((image_pixel_format_t) { IMAGE_SAMPLE_FLOAT, 4 })
+
+
 typedef struct image_tag {
   size_t width;
   size_t height;
 
-  float *pixels;
+  image_pixel_format_t format;
+  void *pixels;  /* packed row by row, channels samples per pixel */
 } image_t;
 
 
+/* Per-format kernels for reading and writing pixel x of a row, which must be in bounds. */
+typedef void (*image_load_pixel_t)(const void *row, size_t x, float *pixel);
+typedef void (*image_store_pixel_t)(void *row, size_t x, const float *pixel);
+
+/* The same for count pixels starting at x, packed as four floats each. */
+typedef void (*image_load_row_t)(const void *row, size_t x, size_t count, float *pixels);
+typedef void (*image_store_row_t)(void *row, size_t x, size_t count, const float *pixels);
+
+
 typedef enum {
   PATTERN_TYPE_PERLIN,
   PATTERN_TYPE_POLYGONS,
@@ -27,21 +57,67 @@ typedef enum {
 } pattern_t;
 
 
+/* How the perlin pattern's noise is made to tile horizontally. */
+typedef enum {
+  NOISE_KERNEL_PERLIN3D,  /* 3D Perlin noise around a circle */
+  NOISE_KERNEL_SIMPLEX,  /* 3D simplex noise around the same circle */
+  NOISE_KERNEL_PERIODIC  /* 2D Perlin noise that repeats every texture width */
+} noise_kernel_t;
+
+
+/* How image_resample() weighs the source pixels around each destination pixel. */
+typedef enum {
+  IMAGE_FILTER_BOX,  /* the average of the area the pixel covers */
+  IMAGE_FILTER_BILINEAR,
+  IMAGE_FILTER_LANCZOS  /* 3 lobes */
+} image_filter_t;
+
+
 typedef enum {
   BLEND_METHOD_ALPHA,
   BLEND_METHOD_OFFSET,
 } blend_method_t;
 
 
-void image_init(void);  /* initialize the image library */
-void image_close(void);  /* close the image library */
+void image_close(void);  /* close the image library, if it was ever started */
 
+/* Creates a float RGBA image. */
 image_t *image_create(size_t width, size_t height);
 
+image_t *image_create_with_format(size_t width, size_t height, image_pixel_format_t format);
+
+/* Converts the image's pixels to another format, in place. */
+int image_convert(image_t *image, image_pixel_format_t format);
+
+/* Returns a new image with the same size, format and pixels. */
+image_t *image_copy(const image_t *image);
+
 void image_destroy(image_t *image);
 
 image_t *image_read(const char *filename);
 
+/* Reads the given channels (a channel map such as "RGB") of every pixel of an image file into a
+   newly allocated buffer, packed row by row.  The sample type is the narrowest one that holds
+   the file's bit depth.  Returns NULL on error. */
+void *image_read_samples(const char *filename, const char *channels, image_sample_type_t *type, size_t *width, size_t *height);
+
+size_t image_sample_size(image_sample_type_t type);
+size_t image_pixel_size(image_pixel_format_t format);
+
+image_load_pixel_t image_pixel_loader(image_pixel_format_t format);
+image_store_pixel_t image_pixel_storer(image_pixel_format_t format);
+image_load_row_t image_row_loader(image_pixel_format_t format);
+image_store_row_t image_row_storer(image_pixel_format_t format);
+
+float image_half_to_float(uint16_t half);
+
+/* Returns the start of the given row of pixels, for use with the loader and storer. */
+void *image_get_row(const image_t *image, size_t y);
+
+/* Parses names such as "rgba8", "rgb16", "rgbah" (half) and "rgbf".  Returns -1 if the name
+   isn't one of them. */
+int image_pixel_format_from_name(image_pixel_format_t *format, const char *name);
+
 int image_write(image_t *image, const char *filename);
 
 void image_get_pixel(const image_t *image, float *pixel, size_t x, size_t y);
@@ -52,18 +128,31 @@ void image_set_pixel_color(image_t *image, color_t color, size_t x, size_t y);
 size_t image_get_width(const image_t *image);
 size_t image_get_height(const image_t *image);
 
-image_t *image_create_random(size_t width, size_t height, linear_density_t pixel_density, pattern_t type);
+/* The same seed always gives the same texture, however many threads pool has.  The texture tiles
+   both ways, so a short one can be repeated down a tall stereogram. */
+image_t *image_create_random(size_t width, size_t height, linear_density_t pixel_density, pattern_t type, noise_kernel_t noise_kernel, uint64_t seed, thread_pool_t *pool);
 
-int image_add_noise(image_t *image);
+/* Adds Poisson noise to the color channels.  The same seed always gives the same noise, however
+   many threads pool has. */
+int image_add_noise(image_t *image, uint64_t seed, thread_pool_t *pool);
 
-int image_scale(image_t *image, size_t width, size_t height);
+/* Resamples source into dest, whatever size and format dest already has.  The two passes, across
+   and then down, are split by rows over pool. */
+int image_resample(const image_t *source, image_t *dest, image_filter_t filter, thread_pool_t *pool);
 
-void image_blend_overlay(image_t *dest, image_t *overlay, float overlay_opacity);
+/* Resamples the image to the given size in place. */
+int image_scale(image_t *image, size_t width, size_t height, image_filter_t filter, thread_pool_t *pool);
 
 void image_apply_color_ramp(image_t *image, const color_ramp_t *color_ramp, blend_method_t blend_method);
 
+/* For when image is a band of rows cut out of a taller image: the ramp is laid over the full
+   height, and image's first row is row first_row of it. */
+void image_apply_color_ramp_band(image_t *image, const color_ramp_t *color_ramp, blend_method_t blend_method, size_t first_row, size_t full_height);
+
 int image_color_from_string(color_t *dest, const char *str);
 
 pattern_t image_pattern_type_from_name(const char *name);
 
+noise_kernel_t image_noise_kernel_from_name(const char *name);
+
 #endif
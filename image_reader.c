@@ -0,0 +1,328 @@
+
+#include "image_reader.h"
+
+#include "util.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+#define HOST_IS_LITTLE_ENDIAN (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+
+
+/* Where the parser is in the mapped file. */
+typedef struct {
+  const unsigned char *p;
+  const unsigned char *end;
+} cursor_t;
+
+
+static void skip_whitespace_and_comments(cursor_t *c) {
+  while (c->p < c->end) {
+    if (*c->p == '#') {
+      while (c->p < c->end && *c->p != '\n') c->p++;
+    } else if (isspace(*c->p)) {
+      c->p++;
+    } else {
+      break;
+    }
+  }
+}
+
+
+static int read_header_size(cursor_t *c, size_t *value) {
+  size_t v = 0;
+
+  skip_whitespace_and_comments(c);
+
+  if (c->p >= c->end || !isdigit(*c->p)) {
+    return -1;
+  }
+
+  while (c->p < c->end && isdigit(*c->p)) {
+    if (v > (SIZE_MAX - 9) / 10) {
+      return -1;
+    }
+    v = 10 * v + (*c->p++ - '0');
+  }
+
+  *value = v;
+
+  return 0;
+}
+
+
+static int read_header_float(cursor_t *c, float *value) {
+  char buffer[64];
+  size_t length = 0;
+  char *end;
+
+  skip_whitespace_and_comments(c);
+
+  while (c->p < c->end && !isspace(*c->p) && length + 1 < sizeof(buffer)) {
+    buffer[length++] = *c->p++;
+  }
+  buffer[length] = '\0';
+
+  *value = strtof(buffer, &end);
+
+  return (length == 0 || *end) ? -1 : 0;
+}
+
+
+/* The header ends with exactly one whitespace character before the data. */
+static int end_header(cursor_t *c) {
+  if (c->p >= c->end || !isspace(*c->p)) {
+    return -1;
+  }
+  c->p++;
+
+  return 0;
+}
+
+
+static int has_room(const cursor_t *c, size_t width, size_t height, size_t pixel_size) {
+  return width > 0 && height > 0
+         && width <= SIZE_MAX / height
+         && width * height <= SIZE_MAX / pixel_size
+         && width * height * pixel_size <= (size_t) (c->end - c->p);
+}
+
+
+static uint16_t load_u16_be(const unsigned char *p) {
+  return (uint16_t) ((p[0] << 8) | p[1]);
+}
+
+
+static float load_float(const unsigned char *p, int little_endian) {
+  unsigned char bytes[4];
+  float f;
+
+  if (little_endian == HOST_IS_LITTLE_ENDIAN) {
+    memcpy(&f, p, sizeof(f));
+  } else {
+    bytes[0] = p[3];
+    bytes[1] = p[2];
+    bytes[2] = p[1];
+    bytes[3] = p[0];
+    memcpy(&f, bytes, sizeof(f));
+  }
+
+  return f;
+}
+
+
+static uint32_t load_u32_le(const unsigned char *p) {
+  return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+
+/* P5 (gray) and P6 (RGB).  Only maxvals of 255 and 65535 are handled here, since any other
+   would need rescaling. */
+static int read_netpbm(cursor_t *c, size_t channels, image_samples_t *samples) {
+  size_t maxval;
+
+  if (read_header_size(c, &samples->width) == -1) return -1;
+  if (read_header_size(c, &samples->height) == -1) return -1;
+  if (read_header_size(c, &maxval) == -1) return -1;
+  if (end_header(c) == -1) return -1;
+
+  samples->channels = channels;
+
+  if (maxval == 255) {
+    if (!has_room(c, samples->width, samples->height, channels)) return -1;
+
+    /* Already in the layout we want. */
+    samples->type = IMAGE_SAMPLE_U8;
+    samples->data = (void *) c->p;
+  } else if (maxval == 65535) {
+    size_t count = samples->width * samples->height * channels;
+    uint16_t *data;
+
+    if (!has_room(c, samples->width, samples->height, 2 * channels)) return -1;
+
+    /* Netpbm is big-endian, and the samples may not be aligned, so they have to be copied. */
+    if ((data = malloc(count * sizeof(*data))) == NULL) {
+      return -1;
+    }
+    for (size_t i = 0;  i < count;  i++) {
+      data[i] = load_u16_be(&c->p[2 * i]);
+    }
+
+    samples->type = IMAGE_SAMPLE_U16;
+    samples->data = data;
+  } else {
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/* PF (RGB) and Pf (gray).  A negative scale means little-endian, and rows go from the bottom up. */
+static int read_pfm(cursor_t *c, size_t channels, image_samples_t *samples) {
+  float scale;
+  size_t row_length;
+  float *data;
+
+  if (read_header_size(c, &samples->width) == -1) return -1;
+  if (read_header_size(c, &samples->height) == -1) return -1;
+  if (read_header_float(c, &scale) == -1 || scale == 0.0f) return -1;
+  if (end_header(c) == -1) return -1;
+
+  if (!has_room(c, samples->width, samples->height, channels * sizeof(float))) return -1;
+
+  row_length = samples->width * channels;
+
+  if ((data = malloc(samples->height * row_length * sizeof(*data))) == NULL) {
+    return -1;
+  }
+
+  for (size_t row = 0;  row < samples->height;  row++) {
+    const unsigned char *in = c->p + (samples->height - 1 - row) * row_length * sizeof(float);
+    float *out = &data[row * row_length];
+
+    for (size_t i = 0;  i < row_length;  i++) {
+      out[i] = load_float(&in[i * sizeof(float)], scale < 0.0f);
+    }
+  }
+
+  samples->channels = channels;
+  samples->type = IMAGE_SAMPLE_FLOAT;
+  samples->data = data;
+
+  return 0;
+}
+
+
+static int read_raw_depth(cursor_t *c, image_samples_t *samples) {
+  size_t count;
+
+  c->p += strlen(IMAGE_RAW_DEPTH_MAGIC);
+
+  if (c->end - c->p < 8) return -1;
+
+  samples->width = load_u32_le(c->p);
+  samples->height = load_u32_le(c->p + 4);
+  c->p += 8;
+
+  if (!has_room(c, samples->width, samples->height, sizeof(float))) return -1;
+
+  count = samples->width * samples->height;
+
+  samples->channels = 1;
+  samples->type = IMAGE_SAMPLE_FLOAT;
+
+  if (HOST_IS_LITTLE_ENDIAN && ((uintptr_t) c->p % sizeof(float)) == 0) {
+    samples->data = (void *) c->p;
+  } else {
+    float *data;
+
+    if ((data = malloc(count * sizeof(*data))) == NULL) {
+      return -1;
+    }
+    for (size_t i = 0;  i < count;  i++) {
+      data[i] = load_float(&c->p[i * sizeof(float)], 1);
+    }
+    samples->data = data;
+  }
+
+  return 0;
+}
+
+
+static int starts_with(const cursor_t *c, const char *magic) {
+  size_t length = strlen(magic);
+
+  return (size_t) (c->end - c->p) >= length && memcmp(c->p, magic, length) == 0;
+}
+
+
+int image_read_native_samples(const char *filename, image_samples_t *samples) {
+  int fd;
+  struct stat st;
+  void *mapping;
+  cursor_t c;
+  int result;
+
+  memset(samples, 0, sizeof(*samples));
+
+  if ((fd = open(filename, O_RDONLY)) == -1) {
+    return -1;
+  }
+
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return -1;
+  }
+
+  if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+    close(fd);
+    errno = ENOTSUP;
+    return -1;
+  }
+
+  mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (mapping == MAP_FAILED) {
+    return -1;
+  }
+
+  c.p = mapping;
+  c.end = c.p + st.st_size;
+
+  if (starts_with(&c, "P5")) {
+    c.p += 2;
+    result = read_netpbm(&c, 1, samples);
+  } else if (starts_with(&c, "P6")) {
+    c.p += 2;
+    result = read_netpbm(&c, 3, samples);
+  } else if (starts_with(&c, "Pf")) {
+    c.p += 2;
+    result = read_pfm(&c, 1, samples);
+  } else if (starts_with(&c, "PF")) {
+    c.p += 2;
+    result = read_pfm(&c, 3, samples);
+  } else if (starts_with(&c, IMAGE_RAW_DEPTH_MAGIC)) {
+    result = read_raw_depth(&c, samples);
+  } else {
+    result = -1;
+  }
+
+  if (result == -1) {
+    /* Either it's not one of our formats, or it's one that we can't make sense of, in which case
+       MagickWand can have a go at it and report the problem. */
+    munmap(mapping, st.st_size);
+    errno = ENOTSUP;
+    return -1;
+  }
+
+  if ((const unsigned char *) samples->data >= (const unsigned char *) mapping
+      && (const unsigned char *) samples->data < c.end) {
+    samples->mapping = mapping;
+    samples->mapping_size = st.st_size;
+  } else {
+    /* The samples were copied out, so the file isn't needed any more. */
+    munmap(mapping, st.st_size);
+  }
+
+  return 0;
+}
+
+
+void image_samples_release(image_samples_t *samples) {
+  if (samples->mapping) {
+    munmap(samples->mapping, samples->mapping_size);
+  } else {
+    free(samples->data);
+  }
+
+  samples->data = NULL;
+  samples->mapping = NULL;
+  samples->mapping_size = 0;
+}
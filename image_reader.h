@@ -0,0 +1,36 @@
+#ifndef IMAGE_READER_H
+#define IMAGE_READER_H
+
+#include "image.h"
+
+
+/* The magic number that starts a raw depth file.  It's followed by the width and height as
+   little-endian 32-bit unsigned integers, then one little-endian 32-bit float per pixel, row by
+   row from the top, where 0 is farthest away and 1 is nearest. */
+#define IMAGE_RAW_DEPTH_MAGIC "SGDEPTH1"
+
+
+/* An image's samples, packed row by row from the top, in host byte order.  If the file already
+   had them that way, data points straight into the mapped file and nothing was copied. */
+typedef struct image_samples_tag {
+  size_t width;
+  size_t height;
+  size_t channels;  /* 1 for gray, 3 for RGB */
+
+  image_sample_type_t type;
+  void *data;
+
+  void *mapping;  /* NULL if data was allocated */
+  size_t mapping_size;
+} image_samples_t;
+
+
+/* Reads binary PGM and PPM (8 or 16 bits per sample), PFM, and raw depth files without going
+   through MagickWand.  Fails with errno set to ENOTSUP for any other kind of file, in which case
+   the caller should fall back to MagickWand. */
+int image_read_native_samples(const char *filename, image_samples_t *samples);
+
+/* Frees or unmaps the samples' data. */
+void image_samples_release(image_samples_t *samples);
+
+#endif
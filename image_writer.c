@@ -0,0 +1,350 @@
+
+#include "image_writer.h"
+
+#include "simd.h"
+#include "util.h"
+
+#include <strings.h>
+
+
+#define HOST_IS_LITTLE_ENDIAN (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+
+#define QOI_OP_INDEX (0x00)
+#define QOI_OP_DIFF  (0x40)
+#define QOI_OP_LUMA  (0x80)
+#define QOI_OP_RUN   (0xc0)
+#define QOI_OP_RGB   (0xfe)
+#define QOI_OP_RGBA  (0xff)
+
+#define QOI_RUN_MAX (62)
+
+
+static int format_from_filename(const char *filename, image_writer_format_t *format) {
+  const char *extension = strrchr(filename, '.');
+
+  if (extension == NULL) {
+    return -1;
+  }
+  extension++;
+
+  if (strcasecmp(extension, "ppm") == 0) {
+    *format = IMAGE_WRITER_FORMAT_PPM;
+  } else if (strcasecmp(extension, "pam") == 0) {
+    *format = IMAGE_WRITER_FORMAT_PAM;
+  } else if (strcasecmp(extension, "pfm") == 0) {
+    *format = IMAGE_WRITER_FORMAT_PFM;
+  } else if (strcasecmp(extension, "qoi") == 0) {
+    *format = IMAGE_WRITER_FORMAT_QOI;
+  } else {
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/* The most bytes one pixel can encode to. */
+static size_t max_pixel_size(image_writer_format_t format) {
+  switch (format) {
+    case IMAGE_WRITER_FORMAT_PAM:
+      return 4 * sizeof(uint16_t);
+    case IMAGE_WRITER_FORMAT_PFM:
+      return 3 * sizeof(float);
+    case IMAGE_WRITER_FORMAT_QOI:
+      return 5;  /* QOI_OP_RGBA */
+    case IMAGE_WRITER_FORMAT_PPM:
+    default:
+      return 3 * sizeof(uint16_t);
+  }
+}
+
+
+static void put_u32_be(unsigned char *p, uint32_t value) {
+  p[0] = value >> 24;
+  p[1] = value >> 16;
+  p[2] = value >> 8;
+  p[3] = value;
+}
+
+
+static int write_header(image_writer_t *writer) {
+  unsigned char qoi_header[14];
+  int result;
+
+  switch (writer->format) {
+    case IMAGE_WRITER_FORMAT_PAM:
+      result = fprintf(writer->file, "P7\nWIDTH %zu\nHEIGHT %zu\nDEPTH 4\nMAXVAL 65535\nTUPLTYPE RGB_ALPHA\nENDHDR\n", writer->width, writer->height);
+      break;
+    case IMAGE_WRITER_FORMAT_PFM:
+      /* The sign of the scale gives the byte order, so the floats can be written as they are. */
+      result = fprintf(writer->file, "PF\n%zu %zu\n%s\n", writer->width, writer->height, HOST_IS_LITTLE_ENDIAN ? "-1.0" : "1.0");
+      break;
+    case IMAGE_WRITER_FORMAT_QOI:
+      if (writer->width > UINT32_MAX || writer->height > UINT32_MAX) {
+        errno = EFBIG;
+        return -1;
+      }
+      memcpy(qoi_header, "qoif", 4);
+      put_u32_be(&qoi_header[4], writer->width);
+      put_u32_be(&qoi_header[8], writer->height);
+      qoi_header[12] = 4;  /* RGBA */
+      qoi_header[13] = 0;  /* sRGB with linear alpha */
+      result = fwrite(qoi_header, 1, sizeof(qoi_header), writer->file) == sizeof(qoi_header) ? 0 : -1;
+      break;
+    case IMAGE_WRITER_FORMAT_PPM:
+    default:
+      result = fprintf(writer->file, "P6\n%zu %zu\n65535\n", writer->width, writer->height);
+      break;
+  }
+
+  if (result < 0) {
+    return -1;
+  }
+
+  writer->header_size = ftell(writer->file);
+
+  return 0;
+}
+
+
+/* Scales a pixel from 0..1 to 0..maxval, rounding to the nearest step.  Out of range samples are
+   clamped, and NaNs become 0. */
+static inline v4si quantize(const float *pixel, float maxval) {
+  v4sf clamped = v4sf_min(v4sf_max(v4sf_load(pixel), v4sf_splat(0.0f)), v4sf_splat(1.0f));
+  return __builtin_convertvector(clamped * v4sf_splat(maxval) + v4sf_splat(0.5f), v4si);
+}
+
+
+/* Netpbm samples are big-endian. */
+static size_t encode_netpbm_row(unsigned char *out, const float *pixels, size_t width, size_t channels) {
+  unsigned char *start = out;
+
+  for (size_t col = 0;  col < width;  col++, pixels += 4) {
+    v4si q = quantize(pixels, 65535.0f);
+
+    for (size_t i = 0;  i < channels;  i++) {
+      *out++ = q[i] >> 8;
+      *out++ = q[i] & 0xff;
+    }
+  }
+
+  return out - start;
+}
+
+
+static size_t encode_pfm_row(unsigned char *out, const float *pixels, size_t width) {
+  for (size_t col = 0;  col < width;  col++, pixels += 4) {
+    memcpy(&out[col * 3 * sizeof(float)], pixels, 3 * sizeof(float));
+  }
+
+  return width * 3 * sizeof(float);
+}
+
+
+static unsigned char *qoi_flush_run(image_writer_t *writer, unsigned char *out) {
+  if (writer->qoi_run > 0) {
+    *out++ = QOI_OP_RUN | (writer->qoi_run - 1);
+    writer->qoi_run = 0;
+  }
+
+  return out;
+}
+
+
+static size_t encode_qoi_row(image_writer_t *writer, unsigned char *out, const float *pixels, size_t width) {
+  unsigned char *start = out;
+  uint8_t *previous = writer->qoi_previous;
+
+  for (size_t col = 0;  col < width;  col++, pixels += 4) {
+    v4si q = quantize(pixels, 255.0f);
+    uint8_t px[4] = { q[0], q[1], q[2], q[3] };
+
+    if (memcmp(px, previous, 4) == 0) {
+      if (++writer->qoi_run == QOI_RUN_MAX) {
+        out = qoi_flush_run(writer, out);
+      }
+      continue;
+    }
+
+    out = qoi_flush_run(writer, out);
+
+    unsigned hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+
+    if (memcmp(writer->qoi_index[hash], px, 4) == 0) {
+      *out++ = QOI_OP_INDEX | hash;
+    } else {
+      memcpy(writer->qoi_index[hash], px, 4);
+
+      if (px[3] == previous[3]) {
+        int8_t dr = px[0] - previous[0];
+        int8_t dg = px[1] - previous[1];
+        int8_t db = px[2] - previous[2];
+        int8_t dr_dg = dr - dg;
+        int8_t db_dg = db - dg;
+
+        if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+          *out++ = QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+        } else if (dr_dg >= -8 && dr_dg <= 7 && dg >= -32 && dg <= 31 && db_dg >= -8 && db_dg <= 7) {
+          *out++ = QOI_OP_LUMA | (dg + 32);
+          *out++ = (dr_dg + 8) << 4 | (db_dg + 8);
+        } else {
+          *out++ = QOI_OP_RGB;
+          *out++ = px[0];
+          *out++ = px[1];
+          *out++ = px[2];
+        }
+      } else {
+        *out++ = QOI_OP_RGBA;
+        *out++ = px[0];
+        *out++ = px[1];
+        *out++ = px[2];
+        *out++ = px[3];
+      }
+    }
+
+    memcpy(previous, px, 4);
+  }
+
+  return out - start;
+}
+
+
+int image_writer_supports(const char *filename) {
+  image_writer_format_t format;
+
+  return format_from_filename(filename, &format) == 0;
+}
+
+
+image_writer_t *image_writer_open(const char *filename, size_t width, size_t height) {
+  image_writer_t *writer;
+
+  if ((writer = calloc(1, sizeof(*writer))) == NULL) {
+    PERROR("image writer allocation");
+    return NULL;
+  }
+
+  if (format_from_filename(filename, &writer->format) == -1) {
+    errno = ENOTSUP;
+    goto bad;
+  }
+
+  writer->width = width;
+  writer->height = height;
+
+  writer->qoi_previous[3] = 255;
+
+  /* One extra byte, for a QOI run left over from the previous row. */
+  if ((writer->row_buffer = malloc(width * max_pixel_size(writer->format) + 1)) == NULL) {
+    PERROR("row buffer allocation");
+    goto bad;
+  }
+
+  if ((writer->float_row = malloc(width * 4 * sizeof(*writer->float_row))) == NULL) {
+    PERROR("row buffer allocation");
+    goto bad;
+  }
+
+  if ((writer->file = fopen(filename, "wb")) == NULL) {
+    PERROR("opening output image");
+    goto bad;
+  }
+
+  if (write_header(writer) == -1) {
+    PERROR("writing image header");
+    goto bad;
+  }
+
+  return writer;
+
+ bad:
+  if (writer->file) fclose(writer->file);
+  free(writer->float_row);
+  free(writer->row_buffer);
+  free(writer);
+  return NULL;
+}
+
+
+int image_writer_write_rows(image_writer_t *writer, const image_t *band) {
+  int is_float_rgba = band->format.type == IMAGE_SAMPLE_FLOAT && band->format.channels == 4;
+  image_load_row_t load = image_row_loader(band->format);
+
+  if (band->width != writer->width || writer->rows_written + band->height > writer->height) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  for (size_t row = 0;  row < band->height;  row++) {
+    const float *pixels;
+    size_t size;
+
+    if (is_float_rgba) {
+      pixels = image_get_row(band, row);
+    } else {
+      load(image_get_row(band, row), 0, band->width, writer->float_row);
+      pixels = writer->float_row;
+    }
+
+    switch (writer->format) {
+      case IMAGE_WRITER_FORMAT_PAM:
+        size = encode_netpbm_row(writer->row_buffer, pixels, band->width, 4);
+        break;
+      case IMAGE_WRITER_FORMAT_PFM:
+        size = encode_pfm_row(writer->row_buffer, pixels, band->width);
+
+        /* PFM rows go from the bottom up. */
+        if (fseek(writer->file, writer->header_size + (long) ((writer->height - 1 - (writer->rows_written + row)) * size), SEEK_SET) == -1) {
+          PERROR("seeking in output image");
+          return -1;
+        }
+        break;
+      case IMAGE_WRITER_FORMAT_QOI:
+        size = encode_qoi_row(writer, writer->row_buffer, pixels, band->width);
+        break;
+      case IMAGE_WRITER_FORMAT_PPM:
+      default:
+        size = encode_netpbm_row(writer->row_buffer, pixels, band->width, 3);
+        break;
+    }
+
+    if (fwrite(writer->row_buffer, 1, size, writer->file) != size) {
+      PERROR("writing image rows");
+      return -1;
+    }
+  }
+
+  writer->rows_written += band->height;
+
+  return 0;
+}
+
+
+int image_writer_close(image_writer_t *writer) {
+  static const unsigned char qoi_end[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+  int retval = 0;
+
+  if (writer->rows_written != writer->height) {
+    fprintf(stderr, "Only %zu of %zu image rows were written\n", writer->rows_written, writer->height);
+    retval = -1;
+  } else if (writer->format == IMAGE_WRITER_FORMAT_QOI) {
+    size_t size = qoi_flush_run(writer, writer->row_buffer) - writer->row_buffer;
+
+    if (fwrite(writer->row_buffer, 1, size, writer->file) != size
+        || fwrite(qoi_end, 1, sizeof(qoi_end), writer->file) != sizeof(qoi_end)) {
+      PERROR("writing image end");
+      retval = -1;
+    }
+  }
+
+  if (fclose(writer->file) == EOF) {
+    PERROR("closing output image");
+    retval = -1;
+  }
+
+  free(writer->float_row);
+  free(writer->row_buffer);
+  free(writer);
+
+  return retval;
+}
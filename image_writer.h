@@ -0,0 +1,56 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include "image.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+
+typedef enum {
+  IMAGE_WRITER_FORMAT_PPM,
+  IMAGE_WRITER_FORMAT_PAM,
+  IMAGE_WRITER_FORMAT_PFM,
+  IMAGE_WRITER_FORMAT_QOI,
+} image_writer_format_t;
+
+
+/* Writes an image to a file a band of rows at a time, so the whole image never has to be held
+   in memory.  PPM and PAM are written at 16 bits per sample (the same depth MagickWand writes
+   them at), PFM as 32-bit floats, and QOI at 8 bits per sample. */
+typedef struct image_writer_tag {
+  FILE *file;
+  image_writer_format_t format;
+
+  size_t width;
+  size_t height;
+  size_t rows_written;
+
+  long header_size;
+
+  unsigned char *row_buffer;  /* one encoded row, or for QOI, the most one row can encode to */
+  float *float_row;  /* one row decoded to float RGBA, for bands in other pixel formats */
+
+  /* QOI encoder state, which carries on from one row to the next. */
+  uint8_t qoi_index[64][4];
+  uint8_t qoi_previous[4];
+  unsigned qoi_run;
+} image_writer_t;
+
+
+/* The format is chosen from the file name's extension.  Returns NULL with errno set to ENOTSUP
+   if the extension isn't one of the supported formats. */
+image_writer_t *image_writer_open(const char *filename, size_t width, size_t height);
+
+/* Appends every row of band, which must be as wide as the image, below the rows already
+   written. */
+int image_writer_write_rows(image_writer_t *writer, const image_t *band);
+
+/* Fails if fewer rows were written than the image has, or if flushing the file fails.  The
+   writer is freed either way. */
+int image_writer_close(image_writer_t *writer);
+
+/* Returns nonzero if image_writer_open() can handle the given file name. */
+int image_writer_supports(const char *filename);
+
+#endif
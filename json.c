@@ -0,0 +1,329 @@
+
+#include "json.h"
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+typedef struct {
+  const char *p;
+  const char *start;
+
+  char *error;
+  size_t error_size;
+} parser_t;
+
+
+static int fail(parser_t *parser, const char *fmt, ...) {
+  va_list ap;
+  int length;
+
+  length = snprintf(parser->error, parser->error_size, "column %ld: ", (long) (parser->p - parser->start) + 1);
+  if (length >= 0 && (size_t) length < parser->error_size) {
+    va_start(ap, fmt);
+    vsnprintf(parser->error + length, parser->error_size - length, fmt, ap);
+    va_end(ap);
+  }
+
+  return -1;
+}
+
+
+static void skip_whitespace(parser_t *parser) {
+  while (*parser->p == ' ' || *parser->p == '\t' || *parser->p == '\n' || *parser->p == '\r') {
+    parser->p++;
+  }
+}
+
+
+static int hex_digit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+
+/* Appends a code point to dest as UTF-8. */
+static char *put_utf8(char *dest, unsigned long code_point) {
+  if (code_point < 0x80) {
+    *dest++ = code_point;
+  } else if (code_point < 0x800) {
+    *dest++ = 0xc0 | (code_point >> 6);
+    *dest++ = 0x80 | (code_point & 0x3f);
+  } else if (code_point < 0x10000) {
+    *dest++ = 0xe0 | (code_point >> 12);
+    *dest++ = 0x80 | ((code_point >> 6) & 0x3f);
+    *dest++ = 0x80 | (code_point & 0x3f);
+  } else {
+    *dest++ = 0xf0 | (code_point >> 18);
+    *dest++ = 0x80 | ((code_point >> 12) & 0x3f);
+    *dest++ = 0x80 | ((code_point >> 6) & 0x3f);
+    *dest++ = 0x80 | (code_point & 0x3f);
+  }
+
+  return dest;
+}
+
+
+static int parse_hex4(parser_t *parser, unsigned long *value) {
+  *value = 0;
+
+  for (int i = 0;  i < 4;  i++) {
+    int digit = hex_digit(parser->p[i]);
+    if (digit == -1) {
+      return fail(parser, "invalid \\u escape");
+    }
+    *value = (*value << 4) | digit;
+  }
+  parser->p += 4;
+
+  return 0;
+}
+
+
+/* The decoded string is never longer than the quoted one, so dest needs no more room than
+   what's left of the text. */
+static int parse_string(parser_t *parser, char *dest) {
+  if (*parser->p != '"') {
+    return fail(parser, "expected a string");
+  }
+  parser->p++;
+
+  while (*parser->p != '"') {
+    unsigned char c = *parser->p;
+
+    if (c == '\0') {
+      return fail(parser, "unterminated string");
+    }
+    if (c < 0x20) {
+      return fail(parser, "control character in string");
+    }
+
+    if (c != '\\') {
+      *dest++ = c;
+      parser->p++;
+      continue;
+    }
+
+    parser->p++;
+    switch (*parser->p++) {
+      case '"':  *dest++ = '"';  break;
+      case '\\': *dest++ = '\\'; break;
+      case '/':  *dest++ = '/';  break;
+      case 'b':  *dest++ = '\b'; break;
+      case 'f':  *dest++ = '\f'; break;
+      case 'n':  *dest++ = '\n'; break;
+      case 'r':  *dest++ = '\r'; break;
+      case 't':  *dest++ = '\t'; break;
+      case 'u': {
+        unsigned long code_point;
+        unsigned long low;
+
+        if (parse_hex4(parser, &code_point) == -1) return -1;
+
+        if (code_point >= 0xd800 && code_point < 0xdc00) {
+          /* A surrogate pair. */
+          if (parser->p[0] != '\\' || parser->p[1] != 'u') {
+            return fail(parser, "unpaired surrogate");
+          }
+          parser->p += 2;
+          if (parse_hex4(parser, &low) == -1) return -1;
+          if (low < 0xdc00 || low >= 0xe000) {
+            return fail(parser, "unpaired surrogate");
+          }
+          code_point = 0x10000 + ((code_point - 0xd800) << 10) + (low - 0xdc00);
+        } else if (code_point >= 0xdc00 && code_point < 0xe000) {
+          return fail(parser, "unpaired surrogate");
+        } else if (code_point == 0) {
+          return fail(parser, "NUL in string");
+        }
+
+        dest = put_utf8(dest, code_point);
+        break;
+      }
+      default:
+        parser->p--;
+        return fail(parser, "invalid escape");
+    }
+  }
+  parser->p++;
+
+  *dest = '\0';
+
+  return 0;
+}
+
+
+static int parse_number(parser_t *parser, char *dest) {
+  const char *start = parser->p;
+
+  if (*parser->p == '-') parser->p++;
+
+  if (*parser->p == '0') {
+    parser->p++;
+  } else if (isdigit((unsigned char) *parser->p)) {
+    while (isdigit((unsigned char) *parser->p)) parser->p++;
+  } else {
+    return fail(parser, "invalid number");
+  }
+
+  if (*parser->p == '.') {
+    parser->p++;
+    if (!isdigit((unsigned char) *parser->p)) return fail(parser, "invalid number");
+    while (isdigit((unsigned char) *parser->p)) parser->p++;
+  }
+
+  if (*parser->p == 'e' || *parser->p == 'E') {
+    parser->p++;
+    if (*parser->p == '+' || *parser->p == '-') parser->p++;
+    if (!isdigit((unsigned char) *parser->p)) return fail(parser, "invalid number");
+    while (isdigit((unsigned char) *parser->p)) parser->p++;
+  }
+
+  memcpy(dest, start, parser->p - start);
+  dest[parser->p - start] = '\0';
+
+  return 0;
+}
+
+
+static int parse_literal(parser_t *parser, const char *literal) {
+  size_t length = strlen(literal);
+
+  if (strncmp(parser->p, literal, length) != 0) {
+    return fail(parser, "unexpected character '%c'", *parser->p);
+  }
+  parser->p += length;
+
+  return 0;
+}
+
+
+static int parse_value(parser_t *parser, json_value_t *value, char *buffer) {
+  value->text = NULL;
+
+  switch (*parser->p) {
+    case '"':
+      value->type = JSON_STRING;
+      value->text = buffer;
+      return parse_string(parser, buffer);
+    case 't':
+      value->type = JSON_TRUE;
+      return parse_literal(parser, "true");
+    case 'f':
+      value->type = JSON_FALSE;
+      return parse_literal(parser, "false");
+    case 'n':
+      value->type = JSON_NULL;
+      return parse_literal(parser, "null");
+    case '{':
+    case '[':
+      return fail(parser, "nested objects and arrays aren't supported");
+    default:
+      value->type = JSON_NUMBER;
+      value->text = buffer;
+      return parse_number(parser, buffer);
+  }
+}
+
+
+int json_parse_flat_object(const char *text, json_member_callback_t callback, void *arg, char *error, size_t error_size) {
+  parser_t parser = { text, text, error, error_size };
+  size_t length = strlen(text);
+  char *key = NULL;
+  char *buffer = NULL;
+  int retval = 0;
+
+  /* Neither a key nor a value can be longer than the whole text. */
+  if ((key = malloc(length + 1)) == NULL || (buffer = malloc(length + 1)) == NULL) {
+    snprintf(error, error_size, "out of memory");
+    goto bad;
+  }
+
+  skip_whitespace(&parser);
+  if (*parser.p != '{') {
+    fail(&parser, "expected '{'");
+    goto bad;
+  }
+  parser.p++;
+  skip_whitespace(&parser);
+
+  if (*parser.p == '}') {
+    parser.p++;
+  } else {
+    for (;;) {
+      json_value_t value;
+
+      skip_whitespace(&parser);
+      if (parse_string(&parser, key) == -1) goto bad;
+
+      skip_whitespace(&parser);
+      if (*parser.p != ':') {
+        fail(&parser, "expected ':'");
+        goto bad;
+      }
+      parser.p++;
+
+      skip_whitespace(&parser);
+      if (parse_value(&parser, &value, buffer) == -1) goto bad;
+
+      if (callback(arg, key, &value) == -1) goto bad;
+
+      skip_whitespace(&parser);
+      if (*parser.p == ',') {
+        parser.p++;
+      } else if (*parser.p == '}') {
+        parser.p++;
+        break;
+      } else {
+        fail(&parser, "expected ',' or '}'");
+        goto bad;
+      }
+    }
+  }
+
+  skip_whitespace(&parser);
+  if (*parser.p != '\0') {
+    fail(&parser, "unexpected text after the object");
+    goto bad;
+  }
+
+ cleanup:
+  free(key);
+  free(buffer);
+
+  return retval;
+
+ bad:
+  retval = -1;
+  goto cleanup;
+}
+
+
+int json_write_string(FILE *file, const char *s) {
+  if (fputc('"', file) == EOF) return -1;
+
+  for (;  *s;  s++) {
+    unsigned char c = *s;
+    int written;
+
+    switch (c) {
+      case '"':  written = fputs("\\\"", file);  break;
+      case '\\': written = fputs("\\\\", file);  break;
+      case '\n': written = fputs("\\n", file);  break;
+      case '\r': written = fputs("\\r", file);  break;
+      case '\t': written = fputs("\\t", file);  break;
+      default:
+        written = c < 0x20 ? fprintf(file, "\\u%04x", c) : fputc(c, file);
+        break;
+    }
+
+    if (written < 0) return -1;
+  }
+
+  return fputc('"', file) == EOF ? -1 : 0;
+}
@@ -0,0 +1,37 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+
+typedef enum {
+  JSON_STRING,
+  JSON_NUMBER,
+  JSON_TRUE,
+  JSON_FALSE,
+  JSON_NULL,
+} json_type_t;
+
+
+typedef struct json_value_tag {
+  json_type_t type;
+  const char *text;  /* the decoded string, or a number as written; NULL for the others */
+} json_value_t;
+
+
+/* Called once per member, in order.  key and value->text are only valid during the call.
+   Returning -1 stops the parse, and it's up to the callback to say why. */
+typedef int (*json_member_callback_t)(void *arg, const char *key, const json_value_t *value);
+
+
+/* Parses a single JSON object whose members are all strings, numbers, booleans or null, which
+   is all our manifests and requests need.  Nested objects and arrays are rejected.  On a syntax
+   error, returns -1 with a description in error. */
+int json_parse_flat_object(const char *text, json_member_callback_t callback, void *arg, char *error, size_t error_size);
+
+
+/* Writes s to file as a quoted JSON string. */
+int json_write_string(FILE *file, const char *s);
+
+#endif
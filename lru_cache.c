@@ -0,0 +1,90 @@
+
+#include "lru_cache.h"
+
+#include "util.h"
+
+#include <string.h>
+
+
+int lru_cache_init(lru_cache_t *cache, size_t capacity, lru_cache_destroy_t destroy) {
+  if ((cache->entries = calloc(capacity, sizeof(*cache->entries))) == NULL) {
+    PERROR("cache allocation");
+    return -1;
+  }
+
+  cache->capacity = capacity;
+  cache->clock = 0;
+  cache->destroy = destroy;
+
+  return 0;
+}
+
+
+static void clear_entry(lru_cache_t *cache, lru_cache_entry_t *entry) {
+  if (entry->key) {
+    free(entry->key);
+    cache->destroy(entry->value);
+    entry->key = NULL;
+    entry->value = NULL;
+  }
+}
+
+
+void lru_cache_destroy(lru_cache_t *cache) {
+  for (size_t i = 0;  i < cache->capacity;  i++) {
+    clear_entry(cache, &cache->entries[i]);
+  }
+  free(cache->entries);
+}
+
+
+void *lru_cache_get(lru_cache_t *cache, const char *key) {
+  for (size_t i = 0;  i < cache->capacity;  i++) {
+    lru_cache_entry_t *entry = &cache->entries[i];
+
+    if (entry->key && strcmp(entry->key, key) == 0) {
+      entry->last_used = ++cache->clock;
+      return entry->value;
+    }
+  }
+
+  return NULL;
+}
+
+
+int lru_cache_put(lru_cache_t *cache, const char *key, void *value) {
+  lru_cache_entry_t *victim = NULL;
+  char *key_copy;
+
+  if (cache->capacity == 0) {
+    errno = ENOSPC;
+    return -1;
+  }
+
+  if ((key_copy = strdup(key)) == NULL) {
+    PERROR("cache key allocation");
+    return -1;
+  }
+
+  /* The entry already holding key if there is one, else an unused entry, else the least
+     recently used one. */
+  for (size_t i = 0;  i < cache->capacity;  i++) {
+    lru_cache_entry_t *entry = &cache->entries[i];
+
+    if (entry->key && strcmp(entry->key, key) == 0) {
+      victim = entry;
+      break;
+    }
+    if (victim == NULL || (victim->key && (entry->key == NULL || entry->last_used < victim->last_used))) {
+      victim = entry;
+    }
+  }
+
+  clear_entry(cache, victim);
+
+  victim->key = key_copy;
+  victim->value = value;
+  victim->last_used = ++cache->clock;
+
+  return 0;
+}
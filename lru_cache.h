@@ -0,0 +1,37 @@
+#ifndef LRU_CACHE_H
+#define LRU_CACHE_H
+
+#include <stdlib.h>
+
+
+typedef void (*lru_cache_destroy_t)(void *value);
+
+
+typedef struct lru_cache_entry_tag {
+  char *key;  /* NULL if the entry is unused */
+  void *value;
+  unsigned long last_used;
+} lru_cache_entry_t;
+
+
+/* Up to capacity values by string key.  Once it's full, adding a value evicts the least recently
+   used one.  Lookups scan every entry, so it's meant for a handful of large values. */
+typedef struct lru_cache_tag {
+  lru_cache_entry_t *entries;
+  size_t capacity;
+  unsigned long clock;  /* counts uses, to tell which entry was used least recently */
+  lru_cache_destroy_t destroy;  /* frees an evicted value */
+} lru_cache_t;
+
+
+int lru_cache_init(lru_cache_t *cache, size_t capacity, lru_cache_destroy_t destroy);
+void lru_cache_destroy(lru_cache_t *cache);
+
+/* Returns the value for key, or NULL if it isn't cached. */
+void *lru_cache_get(lru_cache_t *cache, const char *key);
+
+/* Adds value under key, replacing any value already there.  The cache owns value from then on,
+   unless this fails. */
+int lru_cache_put(lru_cache_t *cache, const char *key, void *value);
+
+#endif
@@ -1,81 +1,465 @@
 #include "perlin.h"
+#include "rng.h"
+#include "simd.h"
 #include "util.h"
 
 #include <math.h>
 #include <stdlib.h>
 
+static void shuffle_permutation(uint16_t perm[2 * PERLIN_PERIOD], rng_t *rng) {
+    for (unsigned i = 0;  i < PERLIN_PERIOD;  i++) {
+        perm[i] = (uint16_t) i;
+    }
+    for (unsigned i = PERLIN_PERIOD - 1;  i > 0;  i--) {
+        size_t j = rand_index(rng, i + 1);
+        uint16_t swap = perm[i];
+        perm[i] = perm[j];
+        perm[j] = swap;
+    }
+    for (unsigned i = 0;  i < PERLIN_PERIOD;  i++) {
+        perm[PERLIN_PERIOD + i] = perm[i];
+    }
+}
+
 int perlin3d_init(perlin3d_t *perlin3d, float scale, perlin_seed_t seed) {
+    rng_t rng;
+
     perlin3d->scale = scale;
-    perlin3d->seed = seed;
+
+    rng_seed(&rng, seed);
+
+    shuffle_permutation(perlin3d->perm, &rng);
+
+    for (unsigned i = 0;  i < PERLIN_PERIOD;  i++) {
+        float *gradient = perlin3d->gradients[i];
+        float sum;
+
+        // Points picked from inside the unit ball point in every direction equally often.
+        do {
+            sum = 0;
+            for (int axis = 0;  axis < 3;  axis++) {
+                gradient[axis] = rand_in_range(&rng, -1.0, 1.0);
+                sum += gradient[axis] * gradient[axis];
+            }
+        } while (sum > 1.0f || sum < 1e-6f);
+
+        float length = sqrtf(sum);
+        for (int axis = 0;  axis < 3;  axis++) {
+            gradient[axis] /= length;
+        }
+    }
+
     return 0;
 }
 
 void perlin3d_destroy(perlin3d_t *perlin3d) {
 }
 
-static unsigned int generate_lattice_point_seed(float lattice_point[3], perlin_seed_t seed) {
-    unsigned total_bit_count = sizeof(unsigned int) * 8;
-    unsigned bits_per_part = total_bit_count / 4;
+static inline float ease(float t) {
+    return t * t * (3 - 2 * t);
+}
+
+static inline float lerp(float a, float b, float t) {
+    return a + t * (b - a);
+}
+
+static inline float corner_dot(const perlin3d_t *perlin3d, unsigned hash, float x, float y, float z) {
+    const float *gradient = perlin3d->gradients[hash];
+    return gradient[0] * x + gradient[1] * y + gradient[2] * z;
+}
+
+float perlin3d_get(const perlin3d_t *perlin3d, const float point[3]) {
+    const uint16_t *perm = perlin3d->perm;
+    float x = point[0] / perlin3d->scale;
+    float y = point[1] / perlin3d->scale;
+    float z = point[2] / perlin3d->scale;
+    float floor_x = floorf(x);
+    float floor_y = floorf(y);
+    float floor_z = floorf(z);
+
+    // The lattice cell, wrapped to the table's period, and where the point sits inside it.
+    unsigned cx = (unsigned) (int) floor_x & (PERLIN_PERIOD - 1);
+    unsigned cy = (unsigned) (int) floor_y & (PERLIN_PERIOD - 1);
+    unsigned cz = (unsigned) (int) floor_z & (PERLIN_PERIOD - 1);
+    float fx = x - floor_x;
+    float fy = y - floor_y;
+    float fz = z - floor_z;
+
+    unsigned a = perm[cx] + cy;
+    unsigned b = perm[cx + 1] + cy;
+    unsigned aa = perm[a] + cz;
+    unsigned ab = perm[a + 1] + cz;
+    unsigned ba = perm[b] + cz;
+    unsigned bb = perm[b + 1] + cz;
+
+    float x00 = lerp(corner_dot(perlin3d, perm[aa], fx, fy, fz), corner_dot(perlin3d, perm[ba], fx - 1, fy, fz), ease(fx));
+    float x10 = lerp(corner_dot(perlin3d, perm[ab], fx, fy - 1, fz), corner_dot(perlin3d, perm[bb], fx - 1, fy - 1, fz), ease(fx));
+    float x01 = lerp(corner_dot(perlin3d, perm[aa + 1], fx, fy, fz - 1), corner_dot(perlin3d, perm[ba + 1], fx - 1, fy, fz - 1), ease(fx));
+    float x11 = lerp(corner_dot(perlin3d, perm[ab + 1], fx, fy - 1, fz - 1), corner_dot(perlin3d, perm[bb + 1], fx - 1, fy - 1, fz - 1), ease(fx));
+
+    return lerp(lerp(x00, x10, ease(fy)), lerp(x01, x11, ease(fy)), ease(fz));
+}
+
+#define PERLIN_BATCH 4  /* points per perlin3d_get_row() step */
+
+static inline v4sf ease4(v4sf t) {
+    return t * t * (3 - 2 * t);
+}
+
+static inline v4sf lerp4(v4sf a, v4sf b, v4sf t) {
+    return a + t * (b - a);
+}
+
+// Rounds toward negative infinity, setting *cell to the result's wrapped lattice coordinate.
+static inline v4sf floor4(v4sf v, v4si *cell) {
+    v4si truncated = __builtin_convertvector(v, v4si);
+    v4sf result = __builtin_convertvector(truncated, v4sf);
+
+    // Truncation rounds negative values up; comparisons give -1 where they hold.
+    truncated += (v4si) (result > v);
+    *cell = truncated & (PERLIN_PERIOD - 1);
+    return __builtin_convertvector(truncated, v4sf);
+}
+
+static void get_batch(const perlin3d_t *perlin3d, const float *x_in, float y_in, const float *z_in, float *noise) {
+    const uint16_t *perm = perlin3d->perm;
+    v4sf scale = v4sf_splat(perlin3d->scale);
+    v4sf x = v4sf_load(x_in) / scale;
+    v4sf z = v4sf_load(z_in) / scale;
+    float y = y_in / perlin3d->scale;
+    float floor_y = floorf(y);
+    unsigned cy = (unsigned) (int) floor_y & (PERLIN_PERIOD - 1);
+    v4si cx, cz;
+    v4sf fx = x - floor4(x, &cx);
+    v4sf fz = z - floor4(z, &cz);
+    v4sf fy = v4sf_splat(y - floor_y);
+
+    // The hashing is table lookups, which vectors can't do, so each lane gathers its corners'
+    // gradients one at a time.  gradient[corner][axis][lane], with corners numbered zyx.
+    float gradient[8][3][PERLIN_BATCH];
+
+    for (int lane = 0;  lane < PERLIN_BATCH;  lane++) {
+        unsigned a = perm[cx[lane]] + cy;
+        unsigned b = perm[cx[lane] + 1] + cy;
+        unsigned hash[4] = { perm[a] + cz[lane], perm[b] + cz[lane], perm[a + 1] + cz[lane], perm[b + 1] + cz[lane] };
+
+        for (int corner = 0;  corner < 8;  corner++) {
+            const float *g = perlin3d->gradients[perm[hash[corner & 3] + (corner >> 2)]];
+            gradient[corner][0][lane] = g[0];
+            gradient[corner][1][lane] = g[1];
+            gradient[corner][2][lane] = g[2];
+        }
+    }
+
+    v4sf dot[8];
+    for (int corner = 0;  corner < 8;  corner++) {
+        v4sf dx = fx - (float) (corner & 1);
+        v4sf dy = fy - (float) ((corner >> 1) & 1);
+        v4sf dz = fz - (float) (corner >> 2);
+        dot[corner] = v4sf_load(gradient[corner][0]) * dx + v4sf_load(gradient[corner][1]) * dy + v4sf_load(gradient[corner][2]) * dz;
+    }
+
+    v4sf ex = ease4(fx);
+    v4sf ey = ease4(fy);
+    v4sf x00 = lerp4(dot[0], dot[1], ex);
+    v4sf x10 = lerp4(dot[2], dot[3], ex);
+    v4sf x01 = lerp4(dot[4], dot[5], ex);
+    v4sf x11 = lerp4(dot[6], dot[7], ex);
+
+    v4sf_store(noise, lerp4(lerp4(x00, x10, ey), lerp4(x01, x11, ey), ease4(fz)));
+}
+
+void perlin3d_get_row(const perlin3d_t *perlin3d, const float *x, float y, const float *z, size_t count, float *noise) {
+    size_t i;
+
+    for (i = 0;  i + PERLIN_BATCH <= count;  i += PERLIN_BATCH) {
+        get_batch(perlin3d, &x[i], y, &z[i], &noise[i]);
+    }
+
+    if (i < count) {
+        // Pad the last few points out to a whole batch.
+        float last_x[PERLIN_BATCH] = { 0 };
+        float last_z[PERLIN_BATCH] = { 0 };
+        float last_noise[PERLIN_BATCH];
+
+        memcpy(last_x, &x[i], (count - i) * sizeof(*x));
+        memcpy(last_z, &z[i], (count - i) * sizeof(*z));
+        get_batch(perlin3d, last_x, y, last_z, last_noise);
+        memcpy(&noise[i], last_noise, (count - i) * sizeof(*noise));
+    }
+}
+
+// Brings simplex and 2D noise to about the same spread as 3D Perlin noise, which the texture
+// color maps' thresholds were tuned for.
+#define SIMPLEX3D_AMPLITUDE 19.0f
+#define PERLIN2D_AMPLITUDE 0.845f
 
-    unsigned mask = (1 << bits_per_part) - 1;
+static inline float simplex_corner(const perlin3d_t *perlin3d, unsigned hash, float x, float y, float z) {
+    float t = 0.6f - x * x - y * y - z * z;
 
-    return ((int) lattice_point[0] & mask)
-        + (((int) lattice_point[1] & mask) << bits_per_part)
-        + (((int) lattice_point[2] & mask) << (2 * bits_per_part))
-	+ ((seed & mask) << (3 * bits_per_part));
+    if (t <= 0) {
+        return 0;
+    }
+    t *= t;
+    return t * t * corner_dot(perlin3d, hash, x, y, z);
 }
 
-static void gradient_for_lattice_point(float gradient[3], float lattice_point[3], perlin_seed_t seed) {
-    unsigned int lattice_seed = generate_lattice_point_seed(lattice_point, seed);
+float simplex3d_get(const perlin3d_t *perlin3d, const float point[3]) {
+    const float skew = 1.0f / 3.0f;
+    const float unskew = 1.0f / 6.0f;
+    const uint16_t *perm = perlin3d->perm;
+    float x = point[0] / perlin3d->scale;
+    float y = point[1] / perlin3d->scale;
+    float z = point[2] / perlin3d->scale;
 
-    float sum = 0;
-    for (int i = 0;  i < 3;  i++) {
-	gradient[i] = rand_r_in_range(&lattice_seed, -1.0, 1.0);
-	sum += gradient[i] * gradient[i];
+    // Skewing space turns the tetrahedra into cubes, so finding the cell is a floor again.
+    float s = (x + y + z) * skew;
+    float i = floorf(x + s);
+    float j = floorf(y + s);
+    float k = floorf(z + s);
+    float t = (i + j + k) * unskew;
+    float x0 = x - (i - t);
+    float y0 = y - (j - t);
+    float z0 = z - (k - t);
+
+    // Which of the cube's six tetrahedra the point is in follows from the order of its
+    // coordinates: the second and third corners step along the largest, then the next.
+    int i1, j1, k1, i2, j2, k2;
+    if (x0 >= y0) {
+        if (y0 >= z0) {
+            i1 = 1; j1 = 0; k1 = 0; i2 = 1; j2 = 1; k2 = 0;
+        } else if (x0 >= z0) {
+            i1 = 1; j1 = 0; k1 = 0; i2 = 1; j2 = 0; k2 = 1;
+        } else {
+            i1 = 0; j1 = 0; k1 = 1; i2 = 1; j2 = 0; k2 = 1;
+        }
+    } else {
+        if (y0 < z0) {
+            i1 = 0; j1 = 0; k1 = 1; i2 = 0; j2 = 1; k2 = 1;
+        } else if (x0 < z0) {
+            i1 = 0; j1 = 1; k1 = 0; i2 = 0; j2 = 1; k2 = 1;
+        } else {
+            i1 = 0; j1 = 1; k1 = 0; i2 = 1; j2 = 1; k2 = 0;
+        }
     }
 
-    // normalize
-    float length = sqrtf(sum);
-    for (int i = 0;  i < 3;  i++) {
-	gradient[i] /= length;
+    unsigned ci = (unsigned) (int) i & (PERLIN_PERIOD - 1);
+    unsigned cj = (unsigned) (int) j & (PERLIN_PERIOD - 1);
+    unsigned ck = (unsigned) (int) k & (PERLIN_PERIOD - 1);
+
+    float sum = simplex_corner(perlin3d, perm[perm[perm[ci] + cj] + ck], x0, y0, z0)
+        + simplex_corner(perlin3d, perm[perm[perm[ci + i1] + cj + j1] + ck + k1],
+                         x0 - i1 + unskew, y0 - j1 + unskew, z0 - k1 + unskew)
+        + simplex_corner(perlin3d, perm[perm[perm[ci + i2] + cj + j2] + ck + k2],
+                         x0 - i2 + 2 * unskew, y0 - j2 + 2 * unskew, z0 - k2 + 2 * unskew)
+        + simplex_corner(perlin3d, perm[perm[perm[ci + 1] + cj + 1] + ck + 1],
+                         x0 - 1 + 3 * unskew, y0 - 1 + 3 * unskew, z0 - 1 + 3 * unskew);
+
+    return SIMPLEX3D_AMPLITUDE * sum;
+}
+
+// Comparisons give -1 where they hold; this makes that 1.0, and 0 elsewhere.
+static inline v4sf mask_to_one(v4si mask) {
+    return (v4sf) (mask & (v4si) v4sf_splat(1.0f));
+}
+
+static inline v4sf simplex_corner4(v4sf gradient[3], v4sf x, v4sf y, v4sf z) {
+    v4sf t = v4sf_max(0.6f - x * x - y * y - z * z, v4sf_splat(0));
+
+    t *= t;
+    return t * t * (gradient[0] * x + gradient[1] * y + gradient[2] * z);
+}
+
+static void simplex_batch(const perlin3d_t *perlin3d, const float *x_in, float y_in, const float *z_in, float *noise) {
+    const float skew = 1.0f / 3.0f;
+    const float unskew = 1.0f / 6.0f;
+    const uint16_t *perm = perlin3d->perm;
+    v4sf scale = v4sf_splat(perlin3d->scale);
+    v4sf x = v4sf_load(x_in) / scale;
+    v4sf y = v4sf_splat(y_in / perlin3d->scale);
+    v4sf z = v4sf_load(z_in) / scale;
+    v4si ci, cj, ck;
+
+    v4sf s = (x + y + z) * skew;
+    v4sf i = floor4(x + s, &ci);
+    v4sf j = floor4(y + s, &cj);
+    v4sf k = floor4(z + s, &ck);
+    v4sf t = (i + j + k) * unskew;
+    v4sf x0 = x - (i - t);
+    v4sf y0 = y - (j - t);
+    v4sf z0 = z - (k - t);
+
+    // The same choice of tetrahedron simplex3d_get() makes, without branches.
+    v4si xy = x0 >= y0;
+    v4si xz = x0 >= z0;
+    v4si yz = y0 >= z0;
+    v4si i1 = xy & xz, j1 = ~xy & yz, k1 = ~xz & ~yz;
+    v4si i2 = xy | xz, j2 = ~xy | yz, k2 = ~(xz & yz);
+
+    v4sf gradient[4][3];
+    float lanes[4][3][PERLIN_BATCH];  // [corner][axis][lane]
+
+    for (int lane = 0;  lane < PERLIN_BATCH;  lane++) {
+        unsigned a = ci[lane], b = cj[lane], c = ck[lane];
+        unsigned hash[4] = {
+            perm[perm[perm[a] + b] + c],
+            perm[perm[perm[a + (i1[lane] & 1)] + b + (j1[lane] & 1)] + c + (k1[lane] & 1)],
+            perm[perm[perm[a + (i2[lane] & 1)] + b + (j2[lane] & 1)] + c + (k2[lane] & 1)],
+            perm[perm[perm[a + 1] + b + 1] + c + 1],
+        };
+
+        for (int corner = 0;  corner < 4;  corner++) {
+            for (int axis = 0;  axis < 3;  axis++) {
+                lanes[corner][axis][lane] = perlin3d->gradients[hash[corner]][axis];
+            }
+        }
+    }
+    for (int corner = 0;  corner < 4;  corner++) {
+        for (int axis = 0;  axis < 3;  axis++) {
+            gradient[corner][axis] = v4sf_load(lanes[corner][axis]);
+        }
     }
+
+    v4sf sum = simplex_corner4(gradient[0], x0, y0, z0)
+        + simplex_corner4(gradient[1], x0 - mask_to_one(i1) + unskew, y0 - mask_to_one(j1) + unskew, z0 - mask_to_one(k1) + unskew)
+        + simplex_corner4(gradient[2], x0 - mask_to_one(i2) + 2 * unskew, y0 - mask_to_one(j2) + 2 * unskew, z0 - mask_to_one(k2) + 2 * unskew)
+        + simplex_corner4(gradient[3], x0 - 1 + 3 * unskew, y0 - 1 + 3 * unskew, z0 - 1 + 3 * unskew);
+
+    v4sf_store(noise, SIMPLEX3D_AMPLITUDE * sum);
 }
 
-static float gradient_dot_product(perlin_seed_t seed, float corner[3], float point[3]) {
-    float gradient[3];
-    gradient_for_lattice_point(gradient, corner, seed);
+void simplex3d_get_row(const perlin3d_t *perlin3d, const float *x, float y, const float *z, size_t count, float *noise) {
+    size_t i;
 
-    float sum = 0;
-    for (int i = 0;  i < 3;  i++) {
-	sum += gradient[i] * (point[i] - corner[i]);
+    for (i = 0;  i + PERLIN_BATCH <= count;  i += PERLIN_BATCH) {
+        simplex_batch(perlin3d, &x[i], y, &z[i], &noise[i]);
     }
 
-    return sum;
+    if (i < count) {
+        float last_x[PERLIN_BATCH] = { 0 };
+        float last_z[PERLIN_BATCH] = { 0 };
+        float last_noise[PERLIN_BATCH];
+
+        memcpy(last_x, &x[i], (count - i) * sizeof(*x));
+        memcpy(last_z, &z[i], (count - i) * sizeof(*z));
+        simplex_batch(perlin3d, last_x, y, last_z, last_noise);
+        memcpy(&noise[i], last_noise, (count - i) * sizeof(*noise));
+    }
 }
 
-static float get_recurse(perlin_seed_t seed, float corner[3], float point[3], unsigned axis) {
-    if (axis > 2) {
-	return gradient_dot_product(seed, corner, point);
+int perlin2d_init(perlin2d_t *perlin2d, float scale, float period, perlin_seed_t seed) {
+    rng_t rng;
+    float cells = roundf(period / scale);
+
+    perlin2d->period_cells = cells < 1 ? 1 : (unsigned) cells;
+    perlin2d->scale_x = period / perlin2d->period_cells;
+    perlin2d->scale_y = scale;
+
+    rng_seed(&rng, seed);
+
+    shuffle_permutation(perlin2d->perm, &rng);
+
+    for (unsigned i = 0;  i < PERLIN_PERIOD;  i++) {
+        float angle = rand_in_range(&rng, 0, 2 * M_PI);
+        perlin2d->gradients[i][0] = cosf(angle);
+        perlin2d->gradients[i][1] = sinf(angle);
+    }
+
+    return 0;
+}
+
+// Wraps a cell column to the period.  Columns past the table's size share its entries, which
+// only matters for periods of more than PERLIN_PERIOD cells.
+static inline unsigned wrap_column(const perlin2d_t *perlin2d, int column) {
+    int period = (int) perlin2d->period_cells;
+
+    column %= period;
+    if (column < 0) {
+        column += period;
+    }
+    return (unsigned) column;
+}
+
+static inline float corner_dot2(const perlin2d_t *perlin2d, unsigned hash, float x, float y) {
+    const float *gradient = perlin2d->gradients[hash];
+    return gradient[0] * x + gradient[1] * y;
+}
+
+float perlin2d_get(const perlin2d_t *perlin2d, const float point[2]) {
+    const uint16_t *perm = perlin2d->perm;
+    float x = point[0] / perlin2d->scale_x;
+    float y = point[1] / perlin2d->scale_y;
+    float floor_x = floorf(x);
+    float floor_y = floorf(y);
+    unsigned cx = wrap_column(perlin2d, (int) floor_x);
+    unsigned cx1 = cx + 1 == perlin2d->period_cells ? 0 : cx + 1;
+    unsigned cy = (unsigned) (int) floor_y & (PERLIN_PERIOD - 1);
+    float fx = x - floor_x;
+    float fy = y - floor_y;
+
+    unsigned a = perm[cx & (PERLIN_PERIOD - 1)] + cy;
+    unsigned b = perm[cx1 & (PERLIN_PERIOD - 1)] + cy;
+
+    float y0 = lerp(corner_dot2(perlin2d, perm[a], fx, fy), corner_dot2(perlin2d, perm[b], fx - 1, fy), ease(fx));
+    float y1 = lerp(corner_dot2(perlin2d, perm[a + 1], fx, fy - 1), corner_dot2(perlin2d, perm[b + 1], fx - 1, fy - 1), ease(fx));
+
+    return PERLIN2D_AMPLITUDE * lerp(y0, y1, ease(fy));
+}
+
+static void get_batch2(const perlin2d_t *perlin2d, const float *x_in, float y_in, float *noise) {
+    const uint16_t *perm = perlin2d->perm;
+    v4sf x = v4sf_load(x_in) / v4sf_splat(perlin2d->scale_x);
+    float y = y_in / perlin2d->scale_y;
+    float floor_y = floorf(y);
+    unsigned cy = (unsigned) (int) floor_y & (PERLIN_PERIOD - 1);
+    v4si cx_unwrapped;
+    v4sf fx = x - floor4(x, &cx_unwrapped);
+    v4sf fy = v4sf_splat(y - floor_y);
+    float gradient[4][2][PERLIN_BATCH];  // [corner][axis][lane], corners numbered yx
+
+    // floor4() wrapped the column to the table, not the period, so redo it from the float.
+    v4sf floor_x = x - fx;
+
+    for (int lane = 0;  lane < PERLIN_BATCH;  lane++) {
+        unsigned cx = wrap_column(perlin2d, (int) floor_x[lane]);
+        unsigned cx1 = cx + 1 == perlin2d->period_cells ? 0 : cx + 1;
+        unsigned a = perm[cx & (PERLIN_PERIOD - 1)] + cy;
+        unsigned b = perm[cx1 & (PERLIN_PERIOD - 1)] + cy;
+        unsigned hash[4] = { perm[a], perm[b], perm[a + 1], perm[b + 1] };
+
+        for (int corner = 0;  corner < 4;  corner++) {
+            gradient[corner][0][lane] = perlin2d->gradients[hash[corner]][0];
+            gradient[corner][1][lane] = perlin2d->gradients[hash[corner]][1];
+        }
     }
 
-    float low = get_recurse(seed, corner, point, axis + 1);
-    corner[axis] += 1;
-    float high = get_recurse(seed, corner, point, axis + 1);
-    corner[axis] -= 1;
+    v4sf dot[4];
+    for (int corner = 0;  corner < 4;  corner++) {
+        v4sf dx = fx - (float) (corner & 1);
+        v4sf dy = fy - (float) (corner >> 1);
+        dot[corner] = v4sf_load(gradient[corner][0]) * dx + v4sf_load(gradient[corner][1]) * dy;
+    }
 
-    float distance = point[axis] - corner[axis];
-    float eased = 3 * distance * distance - 2 * distance * distance * distance;
+    v4sf ex = ease4(fx);
+    v4sf y0 = lerp4(dot[0], dot[1], ex);
+    v4sf y1 = lerp4(dot[2], dot[3], ex);
 
-    return eased * high + (1 - eased) * low;
+    v4sf_store(noise, PERLIN2D_AMPLITUDE * lerp4(y0, y1, ease4(fy)));
 }
 
-float perlin3d_get(perlin3d_t *perlin3d, const float point[3]) {
-    float mypoint[3];
-    float corner[3];
-    for (int i = 0;  i < 3;  i++) {
-	mypoint[i] = point[i] / perlin3d->scale;
-        corner[i] = floorf(mypoint[i]);
+void perlin2d_get_row(const perlin2d_t *perlin2d, const float *x, float y, size_t count, float *noise) {
+    size_t i;
+
+    for (i = 0;  i + PERLIN_BATCH <= count;  i += PERLIN_BATCH) {
+        get_batch2(perlin2d, &x[i], y, &noise[i]);
     }
 
-    return get_recurse(perlin3d->seed, corner, mypoint, 0);
+    if (i < count) {
+        float last_x[PERLIN_BATCH] = { 0 };
+        float last_noise[PERLIN_BATCH];
+
+        memcpy(last_x, &x[i], (count - i) * sizeof(*x));
+        get_batch2(perlin2d, last_x, y, last_noise);
+        memcpy(&noise[i], last_noise, (count - i) * sizeof(*noise));
+    }
 }
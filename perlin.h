@@ -1,18 +1,58 @@
 #ifndef PERLIN_H
 #define PERLIN_H
 
-typedef unsigned int perlin_seed_t;
+#include <stddef.h>
+#include <stdint.h>
 
+typedef uint64_t perlin_seed_t;
+
+#define PERLIN_PERIOD 256
+
+/* Noise repeats every PERLIN_PERIOD lattice cells along each axis.  Everything is filled in by
+   perlin3d_init(), after which the noise can be read from any number of threads at once. */
 typedef struct {
     float scale;
-    perlin_seed_t seed;
+
+    /* perm holds a shuffle of 0 .. PERLIN_PERIOD - 1 twice over, so that hashing a lattice
+       point needs no wrapping between lookups. */
+    uint16_t perm[2 * PERLIN_PERIOD];
+    float gradients[PERLIN_PERIOD][3];  /* unit vectors */
 } perlin3d_t;
 
+/* Gradient noise on a plane that repeats exactly every period along x, for textures that have to
+   tile horizontally without being wrapped around a circle in 3D.  The lattice cells are stretched
+   a little along x so that a whole number of them fits the period. */
+typedef struct {
+    float scale_x;
+    float scale_y;
+    unsigned period_cells;
+
+    uint16_t perm[2 * PERLIN_PERIOD];
+    float gradients[PERLIN_PERIOD][2];  /* unit vectors */
+} perlin2d_t;
+
 int perlin3d_init(perlin3d_t *perlin3d, float scale, perlin_seed_t seed);
 
 void perlin3d_destroy(perlin3d_t *perlin3d);
 
-// Returns NaN on error.
-float perlin3d_get(perlin3d_t *perlin3d, const float point[3]);
+float perlin3d_get(const perlin3d_t *perlin3d, const float point[3]);
+
+/* Sets noise[i] to the noise at (x[i], y, z[i]) for every i below count, several points at a
+   time.  Gives exactly what perlin3d_get() would for each point. */
+void perlin3d_get_row(const perlin3d_t *perlin3d, const float *x, float y, const float *z, size_t count, float *noise);
+
+/* Simplex noise, which blends the 4 corners of a tetrahedron rather than the 8 of a cube, using
+   an initialized perlin3d_t's tables.  Scaled to about the same spread as perlin3d_get(). */
+float simplex3d_get(const perlin3d_t *perlin3d, const float point[3]);
+
+void simplex3d_get_row(const perlin3d_t *perlin3d, const float *x, float y, const float *z, size_t count, float *noise);
+
+int perlin2d_init(perlin2d_t *perlin2d, float scale, float period, perlin_seed_t seed);
+
+/* Scaled to about the same spread as perlin3d_get(). */
+float perlin2d_get(const perlin2d_t *perlin2d, const float point[2]);
+
+/* Gives exactly what perlin2d_get() would for each point. */
+void perlin2d_get_row(const perlin2d_t *perlin2d, const float *x, float y, size_t count, float *noise);
 
 #endif
@@ -0,0 +1,270 @@
+
+#include "point_buffer.h"
+
+#include "util.h"
+
+#include <string.h>
+#include <stdio.h>
+
+
+int point_buffer_init(point_buffer_t *buffer, size_t capacity) {
+  memset(buffer, 0, sizeof(*buffer));
+
+  if (capacity < 2) {
+    capacity = 2;
+  }
+
+  buffer->x = malloc(capacity * sizeof(*buffer->x));
+  buffer->other_x = malloc(capacity * sizeof(*buffer->other_x));
+  buffer->left_x = malloc(capacity * sizeof(*buffer->left_x));
+  buffer->left_y = malloc(capacity * sizeof(*buffer->left_y));
+  buffer->right_x = malloc(capacity * sizeof(*buffer->right_x));
+  buffer->right_y = malloc(capacity * sizeof(*buffer->right_y));
+
+  if (!buffer->x || !buffer->other_x || !buffer->left_x || !buffer->left_y || !buffer->right_x || !buffer->right_y) {
+    PERROR("point buffer allocation");
+    point_buffer_destroy(buffer);
+    return -1;
+  }
+
+  buffer->capacity = capacity;
+
+  return 0;
+}
+
+
+void point_buffer_destroy(point_buffer_t *buffer) {
+  free(buffer->x);
+  free(buffer->other_x);
+  free(buffer->left_x);
+  free(buffer->left_y);
+  free(buffer->right_x);
+  free(buffer->right_y);
+
+  memset(buffer, 0, sizeof(*buffer));
+}
+
+
+void point_buffer_clear(point_buffer_t *buffer) {
+  buffer->count = 0;
+}
+
+
+ssize_t point_buffer_last(const point_buffer_t *buffer) {
+  return (ssize_t) buffer->count - 1;
+}
+
+
+void point_buffer_get(const point_buffer_t *buffer, size_t index, control_point_t *point) {
+  point->x = buffer->x[index];
+  point->other_x = buffer->other_x[index];
+  point->left_x = buffer->left_x[index];
+  point->left_y = buffer->left_y[index];
+  point->right_x = buffer->right_x[index];
+  point->right_y = buffer->right_y[index];
+}
+
+
+static void set_point(point_buffer_t *buffer, size_t index, const control_point_t *point) {
+  buffer->x[index] = point->x;
+  buffer->other_x[index] = point->other_x;
+  buffer->left_x[index] = point->left_x;
+  buffer->left_y[index] = point->left_y;
+  buffer->right_x[index] = point->right_x;
+  buffer->right_y[index] = point->right_y;
+}
+
+
+#define GROW_ARRAY(array, capacity) \
+  do { \
+    void *grown = realloc((array), (capacity) * sizeof(*(array))); \
+    if (grown == NULL) return -1; \
+    (array) = grown; \
+  } while (0)
+
+static int grow(point_buffer_t *buffer) {
+  size_t capacity = 2 * buffer->capacity;
+
+  GROW_ARRAY(buffer->x, capacity);
+  GROW_ARRAY(buffer->other_x, capacity);
+  GROW_ARRAY(buffer->left_x, capacity);
+  GROW_ARRAY(buffer->left_y, capacity);
+  GROW_ARRAY(buffer->right_x, capacity);
+  GROW_ARRAY(buffer->right_y, capacity);
+
+  buffer->capacity = capacity;
+
+  return 0;
+}
+
+#undef GROW_ARRAY
+
+
+#define OPEN_GAP(array, index, count) \
+  memmove(&(array)[(index) + 1], &(array)[index], ((count) - (index)) * sizeof(*(array)))
+
+ssize_t point_buffer_add(point_buffer_t *buffer, const control_point_t *point, ssize_t from) {
+  size_t index;
+
+  if (buffer->count == buffer->capacity && grow(buffer) == -1) {
+    return -1;
+  }
+
+  index = (size_t) (point_buffer_find(buffer, point->x, from) + 1);
+
+  if (index < buffer->count) {
+    /* Almost every point lands at the end, but not all of them. */
+    OPEN_GAP(buffer->x, index, buffer->count);
+    OPEN_GAP(buffer->other_x, index, buffer->count);
+    OPEN_GAP(buffer->left_x, index, buffer->count);
+    OPEN_GAP(buffer->left_y, index, buffer->count);
+    OPEN_GAP(buffer->right_x, index, buffer->count);
+    OPEN_GAP(buffer->right_y, index, buffer->count);
+  }
+
+  set_point(buffer, index, point);
+  buffer->count++;
+
+  return (ssize_t) index;
+}
+
+#undef OPEN_GAP
+
+
+ssize_t point_buffer_find(const point_buffer_t *buffer, float x, ssize_t from) {
+  const float *xs = buffer->x;
+  ssize_t count = (ssize_t) buffer->count;
+  ssize_t low;  /* xs[low] <= x, treating xs[-1] as -infinity */
+  ssize_t high;  /* xs[high] > x, treating xs[count] as +infinity */
+  ssize_t step;
+
+  if (count == 0) {
+    return -1;
+  }
+
+  if (from < 0 || from >= count) {
+    from = count - 1;
+  }
+
+  /* Gallop away from the hint until the answer is bracketed... */
+  if (xs[from] <= x) {
+    low = from;
+    high = from + 1;
+    for (step = 1;  high < count && xs[high] <= x;  step *= 2) {
+      low = high;
+      high = low + step;
+    }
+    if (high > count) {
+      high = count;
+    }
+  } else {
+    high = from;
+    low = from - 1;
+    for (step = 1;  low >= 0 && xs[low] > x;  step *= 2) {
+      high = low;
+      low = high - step;
+    }
+    if (low < -1) {
+      low = -1;
+    }
+  }
+
+  /* ...then bisect the bracket. */
+  while (high - low > 1) {
+    ssize_t mid = low + (high - low) / 2;
+    if (xs[mid] <= x) {
+      low = mid;
+    } else {
+      high = mid;
+    }
+  }
+
+  return low;
+}
+
+
+void point_buffer_find_range(const point_buffer_t *buffer, ssize_t *start, ssize_t *end, float x1, float x2, ssize_t from) {
+  const float *xs = buffer->x;
+  ssize_t count = (ssize_t) buffer->count;
+  ssize_t low;
+  ssize_t high;
+  ssize_t step;
+
+  if (x1 > x2) {
+    fprintf(stderr, "Warning: point_buffer_find_range() called with %f .. %f\n", x1, x2);
+  }
+
+  *start = point_buffer_find(buffer, x1, from);
+
+  if (*start < 0) {
+    *end = -1;
+    return;
+  }
+
+  if (xs[*start] >= x2) {
+    *end = *start;
+    return;
+  }
+
+  /* Gallop right from the start of the range for the first point at or past x2. */
+  low = *start;
+  high = low + 1;
+  for (step = 1;  high < count && xs[high] < x2;  step *= 2) {
+    low = high;
+    high = low + step;
+  }
+  if (high > count) {
+    high = count;
+  }
+
+  while (high - low > 1) {
+    ssize_t mid = low + (high - low) / 2;
+    if (xs[mid] < x2) {
+      low = mid;
+    } else {
+      high = mid;
+    }
+  }
+
+  *end = high < count ? high : -1;
+}
+
+
+void point_buffer_remove_last(point_buffer_t *buffer) {
+  if (buffer->count > 0) {
+    buffer->count--;
+  }
+}
+
+
+void point_buffer_dump(const point_buffer_t *buffer) {
+  control_point_t point;
+
+  for (size_t i = 0;  i < buffer->count;  i++) {
+    point_buffer_get(buffer, i, &point);
+    control_point_dump(&point);
+  }
+}
+
+
+void point_buffer_reflect(point_buffer_t *buffer, float axis) {
+  control_point_t low_point;
+  control_point_t high_point;
+  size_t low;
+  size_t high;
+
+  if (buffer->count == 0) {
+    return;
+  }
+
+  for (low = 0, high = buffer->count - 1;  low <= high && high < buffer->count;  low++, high--) {
+    point_buffer_get(buffer, low, &low_point);
+    point_buffer_get(buffer, high, &high_point);
+
+    control_point_reflect(&low_point, axis);
+    control_point_reflect(&high_point, axis);
+
+    set_point(buffer, low, &high_point);
+    set_point(buffer, high, &low_point);
+  }
+}
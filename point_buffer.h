@@ -0,0 +1,56 @@
+#ifndef POINT_BUFFER_H
+#define POINT_BUFFER_H
+
+#include <stdlib.h>
+
+#include "control_point.h"
+
+/* A run of control points kept sorted by x.  The fields are stored as parallel arrays, so that
+   searching only has to touch the x values.  Points are addressed by index, and -1 stands for
+   "no point".  The storage is kept between rows; clearing the buffer doesn't free it. */
+typedef struct point_buffer_tag {
+  size_t count;
+  size_t capacity;
+
+  float *x;
+  float *other_x;
+
+  float *left_x;
+  ssize_t *left_y;
+
+  float *right_x;
+  ssize_t *right_y;
+} point_buffer_t;
+
+int point_buffer_init(point_buffer_t *buffer, size_t capacity);
+
+void point_buffer_destroy(point_buffer_t *buffer);
+
+void point_buffer_clear(point_buffer_t *buffer);
+
+/* Returns the index of the last point, or -1 if the buffer is empty. */
+ssize_t point_buffer_last(const point_buffer_t *buffer);
+
+void point_buffer_get(const point_buffer_t *buffer, size_t index, control_point_t *point);
+
+/* Inserts the point after every point whose x value is less than or equal to its own, and returns
+   its index, or -1 if the buffer couldn't grow.  The search for the insertion point starts at
+   from, which is only a hint; any index is accepted. */
+ssize_t point_buffer_add(point_buffer_t *buffer, const control_point_t *point, ssize_t from);
+
+/* Finds the last point that has an x value less than or equal to x.  The search gallops outward
+   from the hint from, so it's cheap when the answer is nearby. */
+ssize_t point_buffer_find(const point_buffer_t *buffer, float x, ssize_t from);
+
+/* Finds the largest run of points contained in the range x1..x2, prepended by the first point
+   to the left of the range.  *end is the first point at or past x2. */
+void point_buffer_find_range(const point_buffer_t *buffer, ssize_t *start, ssize_t *end, float x1, float x2, ssize_t from);
+
+void point_buffer_remove_last(point_buffer_t *buffer);
+
+void point_buffer_dump(const point_buffer_t *buffer);
+
+/* Reverses the buffer and reflects all its control point values around the specified axis. */
+void point_buffer_reflect(point_buffer_t *buffer, float axis);
+
+#endif
@@ -0,0 +1,593 @@
+#include "raster.h"
+
+#include "util.h"
+
+#include <math.h>
+#include <string.h>
+
+
+#define RASTER_TILE_SIZE 64
+#define RASTER_LIST_INITIAL_CAPACITY 256
+
+/* Once this little of a pixel shows through, nothing drawn behind it could change it in any
+   output format. */
+#define RASTER_TRANSMITTANCE_MIN (1.0f / 65536.0f)
+
+
+void raster_list_init(raster_list_t *list) {
+  list->shapes = NULL;
+  list->count = 0;
+  list->capacity = 0;
+}
+
+
+void raster_list_destroy(raster_list_t *list) {
+  free(list->shapes);
+  raster_list_init(list);
+}
+
+
+int raster_list_add(raster_list_t *list, const raster_shape_t *shape) {
+  if (list->count == list->capacity) {
+    size_t capacity = list->capacity ? 2 * list->capacity : RASTER_LIST_INITIAL_CAPACITY;
+    raster_shape_t *shapes;
+
+    if ((shapes = realloc(list->shapes, capacity * sizeof(*shapes))) == NULL) {
+      PERROR("shape list allocation");
+      return -1;
+    }
+    list->shapes = shapes;
+    list->capacity = capacity;
+  }
+
+  list->shapes[list->count++] = *shape;
+
+  return 0;
+}
+
+
+/* Sets the bounds of the pixels the shape can touch at all, outlines and anti-aliasing included. */
+static void shape_bounds(const raster_shape_t *shape, float *left, float *top, float *right, float *bottom) {
+  float margin = 1.0f + (shape->outline_count ? 0.5f * shape->outline_width : 0.0f);
+
+  switch (shape->type) {
+    case RASTER_SHAPE_POLYGON:
+      *left = *right = shape->points[0][0];
+      *top = *bottom = shape->points[0][1];
+      for (size_t i = 1;  i < shape->point_count;  i++) {
+        *left = fminf(*left, shape->points[i][0]);
+        *right = fmaxf(*right, shape->points[i][0]);
+        *top = fminf(*top, shape->points[i][1]);
+        *bottom = fmaxf(*bottom, shape->points[i][1]);
+      }
+      break;
+    case RASTER_SHAPE_ELLIPSE:
+      *left = shape->center_x - shape->radius_x;
+      *right = shape->center_x + shape->radius_x;
+      *top = shape->center_y - shape->radius_y;
+      *bottom = shape->center_y + shape->radius_y;
+      break;
+    case RASTER_SHAPE_RECTANGLE:
+      *left = shape->left;
+      *right = shape->right;
+      *top = shape->top;
+      *bottom = shape->bottom;
+      margin = 0.0f;
+      break;
+  }
+
+  *left -= margin;
+  *top -= margin;
+  *right += margin;
+  *bottom += margin;
+}
+
+
+/* Clips float bounds to whole pixels in first .. end - 1 (a tile, or the whole image).  Returns 0
+   if nothing is left. */
+static inline int clip_bounds(float low, float high, size_t first, size_t end, size_t *clipped_first, size_t *clipped_end) {
+  float low_floor = floorf(low);
+  float high_ceil = ceilf(high);
+
+  if (high_ceil <= (float) first || low_floor >= (float) end) {
+    return 0;
+  }
+
+  *clipped_first = low_floor < (float) first ? first : (size_t) low_floor;
+  *clipped_end = high_ceil > (float) end ? end : (size_t) high_ceil;
+
+  return *clipped_first < *clipped_end;
+}
+
+
+static inline float clamp01(float value) {
+  return value < 0.0f ? 0.0f : (value > 1.0f ? 1.0f : value);
+}
+
+
+/* A tile is drawn front to back: each shape goes behind everything drawn so far, which is what
+   lets the shapes buried under later ones be skipped.  Holds rows top .. bottom - 1 and columns
+   left .. right - 1 of the image, stride pixels apart. */
+typedef struct {
+  float *pixels;  /* the colors drawn so far, each weighted by how much of it shows */
+  float *transmittance;  /* per pixel, how much of what goes behind it will show */
+  unsigned *open_pixels;  /* per row, the pixels with any transmittance left */
+  size_t open_count;  /* the same for the whole tile */
+  float *distance;  /* a row of scratch space that's all INFINITY between uses */
+  size_t left;
+  size_t top;
+  size_t right;
+  size_t bottom;
+  size_t stride;
+} tile_t;
+
+
+/* Draws color over coverage of pixel (x, y), behind what's already there. */
+static inline void draw_behind(tile_t *tile, size_t x, size_t y, const float color[4], float coverage) {
+  size_t i = (y - tile->top) * tile->stride + x - tile->left;
+  float *transmittance = &tile->transmittance[i];
+  float alpha = *transmittance * coverage * color[3];
+
+  for (int c = 0;  c < 4;  c++) {
+    tile->pixels[4 * i + c] += alpha * color[c];
+  }
+
+  *transmittance -= alpha;
+  if (*transmittance < RASTER_TRANSMITTANCE_MIN && *transmittance > 0.0f) {
+    *transmittance = 0.0f;
+  }
+  if (*transmittance == 0.0f && alpha > 0.0f) {
+    tile->open_pixels[y - tile->top]--;
+    tile->open_count--;
+  }
+}
+
+
+static inline int pixel_hidden(const tile_t *tile, size_t x, size_t y) {
+  return tile->transmittance[(y - tile->top) * tile->stride + x - tile->left] == 0.0f;
+}
+
+
+/* Outline i is the shape scaled by this much about its center. */
+static inline float outline_scale(const raster_shape_t *shape, unsigned i) {
+  return 1.0f - (float) i / (float) shape->outline_count;
+}
+
+
+static inline float segment_distance(float x, float y, const float a[2], const float b[2], float scale) {
+  float ax = scale * a[0], ay = scale * a[1];
+  float dx = scale * b[0] - ax, dy = scale * b[1] - ay;
+  float length2 = dx * dx + dy * dy;
+  float t = length2 > 0.0f ? clamp01(((x - ax) * dx + (y - ay) * dy) / length2) : 0.0f;
+  float ex = x - (ax + t * dx), ey = y - (ay + t * dy);
+
+  return sqrtf(ex * ex + ey * ey);
+}
+
+
+/* A polygon's points relative to its center, and each edge's unit normal and distance from the
+   center along it. */
+typedef struct {
+  size_t count;
+  float points[RASTER_POLYGON_MAX_POINTS + 1][2];  /* the first again at the end */
+  float normals[RASTER_POLYGON_MAX_POINTS][2];
+  float supports[RASTER_POLYGON_MAX_POINTS];
+} polygon_edges_t;
+
+
+static void polygon_edges(const raster_shape_t *shape, polygon_edges_t *edges) {
+  size_t n = shape->point_count;
+
+  edges->count = n;
+  for (size_t i = 0;  i <= n;  i++) {
+    edges->points[i][0] = shape->points[i % n][0] - shape->center_x;
+    edges->points[i][1] = shape->points[i % n][1] - shape->center_y;
+  }
+
+  for (size_t i = 0;  i < n;  i++) {
+    float dx = edges->points[i + 1][0] - edges->points[i][0];
+    float dy = edges->points[i + 1][1] - edges->points[i][1];
+    float length = sqrtf(dx * dx + dy * dy);
+
+    edges->normals[i][0] = length > 0.0f ? dy / length : 0.0f;
+    edges->normals[i][1] = length > 0.0f ? -dx / length : 0.0f;
+    edges->supports[i] = edges->normals[i][0] * edges->points[i][0] + edges->normals[i][1] * edges->points[i][1];
+  }
+}
+
+
+/* Finds the pixels x0 .. x1 - 1, within first .. end - 1, whose centers on the row y (relative
+   to the center) might be within reach of the edge scaled by scale: those near both its line and
+   its bounding box.  Returns 0 if there aren't any. */
+static inline int edge_row_span(const polygon_edges_t *edges, size_t edge, float scale, float reach, float y, float center_x, size_t first, size_t end, size_t *x0, size_t *x1) {
+  const float *a = edges->points[edge];
+  const float *b = edges->points[edge + 1];
+  float nx = edges->normals[edge][0];
+  float low = scale * fminf(a[0], b[0]) - reach;
+  float high = scale * fmaxf(a[0], b[0]) + reach;
+
+  if (y < scale * fminf(a[1], b[1]) - reach || y > scale * fmaxf(a[1], b[1]) + reach) {
+    return 0;
+  }
+
+  if (fabsf(nx) > 1e-6f) {
+    float middle = (scale * edges->supports[edge] - edges->normals[edge][1] * y) / nx;
+    float half_width = reach / fabsf(nx);
+
+    low = fmaxf(low, middle - half_width);
+    high = fminf(high, middle + half_width);
+  }
+
+  /* Pixel x's center is at x + 0.5 - center_x. */
+  return clip_bounds(low + center_x - 0.5f, high + center_x - 0.5f, first, end, x0, x1);
+}
+
+
+/* Sets distance for the visible pixels on row y near the polygon scaled by scale to how far they
+   are from it, and spans to the ranges of pixels looked at.  Returns how many spans there are. */
+static size_t polygon_row_distances(tile_t *tile, const polygon_edges_t *edges, float scale, float reach, size_t y, float center_x, float center_y, size_t first, size_t end, size_t spans[][2]) {
+  float ry = y + 0.5f - center_y;
+  size_t span_count = 0;
+
+  for (size_t i = 0;  i < edges->count;  i++) {
+    size_t x0, x1;
+
+    if (!edge_row_span(edges, i, scale, reach, ry, center_x, first, end, &x0, &x1)) continue;
+
+    for (size_t x = x0;  x < x1;  x++) {
+      float *distance = &tile->distance[x - tile->left];
+
+      if (pixel_hidden(tile, x, y)) continue;
+
+      *distance = fminf(*distance, segment_distance(x + 0.5f - center_x, ry, edges->points[i], edges->points[i + 1], scale));
+    }
+    spans[span_count][0] = x0;
+    spans[span_count][1] = x1;
+    span_count++;
+  }
+
+  return span_count;
+}
+
+
+static void draw_polygon_row(tile_t *tile, const raster_shape_t *shape, const polygon_edges_t *edges, size_t y, size_t first, size_t end) {
+  float center_x = shape->center_x;
+  float ry = y + 0.5f - shape->center_y;
+  size_t spans[RASTER_POLYGON_MAX_POINTS][2];
+
+  /* Each outline only touches the pixels near its edges.  A pixel in two spans is drawn from the
+     first, and its distance reset so the second leaves it alone.  Back to front is fill and then
+     outlines from the outside in, so front to back is the reverse. */
+  float reach = 0.5f * shape->outline_width + 0.5f;
+
+  for (unsigned k = shape->outline_count;  k-- > 0;  ) {
+    float scale = outline_scale(shape, k);
+    size_t span_count = polygon_row_distances(tile, edges, scale, reach, y, center_x, shape->center_y, first, end, spans);
+
+    for (size_t i = 0;  i < span_count;  i++) {
+      for (size_t x = spans[i][0];  x < spans[i][1];  x++) {
+        float *distance = &tile->distance[x - tile->left];
+
+        if (*distance < reach) {
+          draw_behind(tile, x, y, shape->outline, reach - *distance);
+        }
+        *distance = INFINITY;
+      }
+    }
+  }
+
+  /* Where the row through the pixel centers crosses the edges, in order.  Between the first two
+     crossings is inside, and so on. */
+  float crossings[RASTER_POLYGON_MAX_POINTS];
+  size_t crossing_count = 0;
+
+  for (size_t i = 0;  i < edges->count;  i++) {
+    const float *a = edges->points[i];
+    const float *b = edges->points[i + 1];
+
+    if ((a[1] <= ry) != (b[1] <= ry)) {
+      float crossing = a[0] + (ry - a[1]) * (b[0] - a[0]) / (b[1] - a[1]);
+      size_t j = crossing_count++;
+
+      for (;  j > 0 && crossings[j - 1] > crossing;  j--) {
+        crossings[j] = crossings[j - 1];
+      }
+      crossings[j] = crossing;
+    }
+  }
+
+  /* Pixels within half a pixel of the edge are partly covered, the rest wholly or not at all. */
+  polygon_row_distances(tile, edges, 1.0f, 0.5f, y, center_x, shape->center_y, first, end, spans);
+
+  size_t next = 0;
+
+  for (size_t x = first;  x < end;  x++) {
+    float rx = x + 0.5f - center_x;
+    float *distance = &tile->distance[x - tile->left];
+    float coverage;
+
+    while (next < crossing_count && crossings[next] <= rx) {
+      next++;
+    }
+
+    if (*distance < 0.5f) {
+      coverage = next & 1 ? 0.5f + *distance : 0.5f - *distance;
+    } else {
+      coverage = next & 1;
+    }
+    *distance = INFINITY;
+
+    if (coverage > 0.0f && !pixel_hidden(tile, x, y)) {
+      draw_behind(tile, x, y, shape->fill, coverage);
+    }
+  }
+}
+
+
+/* Returns roughly how far (x, y) is outside the ellipse, negative inside. */
+static inline float ellipse_distance(float x, float y, float radius_x, float radius_y) {
+  float u = x / (radius_x * radius_x);
+  float v = y / (radius_y * radius_y);
+  float gradient = 2.0f * sqrtf(u * u + v * v);
+
+  if (gradient < 1e-6f) {
+    return -fminf(radius_x, radius_y);
+  }
+
+  /* The level set function over the length of its gradient is the distance to first order. */
+  return (x * u + y * v - 1.0f) / gradient;
+}
+
+
+/* Whether a point at q = x^2 / a^2 + y^2 / b^2 is certainly further than reach from the ellipse
+   with radii a and b, the smaller of which is min_radius.  The gradient of q is at most
+   2 sqrt(q) / min_radius, so no square roots are needed to rule most pixels out. */
+static inline int ellipse_out_of_reach(float q, float min_radius, float reach) {
+  float level = q - 1.0f;
+
+  return level * level * min_radius * min_radius >= 4.0f * reach * reach * q;
+}
+
+
+static void draw_ellipse_row(tile_t *tile, const raster_shape_t *shape, size_t y, size_t first, size_t end) {
+  float ry = y + 0.5f - shape->center_y;
+  float inverse_x2 = 1.0f / (shape->radius_x * shape->radius_x);
+  float row_q = ry * ry / (shape->radius_y * shape->radius_y);
+  float min_radius = fminf(shape->radius_x, shape->radius_y);
+  float reach = 0.5f * shape->outline_width + 0.5f;
+
+  for (size_t x = first;  x < end;  x++) {
+    float rx = x + 0.5f - shape->center_x;
+    float q = rx * rx * inverse_x2 + row_q;
+
+    if (pixel_hidden(tile, x, y)) continue;
+
+    for (unsigned k = shape->outline_count;  k-- > 0;  ) {
+      float scale = outline_scale(shape, k);
+
+      if (ellipse_out_of_reach(q / (scale * scale), scale * min_radius, reach)) continue;
+
+      float distance = fabsf(ellipse_distance(rx, ry, scale * shape->radius_x, scale * shape->radius_y));
+
+      if (distance < reach) {
+        draw_behind(tile, x, y, shape->outline, reach - distance);
+      }
+    }
+
+    if (ellipse_out_of_reach(q, min_radius, 0.5f)) {
+      if (q < 1.0f) {
+        draw_behind(tile, x, y, shape->fill, 1.0f);
+      }
+    } else {
+      draw_behind(tile, x, y, shape->fill, clamp01(0.5f - ellipse_distance(rx, ry, shape->radius_x, shape->radius_y)));
+    }
+  }
+}
+
+
+static void draw_rectangle_row(tile_t *tile, const raster_shape_t *shape, size_t y, size_t first, size_t end) {
+  float row_coverage = clamp01(fminf(y + 1.0f, shape->bottom) - fmaxf(y, shape->top));
+
+  for (size_t x = first;  x < end;  x++) {
+    if (!pixel_hidden(tile, x, y)) {
+      draw_behind(tile, x, y, shape->fill, row_coverage * clamp01(fminf(x + 1.0f, shape->right) - fmaxf(x, shape->left)));
+    }
+  }
+}
+
+
+static void draw_shape(tile_t *tile, const raster_shape_t *shape) {
+  float left, top, right, bottom;
+  size_t x0, x1, y0, y1;
+  polygon_edges_t edges;
+
+  shape_bounds(shape, &left, &top, &right, &bottom);
+  if (!clip_bounds(left, right, tile->left, tile->right, &x0, &x1)) return;
+  if (!clip_bounds(top, bottom, tile->top, tile->bottom, &y0, &y1)) return;
+
+  if (shape->type == RASTER_SHAPE_POLYGON) {
+    polygon_edges(shape, &edges);
+  }
+
+  for (size_t y = y0;  y < y1;  y++) {
+    size_t first = x0, end = x1;
+
+    if (tile->open_pixels[y - tile->top] == 0) continue;
+
+    /* Only the part of the row that can still show needs drawing. */
+    while (first < end && pixel_hidden(tile, first, y)) first++;
+    while (end > first && pixel_hidden(tile, end - 1, y)) end--;
+    if (first == end) continue;
+
+    switch (shape->type) {
+      case RASTER_SHAPE_POLYGON:
+        draw_polygon_row(tile, shape, &edges, y, first, end);
+        break;
+      case RASTER_SHAPE_ELLIPSE:
+        draw_ellipse_row(tile, shape, y, first, end);
+        break;
+      case RASTER_SHAPE_RECTANGLE:
+        draw_rectangle_row(tile, shape, y, first, end);
+        break;
+    }
+  }
+}
+
+
+/* Per worker scratch space, enough for any tile. */
+typedef struct {
+  float pixels[4 * RASTER_TILE_SIZE * RASTER_TILE_SIZE];
+  float transmittance[RASTER_TILE_SIZE * RASTER_TILE_SIZE];
+  unsigned open_pixels[RASTER_TILE_SIZE];
+  float distance[RASTER_TILE_SIZE];
+} tile_scratch_t;
+
+
+typedef struct {
+  const raster_list_t *list;
+  image_t *image;
+  const float *background;
+  size_t tiles_across;
+  size_t *bin_starts;  /* tile i's shapes are bin_shapes[bin_starts[i] .. bin_starts[i + 1] - 1] */
+  size_t *bin_shapes;
+  tile_scratch_t *scratch;
+} raster_job_t;
+
+
+static int draw_tile_task(void *arg, size_t index, unsigned worker) {
+  const raster_job_t *job = arg;
+  size_t width = image_get_width(job->image);
+  size_t height = image_get_height(job->image);
+  tile_scratch_t *scratch = &job->scratch[worker];
+  tile_t tile;
+
+  tile.pixels = scratch->pixels;
+  tile.transmittance = scratch->transmittance;
+  tile.open_pixels = scratch->open_pixels;
+  tile.distance = scratch->distance;
+  tile.left = (index % job->tiles_across) * RASTER_TILE_SIZE;
+  tile.top = (index / job->tiles_across) * RASTER_TILE_SIZE;
+  tile.right = tile.left + RASTER_TILE_SIZE < width ? tile.left + RASTER_TILE_SIZE : width;
+  tile.bottom = tile.top + RASTER_TILE_SIZE < height ? tile.top + RASTER_TILE_SIZE : height;
+  tile.stride = tile.right - tile.left;
+  tile.open_count = (tile.bottom - tile.top) * tile.stride;
+
+  memset(tile.pixels, 0, 4 * tile.open_count * sizeof(*tile.pixels));
+  for (size_t i = 0;  i < tile.open_count;  i++) {
+    tile.transmittance[i] = 1.0f;
+  }
+  for (size_t i = 0;  i < tile.bottom - tile.top;  i++) {
+    tile.open_pixels[i] = tile.stride;
+  }
+  for (size_t i = 0;  i < RASTER_TILE_SIZE;  i++) {
+    tile.distance[i] = INFINITY;
+  }
+
+  /* Last shape first, stopping once nothing further back could show. */
+  for (size_t i = job->bin_starts[index + 1];  i > job->bin_starts[index] && tile.open_count > 0;  i--) {
+    draw_shape(&tile, &job->list->shapes[job->bin_shapes[i - 1]]);
+  }
+
+  for (size_t y = tile.top;  y < tile.bottom;  y++) {
+    for (size_t x = tile.left;  x < tile.right;  x++) {
+      size_t i = (y - tile.top) * tile.stride + x - tile.left;
+      float pixel[4];
+
+      for (int c = 0;  c < 4;  c++) {
+        pixel[c] = tile.pixels[4 * i + c] + tile.transmittance[i] * job->background[c];
+      }
+      image_set_pixel(job->image, pixel, x, y);
+    }
+  }
+
+  return 0;
+}
+
+
+/* Sets the range of tiles the shape reaches, empty if it's off the image.  Binning asks twice and
+   gets the same answer both times, so the counts and the filled bins agree. */
+static void shape_tiles(const raster_shape_t *shape, size_t width, size_t height, size_t *tile_x0, size_t *tile_x1, size_t *tile_y0, size_t *tile_y1) {
+  float left, top, right, bottom;
+  size_t x0, x1, y0, y1;
+
+  shape_bounds(shape, &left, &top, &right, &bottom);
+  if (!clip_bounds(left, right, 0, width, &x0, &x1) || !clip_bounds(top, bottom, 0, height, &y0, &y1)) {
+    *tile_x0 = *tile_x1 = *tile_y0 = *tile_y1 = 0;
+    return;
+  }
+
+  *tile_x0 = x0 / RASTER_TILE_SIZE;
+  *tile_x1 = (x1 - 1) / RASTER_TILE_SIZE + 1;
+  *tile_y0 = y0 / RASTER_TILE_SIZE;
+  *tile_y1 = (y1 - 1) / RASTER_TILE_SIZE + 1;
+}
+
+
+image_t *raster_render(const raster_list_t *list, size_t width, size_t height, const float background[4], thread_pool_t *pool) {
+  raster_job_t job = { list, NULL, background, 0, NULL, NULL, NULL };
+  size_t tiles_across = (width + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+  size_t tiles_down = (height + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+  size_t tile_count = tiles_across * tiles_down;
+  size_t *fill = NULL;
+  image_t *retval = NULL;
+
+  job.tiles_across = tiles_across;
+
+  if ((job.image = image_create(width, height)) == NULL) goto bad;
+
+  if ((job.bin_starts = calloc(tile_count + 1, sizeof(*job.bin_starts))) == NULL
+      || (fill = malloc((tile_count + 1) * sizeof(*fill))) == NULL
+      || (job.scratch = malloc(thread_pool_get_thread_count(pool) * sizeof(*job.scratch))) == NULL) {
+    PERROR("raster allocation");
+    goto bad;
+  }
+
+  /* Bin the shapes by tile: count them, then lay the bins out end to end and fill them in list
+     order, which is the order each tile will draw them in. */
+  for (size_t i = 0;  i < list->count;  i++) {
+    size_t tx0, tx1, ty0, ty1;
+
+    shape_tiles(&list->shapes[i], width, height, &tx0, &tx1, &ty0, &ty1);
+    for (size_t ty = ty0;  ty < ty1;  ty++) {
+      for (size_t tx = tx0;  tx < tx1;  tx++) {
+        job.bin_starts[ty * tiles_across + tx + 1]++;
+      }
+    }
+  }
+  for (size_t i = 0;  i < tile_count;  i++) {
+    job.bin_starts[i + 1] += job.bin_starts[i];
+  }
+  memcpy(fill, job.bin_starts, (tile_count + 1) * sizeof(*fill));
+
+  if ((job.bin_shapes = malloc((job.bin_starts[tile_count] + 1) * sizeof(*job.bin_shapes))) == NULL) {
+    PERROR("raster bin allocation");
+    goto bad;
+  }
+  for (size_t i = 0;  i < list->count;  i++) {
+    size_t tx0, tx1, ty0, ty1;
+
+    shape_tiles(&list->shapes[i], width, height, &tx0, &tx1, &ty0, &ty1);
+    for (size_t ty = ty0;  ty < ty1;  ty++) {
+      for (size_t tx = tx0;  tx < tx1;  tx++) {
+        job.bin_shapes[fill[ty * tiles_across + tx]++] = i;
+      }
+    }
+  }
+
+  if (thread_pool_run(pool, tile_count, draw_tile_task, &job) == -1) goto bad;
+
+  retval = job.image;
+
+ cleanup:
+  free(job.scratch);
+  free(job.bin_shapes);
+  free(job.bin_starts);
+  free(fill);
+
+  return retval;
+
+ bad:
+  if (job.image) image_destroy(job.image);
+  retval = NULL;
+  goto cleanup;
+}
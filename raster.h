@@ -0,0 +1,66 @@
+#ifndef RASTER_H
+#define RASTER_H
+
+#include "image.h"
+#include "thread_pool.h"
+
+#include <stdlib.h>
+
+
+#define RASTER_POLYGON_MAX_POINTS 30
+
+
+typedef enum {
+  RASTER_SHAPE_POLYGON,  /* must be star-shaped around its center, with its points in order */
+  RASTER_SHAPE_ELLIPSE,  /* axis-aligned */
+  RASTER_SHAPE_RECTANGLE
+} raster_shape_type_t;
+
+
+/* A filled shape, optionally with outlines: the first traces the shape itself, and the rest are
+   the shape shrunk toward its center, evenly down to 1 / outline_count of its size.  Coordinates
+   are in pixels, with pixel (x, y) covering x .. x + 1 and y .. y + 1. */
+typedef struct raster_shape_tag {
+  raster_shape_type_t type;
+
+  float center_x;  /* polygons and ellipses */
+  float center_y;
+
+  float radius_x;  /* ellipses */
+  float radius_y;
+
+  size_t point_count;  /* polygons */
+  float points[RASTER_POLYGON_MAX_POINTS][2];
+
+  float left;  /* rectangles */
+  float top;
+  float right;
+  float bottom;
+
+  float fill[4];
+
+  unsigned outline_count;
+  float outline_width;
+  float outline[4];
+} raster_shape_t;
+
+
+/* Shapes to draw, in order. */
+typedef struct raster_list_tag {
+  raster_shape_t *shapes;
+  size_t count;
+  size_t capacity;
+} raster_list_t;
+
+
+void raster_list_init(raster_list_t *list);
+void raster_list_destroy(raster_list_t *list);
+
+int raster_list_add(raster_list_t *list, const raster_shape_t *shape);
+
+/* Returns a width x height image of the shapes drawn over background in list order, anti-aliased.
+   The image is cut into tiles that are drawn in parallel, each from just the shapes that reach it,
+   so the result doesn't depend on the thread count. */
+image_t *raster_render(const raster_list_t *list, size_t width, size_t height, const float background[4], thread_pool_t *pool);
+
+#endif
@@ -0,0 +1,209 @@
+#include "image.h"
+#include "simd.h"
+#include "util.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define LANCZOS_LOBES 3
+
+
+/* Which source pixels go into each destination pixel along one axis, and how much of each.  Every
+   destination pixel takes the same number of taps, with the sources clamped to the edge. */
+typedef struct {
+  size_t taps;
+  size_t *sources;  /* taps per destination pixel */
+  float *weights;  /* taps per destination pixel, summing to 1 */
+} resample_axis_t;
+
+
+static float filter_support(image_filter_t filter) {
+  switch (filter) {
+    case IMAGE_FILTER_BOX:
+      return 0.5f;
+    case IMAGE_FILTER_BILINEAR:
+      return 1.0f;
+    case IMAGE_FILTER_LANCZOS:
+    default:
+      return LANCZOS_LOBES;
+  }
+}
+
+
+static float sinc(float x) {
+  if (x == 0.0f) return 1.0f;
+  x *= (float) M_PI;
+  return sinf(x) / x;
+}
+
+
+static float filter_weight(image_filter_t filter, float x) {
+  x = fabsf(x);
+
+  switch (filter) {
+    case IMAGE_FILTER_BILINEAR:
+      return x < 1.0f ? 1.0f - x : 0.0f;
+    case IMAGE_FILTER_LANCZOS:
+    default:
+      return x < LANCZOS_LOBES ? sinc(x) * sinc(x / LANCZOS_LOBES) : 0.0f;
+  }
+}
+
+
+static void resample_axis_destroy(resample_axis_t *axis) {
+  free(axis->sources);
+  free(axis->weights);
+}
+
+
+static int resample_axis_init(resample_axis_t *axis, size_t source_length, size_t dest_length, image_filter_t filter) {
+  float scale = (float) dest_length / (float) source_length;
+  /* Shrinking widens the filter, so that every source pixel gets its say. */
+  float stretch = scale < 1.0f ? 1.0f / scale : 1.0f;
+  float support = filter_support(filter) * stretch;
+
+  /* An axis that keeps its length is just copied. */
+  axis->taps = source_length == dest_length ? 1 : (size_t) ceilf(2.0f * support) + 1;
+  axis->sources = malloc(dest_length * axis->taps * sizeof(*axis->sources));
+  axis->weights = malloc(dest_length * axis->taps * sizeof(*axis->weights));
+  if (axis->sources == NULL || axis->weights == NULL) {
+    PERROR("resample weight allocation");
+    return -1;
+  }
+
+  for (size_t i = 0;  i < dest_length;  i++) {
+    size_t *sources = &axis->sources[i * axis->taps];
+    float *weights = &axis->weights[i * axis->taps];
+    float center = (i + 0.5f) / scale;
+    ssize_t start = axis->taps == 1 ? (ssize_t) i : (ssize_t) floorf(center - support);
+    float total = 0.0f;
+
+    for (size_t t = 0;  t < axis->taps;  t++) {
+      ssize_t j = start + (ssize_t) t;
+
+      if (filter == IMAGE_FILTER_BOX) {
+        /* How much of the source pixel the destination pixel covers. */
+        float low = fmaxf((float) j, (float) i / scale);
+        float high = fminf((float) (j + 1), (float) (i + 1) / scale);
+        weights[t] = high > low ? high - low : 0.0f;
+      } else {
+        weights[t] = filter_weight(filter, (j + 0.5f - center) / stretch);
+      }
+      sources[t] = j < 0 ? 0 : (j >= (ssize_t) source_length ? source_length - 1 : (size_t) j);
+      total += weights[t];
+    }
+
+    for (size_t t = 0;  t < axis->taps;  t++) {
+      weights[t] /= total;
+    }
+  }
+
+  return 0;
+}
+
+
+typedef struct {
+  const image_t *source;
+  image_t *dest;
+  resample_axis_t horizontal;
+  resample_axis_t vertical;
+  float *across;  /* the source rows resampled to the destination width, RGBA */
+  float *scratch;  /* a row of the wider of the two images per worker, RGBA */
+  size_t scratch_width;
+} resample_job_t;
+
+
+static int resample_row_across_task(void *arg, size_t row, unsigned worker) {
+  const resample_job_t *job = arg;
+  size_t source_width = job->source->width;
+  size_t dest_width = job->dest->width;
+  const void *in = image_get_row(job->source, row);
+  float *line = &job->scratch[worker * 4 * job->scratch_width];
+  float *out = &job->across[row * 4 * dest_width];
+
+  image_row_loader(job->source->format)(in, 0, source_width, line);
+
+  /* A pixel is exactly one vector, so each tap is one multiply-add. */
+  for (size_t x = 0;  x < dest_width;  x++) {
+    const size_t *sources = &job->horizontal.sources[x * job->horizontal.taps];
+    const float *weights = &job->horizontal.weights[x * job->horizontal.taps];
+    v4sf sum = v4sf_splat(0.0f);
+
+    for (size_t t = 0;  t < job->horizontal.taps;  t++) {
+      sum += v4sf_splat(weights[t]) * v4sf_load(&line[4 * sources[t]]);
+    }
+    v4sf_store(&out[4 * x], sum);
+  }
+
+  return 0;
+}
+
+
+static int resample_row_down_task(void *arg, size_t row, unsigned worker) {
+  const resample_job_t *job = arg;
+  size_t width = job->dest->width;
+  void *out = image_get_row(job->dest, row);
+  const size_t *sources = &job->vertical.sources[row * job->vertical.taps];
+  const float *weights = &job->vertical.weights[row * job->vertical.taps];
+  float *line = &job->scratch[worker * 4 * job->scratch_width];
+
+  memset(line, 0, 4 * width * sizeof(*line));
+
+  /* Tap by tap, so that every pass runs straight along a row. */
+  for (size_t t = 0;  t < job->vertical.taps;  t++) {
+    const float *in = &job->across[sources[t] * 4 * width];
+    v4sf weight = v4sf_splat(weights[t]);
+
+    if (weights[t] == 0.0f) continue;
+
+    for (size_t i = 0;  i < 4 * width;  i += 4) {
+      v4sf_store(&line[i], v4sf_load(&line[i]) + weight * v4sf_load(&in[i]));
+    }
+  }
+
+  image_row_storer(job->dest->format)(out, 0, width, line);
+
+  return 0;
+}
+
+
+int image_resample(const image_t *source, image_t *dest, image_filter_t filter, thread_pool_t *pool) {
+  resample_job_t job;
+  int retval = -1;
+
+  job.source = source;
+  job.dest = dest;
+  job.horizontal.sources = NULL;
+  job.horizontal.weights = NULL;
+  job.vertical.sources = NULL;
+  job.vertical.weights = NULL;
+  job.across = NULL;
+  job.scratch = NULL;
+  job.scratch_width = source->width > dest->width ? source->width : dest->width;
+
+  if (resample_axis_init(&job.horizontal, source->width, dest->width, filter) == -1) goto cleanup;
+  if (resample_axis_init(&job.vertical, source->height, dest->height, filter) == -1) goto cleanup;
+
+  if ((job.across = malloc(source->height * dest->width * 4 * sizeof(*job.across))) == NULL
+      || (job.scratch = malloc(thread_pool_get_thread_count(pool) * job.scratch_width * 4 * sizeof(*job.scratch))) == NULL) {
+    PERROR("resample row allocation");
+    goto cleanup;
+  }
+
+  /* Across every source row first, then down, each row on its own so that any thread can take
+     it. */
+  if (thread_pool_run(pool, source->height, resample_row_across_task, &job) == -1) goto cleanup;
+  if (thread_pool_run(pool, dest->height, resample_row_down_task, &job) == -1) goto cleanup;
+
+  retval = 0;
+
+ cleanup:
+  free(job.scratch);
+  free(job.across);
+  resample_axis_destroy(&job.vertical);
+  resample_axis_destroy(&job.horizontal);
+
+  return retval;
+}
@@ -0,0 +1,70 @@
+
+#include "rng.h"
+
+#include <time.h>
+#include <unistd.h>
+
+
+static uint64_t splitmix64(uint64_t *x) {
+  uint64_t z = (*x += 0x9e3779b97f4a7c15);
+
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  return z ^ (z >> 31);
+}
+
+
+static uint64_t rotl(uint64_t x, int k) {
+  return (x << k) | (x >> (64 - k));
+}
+
+
+void rng_seed(rng_t *rng, uint64_t seed) {
+  rng_seed_stream(rng, seed, 0);
+}
+
+
+void rng_seed_stream(rng_t *rng, uint64_t seed, uint64_t stream) {
+  /* Mixing the stream in before expanding the state keeps nearby seeds and streams from giving
+     overlapping sequences. */
+  uint64_t x = splitmix64(&seed) ^ stream;
+
+  for (int i = 0;  i < 4;  i++) {
+    rng->state[i] = splitmix64(&x);
+  }
+}
+
+
+uint64_t rng_fresh_seed(void) {
+  static uint64_t calls;
+  struct timespec now;
+  uint64_t x;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  x = ((uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec) ^ ((uint64_t) getpid() << 32)
+      ^ __atomic_fetch_add(&calls, 1, __ATOMIC_RELAXED) * 0xd1b54a32d192ed03;
+
+  return splitmix64(&x);
+}
+
+
+uint64_t rng_next(rng_t *rng) {
+  uint64_t *s = rng->state;
+  uint64_t result = rotl(s[1] * 5, 7) * 9;
+  uint64_t t = s[1] << 17;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rotl(s[3], 45);
+
+  return result;
+}
+
+
+float rng_float(rng_t *rng) {
+  /* The top 24 bits fill a float's mantissa exactly, so the result can't round up to 1. */
+  return (float) (rng_next(rng) >> 40) * (1.0f / 16777216.0f);
+}
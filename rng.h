@@ -0,0 +1,29 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+
+/* A xoshiro256** random number generator.  Every user keeps its own state, so threads never
+   share a stream and the numbers a seed gives don't depend on what else is running. */
+typedef struct rng_tag {
+  uint64_t state[4];
+} rng_t;
+
+
+void rng_seed(rng_t *rng, uint64_t seed);
+
+/* Seeds rng with stream number stream of seed.  Different streams of one seed are independent,
+   so work split by row, tile or layer can give each piece its own stream and come out the same
+   however the pieces are scheduled. */
+void rng_seed_stream(rng_t *rng, uint64_t seed, uint64_t stream);
+
+/* Returns a seed that differs from call to call and from run to run, for when none was given. */
+uint64_t rng_fresh_seed(void);
+
+uint64_t rng_next(rng_t *rng);
+
+/* Returns a float in [0, 1). */
+float rng_float(rng_t *rng);
+
+#endif
@@ -1,18 +1,36 @@
-
 #include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
 
 #include "color.h"
 #include "color_ramp.h"
 #include "metrics.h"
-#include "list.h"
+#include "point_buffer.h"
+#include "rng.h"
 #include "image.h"
+#include "image_writer.h"
 #include "heightmap.h"
+#include "json.h"
+#include "lru_cache.h"
+#include "texture.h"
+#include "texture_bank.h"
+#include "thread_pool.h"
 #include "util.h"
 
 
@@ -23,11 +41,38 @@
 
 #define EDGE_ECHO_OFFSET_RATIO (0.1f)  /* This value times max separation = how many rows down to go in the texture image to prevent echo */
 
+#define TEXTURE_SCALE_FILTER IMAGE_FILTER_BOX  /* area averaging, as ImageMagick's scale did */
+
+#define GENERATED_TEXTURE_HEIGHT_RATIO (4.0f)  /* This value times average separation = the most rows a generated texture gets */
+
+#define PIXEL_RUN_LENGTH (64)  /* finished stereogram pixels stored at a time */
+
 #define TEXTURE_COLOR_MIN_SATURATION (0.5f)
 #define TEXTURE_COLOR_MAX_SATURATION (1)
 #define TEXTURE_COLOR_MIN_VALUE (0.2f)
 #define TEXTURE_COLOR_MAX_VALUE (0.5f)
 
+#define TEXTURE_CACHE_CAPACITY (8)  /* generated textures kept around in batch and serve modes */
+
+#define SERVE_HEIGHTMAP_CACHE_CAPACITY (16)
+#define SERVE_STEREOGRAM_CACHE_CAPACITY (16)
+#define SERVE_RECEIVE_TIMEOUT_SECONDS (30)
+
+
+/* getopt_long() values for options that have no short form. */
+enum {
+  OPTION_MAX_MEMORY = 256,
+  OPTION_PIXEL_FORMAT,
+  OPTION_SEED,
+  OPTION_BATCH,
+  OPTION_FRAMES,
+  OPTION_SERVE,
+  OPTION_TEXTURE_BANK,
+  OPTION_BUILD_TEXTURE_BANK,
+  OPTION_NOISE_KERNEL,
+  OPTION_RAMP_ON_TEXTURE,
+};
+
 
 int ascii_to_ssize_t(const char *ascii, ssize_t *result) {
   char *end;
@@ -77,6 +122,66 @@ int ascii_to_size_t(const char *ascii, size_t *result) {
 }
 
 
+int ascii_to_uint64(const char *ascii, uint64_t *result) {
+  char *end;
+  unsigned long long temp;
+
+  errno = 0;
+  temp = strtoull(ascii, &end, 10);
+
+  if (*end) {
+    return -1;
+  }
+
+  if (errno == ERANGE) {
+    return -1;
+  }
+
+  *result = (uint64_t) temp;
+  if (*result != temp) {
+    errno = ERANGE;
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/* A byte count, optionally followed by K, M or G (powers of 1024). */
+int ascii_to_byte_size(const char *ascii, size_t *result) {
+  char *end;
+  unsigned long long temp;
+  unsigned shift = 0;
+
+  errno = 0;
+
+  temp = strtoull(ascii, &end, 10);
+
+  if (end == ascii || errno == ERANGE) {
+    return -1;
+  }
+
+  switch (*end) {
+    case 'k':  case 'K':  shift = 10;  end++;  break;
+    case 'm':  case 'M':  shift = 20;  end++;  break;
+    case 'g':  case 'G':  shift = 30;  end++;  break;
+  }
+
+  if (*end) {
+    return -1;
+  }
+
+  if (temp > (SIZE_MAX >> shift)) {
+    errno = ERANGE;
+    return -1;
+  }
+
+  *result = (size_t) temp << shift;
+
+  return 0;
+}
+
+
 int ascii_to_float(const char *ascii, float *result) {
   char *end;
   float temp;
@@ -99,10 +204,80 @@ int ascii_to_float(const char *ascii, float *result) {
 }
 
 
-image_t *create_texture(size_t width, size_t height, linear_density_t pixel_density, pattern_t type) {
+/* A range of frame numbers, <first>-<last>. */
+int ascii_to_frame_range(const char *ascii, unsigned *first, unsigned *last) {
+  char *end;
+  unsigned long first_temp;
+  unsigned long last_temp;
+
+  errno = 0;
+
+  first_temp = strtoul(ascii, &end, 10);
+  if (end == ascii || *end != '-' || errno == ERANGE) {
+    return -1;
+  }
+
+  ascii = end + 1;
+  last_temp = strtoul(ascii, &end, 10);
+  if (end == ascii || *end || errno == ERANGE) {
+    return -1;
+  }
+
+  if (first_temp > last_temp || last_temp >= INT_MAX) {
+    return -1;
+  }
+
+  *first = (unsigned) first_temp;
+  *last = (unsigned) last_temp;
+
+  return 0;
+}
+
+
+/* Returns whether pattern has exactly one integer conversion for the frame number (such as %d
+   or %04d), and no other conversions besides %%. */
+int is_frame_pattern(const char *pattern) {
+  int conversions = 0;
+
+  for (const char *p = pattern;  (p = strchr(p, '%')) != NULL;  ) {
+    p++;
+    if (*p == '%') {
+      p++;
+      continue;
+    }
+
+    p += strspn(p, "-+ #0");
+    p += strspn(p, "0123456789");
+    if (*p != 'd') {
+      return 0;
+    }
+    p++;
+    conversions++;
+  }
+
+  return conversions == 1;
+}
+
+
+int frame_filename(char *filename, size_t size, const char *pattern, unsigned frame) {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+  int length = snprintf(filename, size, pattern, (int) frame);
+#pragma GCC diagnostic pop
+
+  if (length < 0 || (size_t) length >= size) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  return 0;
+}
+
+
+image_t *create_texture(size_t width, size_t height, linear_density_t pixel_density, pattern_t type, noise_kernel_t noise_kernel, uint64_t seed, thread_pool_t *pool) {
   image_t *texture;
 
-  if ((texture = image_create_random(width, height, pixel_density, type)) == NULL) {
+  if ((texture = image_create_random(width, height, pixel_density, type, noise_kernel, seed, pool)) == NULL) {
     perror("image_create_random()");
   }
 
@@ -110,11 +285,11 @@ image_t *create_texture(size_t width, size_t height, linear_density_t pixel_dens
 }
 
 
-image_t *get_texture(const char *filename, size_t width, size_t height, linear_density_t pixel_density, pattern_t type) {
+image_t *get_texture(const char *filename, size_t width, size_t height, linear_density_t pixel_density, pattern_t type, noise_kernel_t noise_kernel, uint64_t seed, thread_pool_t *pool) {
   image_t *image;
 
   if (filename == NULL) {
-    image = create_texture(width, height, pixel_density, type);
+    image = create_texture(width, height, pixel_density, type, noise_kernel, seed, pool);
   } else {
     if ((image = image_read(filename)) == NULL) {
       perror("image_read()");
@@ -125,24 +300,62 @@ image_t *get_texture(const char *filename, size_t width, size_t height, linear_d
 }
 
 
-/* Scale the texture vertically such that, if we were to scale it horizontally to the
-   specified width, the aspect ratio would be preserved. */
-int scale_texture_height(image_t *texture, float width) {
-  size_t height;
+/* Sets key to something that changes whenever the file does. */
+int file_cache_key(const char *filename, char *key, size_t key_size) {
+  struct stat st;
+  int length;
 
-  height = (size_t) roundf((width / image_get_width(texture)) * image_get_height(texture));
+  if (stat(filename, &st) == -1) {
+    return -1;
+  }
+
+  length = snprintf(key, key_size, "%s\t%ju %ju %jd %jd.%09ld", filename, (uintmax_t) st.st_dev, (uintmax_t) st.st_ino,
+                    (intmax_t) st.st_size, (intmax_t) st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+  if (length < 0 || (size_t) length >= key_size) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
 
-  return image_scale(texture, image_get_width(texture), height);
+  return 0;
 }
 
 
-int get_separation(float *separation, const heightmap_t *heightmap, size_t row, float x, float sep_min, float sep_max) {
-  float h = heightmap_get(heightmap, x, row);
+void destroy_cached_image(void *image) {
+  image_destroy(image);
+}
 
-  float dof = 2.0 * (sep_max - sep_min) / (2.0 * sep_max - sep_min);
-  *separation = (1.0 - dof * h) * 2.0 * sep_max / (2.0 - dof * h);
 
-  return 0;
+/* Returns a copy of the texture these parameters generate, generating it only if the cache
+   doesn't have it already.  Callers should only use it for seeded textures, since an unseeded one
+   is meant to come out different every time. */
+image_t *texture_cache_get(lru_cache_t *cache, size_t width, size_t height, linear_density_t pixel_density, pattern_t type, noise_kernel_t noise_kernel, uint64_t seed, thread_pool_t *pool) {
+  image_t *image;
+  char key[128];
+
+  /* %a keeps every bit of the length. */
+  snprintf(key, sizeof(key), "%d %d %zu %zu %u %a %" PRIu64, (int) type, (int) noise_kernel, width, height, pixel_density.count, pixel_density.length.meters, seed);
+
+  if ((image = lru_cache_get(cache, key)) == NULL) {
+    if ((image = create_texture(width, height, pixel_density, type, noise_kernel, seed, pool)) == NULL) return NULL;
+
+    if (lru_cache_put(cache, key, image) == -1) {
+      /* Uncached, it's still good for this job. */
+      return image;
+    }
+  }
+
+  return image_copy(image);
+}
+
+
+/* Scale the texture vertically such that, if we were to scale it horizontally to the
+   specified width, the aspect ratio would be preserved. */
+int scale_texture_height(image_t *texture, float width, thread_pool_t *pool) {
+  size_t height;
+
+  height = (size_t) roundf((width / image_get_width(texture)) * image_get_height(texture));
+
+  return image_scale(texture, image_get_width(texture), height, TEXTURE_SCALE_FILTER, pool);
 }
 
 
@@ -152,18 +365,19 @@ float x_to_texture(float x, float width) {
 }
 
 
-int insert_wraparound_control_point(list_t *points, control_point_t *point) {
+int insert_wraparound_control_point(point_buffer_t *points, control_point_t *point) {
   control_point_t other_point;
+  ssize_t last = point_buffer_last(points);
 
-  other_point.x = points->last->point.x + (point->x - points->last->point.x) * (1.0f - points->last->point.right_x) / (1.0f + point->left_x - points->last->point.right_x);
+  other_point.x = points->x[last] + (point->x - points->x[last]) * (1.0f - points->right_x[last]) / (1.0f + point->left_x - points->right_x[last]);
   other_point.other_x = -1.0f;
   other_point.left_x = 1.0f;
   other_point.left_y = point->left_y;
   other_point.right_x = 0.0f;
   other_point.right_y = point->left_y;
 
-  if (list_add(points, &other_point, points->last) == -1) {
-    perror("list_add()");
+  if (point_buffer_add(points, &other_point, last) == -1) {
+    perror("point_buffer_add()");
     return -1;
   }
 
@@ -187,7 +401,16 @@ ssize_t find_inserted_texture_shift(float width, float x) {
 }
 
 
-int generate_left_eye_cannot_see_control_points(list_t *points, float sep_max, float center, int *last_invalid, control_point_t *point) {
+/* The largest shift find_inserted_texture_shift() can return for a stereogram of the given width.
+   Control points never stray more than half a separation past either edge. */
+ssize_t max_edge_echo_shift(float width, float sep_max) {
+  ssize_t column = (ssize_t) ((0.5f * width + 0.5f * sep_max) / sep_max);
+
+  return column / 2 + 1;
+}
+
+
+int generate_left_eye_cannot_see_control_points(point_buffer_t *points, float sep_max, float center, int *last_invalid, control_point_t *point) {
   /* This point links to a place to the left of where a previous point linked to.
      This means that the left eye can't see what the right eye sees here.
      So, the range to the left of this point needs to map to some other row in
@@ -209,23 +432,24 @@ int generate_left_eye_cannot_see_control_points(list_t *points, float sep_max, f
      *           .        #   <- current point
 
    */
+  ssize_t last = point_buffer_last(points);
 
-  points->last->point.right_x = x_to_texture(points->last->point.x, sep_max);
-  points->last->point.right_y = points->last->point.left_y;
+  points->right_x[last] = x_to_texture(points->x[last], sep_max);
+  points->right_y[last] = points->left_y[last];
 
   if (!*last_invalid) {
-    points->last->point.right_y = find_inserted_texture_shift(sep_max, point->x - center);
+    points->right_y[last] = find_inserted_texture_shift(sep_max, point->x - center);
   }
 
   point->left_x = x_to_texture(point->x, sep_max);
-  point->left_y = points->last->point.right_y;
+  point->left_y = points->right_y[last];
 
   /* If this control point just happens to map to the edge of the texture, then the left
      side of it should map to 1, not 0, and the right side should be 0, not 1. */
   if (point->left_x == 0.0f) point->left_x = 1.0f;
   if (point->right_x == 1.0f) point->right_x = 0.0f;
 
-  if (points->last->point.right_x >= point->left_x) {
+  if (points->right_x[last] >= point->left_x) {
     /* The range to the left wraps around the edge of the texture image, so we need to
        insert another control point to represent the edge. */
     if (insert_wraparound_control_point(points, point) == -1) {
@@ -239,7 +463,7 @@ int generate_left_eye_cannot_see_control_points(list_t *points, float sep_max, f
 }
 
 
-int generate_right_eye_cannot_see_control_points(list_t *points, float *greatest_other_x, node_t **start, int *last_invalid, control_point_t *point) {
+int generate_right_eye_cannot_see_control_points(point_buffer_t *points, float *greatest_other_x, ssize_t *start, int *last_invalid, control_point_t *point) {
   /* This point passes through the screen to the left of where at least one previous point
      passed through.  This means that the right eye can't see what the left eye sees for
      those other points.  So, we need to remove those points to the right of this one
@@ -262,20 +486,22 @@ int generate_right_eye_cannot_see_control_points(list_t *points, float *greatest
 
    */
   control_point_t other_point;
+  ssize_t last = point_buffer_last(points);
 
   other_point.x = other_point.left_x = 0;  /* shut up the compiler warnings */
 
-  while (point->x <= points->last->point.x) {
-    other_point = points->last->point;
-    if (*start == points->last) {
-      *start = (*start)->prev;
+  while (point->x <= points->x[last]) {
+    point_buffer_get(points, last, &other_point);
+    if (*start == last) {
+      *start = last - 1;
     }
-    list_remove_last(points);
+    point_buffer_remove_last(points);
+    last--;
   }
 
   /* Interpolate the texture position based on this point's position between the point immediately to it's left and the point that was removed immediately to its right. */
-  point->left_x = points->last->point.right_x + (other_point.left_x - points->last->point.right_x) * (point->x - points->last->point.x) / (other_point.x - points->last->point.x);
-  point->left_y = points->last->point.right_y;
+  point->left_x = points->right_x[last] + (other_point.left_x - points->right_x[last]) * (point->x - points->x[last]) / (other_point.x - points->x[last]);
+  point->left_y = points->right_y[last];
 
   *greatest_other_x = point->other_x;
 
@@ -285,7 +511,7 @@ int generate_right_eye_cannot_see_control_points(list_t *points, float *greatest
 }
 
 
-int generate_both_eyes_can_see_control_points(list_t *points, float *greatest_other_x, float sep_max, node_t **start, int *last_invalid, control_point_t *point) {
+int generate_both_eyes_can_see_control_points(point_buffer_t *points, float *greatest_other_x, float sep_max, ssize_t *start, int *last_invalid, control_point_t *point) {
   /* This control point is well-behaved.  It falls to the right of all previous control points,
      and the point it links to also is to the right of all previous links.
 
@@ -297,24 +523,25 @@ int generate_both_eyes_can_see_control_points(list_t *points, float *greatest_ot
 
    */
   float bound_x;
-  node_t *end;
+  ssize_t end;
+  ssize_t last = point_buffer_last(points);
 
   if (*last_invalid) {
     bound_x = point->other_x;
   } else {
-    bound_x = points->last->point.other_x;
+    bound_x = points->other_x[last];
   }
 
-  list_find_range(points, start, &end, bound_x, point->other_x, *start);
+  point_buffer_find_range(points, start, &end, bound_x, point->other_x, *start);
 
-  /* Sanity check.  The range should never be null. */
-  if (*start == NULL) {
-    fputs("*start is NULL after list_find_range()\n", stderr);
+  /* Sanity check.  The range should never be empty. */
+  if (*start == -1) {
+    fputs("*start is -1 after point_buffer_find_range()\n", stderr);
     fprintf(stderr, "bound_x is %f, point->other_x is %f\n", bound_x, point->other_x);
     exit(1);
   }
-  if (end == NULL) {
-    fputs("end is NULL after list_find_range()\n", stderr);
+  if (end == -1) {
+    fputs("end is -1 after point_buffer_find_range()\n", stderr);
     fprintf(stderr, "bound_x is %f, point->other_x is %f\n", bound_x, point->other_x);
     exit(1);
   }
@@ -322,16 +549,16 @@ int generate_both_eyes_can_see_control_points(list_t *points, float *greatest_ot
   if (*start == end) {
     /* The previous point was invalid, AND this point links to a point that exactly coincides
        with a previous control point. */
-    point->left_x = (*start)->point.left_x;
-    point->left_y = (*start)->point.left_y;
+    point->left_x = points->left_x[*start];
+    point->left_y = points->left_y[*start];
 
-    point->right_x = (*start)->point.right_x;
-    point->right_y = (*start)->point.right_y;
+    point->right_x = points->right_x[*start];
+    point->right_y = points->right_y[*start];
   } else {
     /* Calculate where in the texture image this point maps to, by linearly interpolating between the two control points
        that the point it links to falls between. */
-    point->right_x = end->prev->point.right_x + (point->other_x - end->prev->point.x) * (end->point.left_x - end->prev->point.right_x) / (end->point.x - end->prev->point.x);
-    point->right_y = end->prev->point.right_y;
+    point->right_x = points->right_x[end - 1] + (point->other_x - points->x[end - 1]) * (points->left_x[end] - points->right_x[end - 1]) / (points->x[end] - points->x[end - 1]);
+    point->right_y = points->right_y[end - 1];
 
     point->left_x = point->right_x;
     point->left_y = point->right_y;
@@ -340,9 +567,9 @@ int generate_both_eyes_can_see_control_points(list_t *points, float *greatest_ot
        to be careful about where the right side of this point links to.  For example, that other
        control point could represent where the texture image wraps around, or the left and
        right sides could map to two different rows in the texture image. */
-    if (point->other_x == end->point.x) {
-      point->right_x = end->point.right_x;
-      point->right_y = end->point.right_y;
+    if (point->other_x == points->x[end]) {
+      point->right_x = points->right_x[end];
+      point->right_y = points->right_y[end];
     }
   }
 
@@ -350,28 +577,39 @@ int generate_both_eyes_can_see_control_points(list_t *points, float *greatest_ot
     /* The previous point didn't link to anything.  Therefore, the left range should map
        to some other part of the texture image.
      */
-    points->last->point.right_x = x_to_texture(points->last->point.x, sep_max);  /* Insert some texture. */
-    points->last->point.right_y = points->last->point.left_y;  /* The range left from that point was inserted, so use the same row here. */
+    points->right_x[last] = x_to_texture(points->x[last], sep_max);  /* Insert some texture. */
+    points->right_y[last] = points->left_y[last];  /* The range left from that point was inserted, so use the same row here. */
 
     point->left_x = x_to_texture(point->x, sep_max);  /* Match inserted left texture with the previous point's right texture. */
-    point->left_y = points->last->point.right_y;
+    point->left_y = points->right_y[last];
   } else {
     if (*start != end) {
-      /* Copy any enclosed control points. */
-      node_t *node;
+      /* Copy any enclosed control points.  The copies land to the right of the enclosed points, so
+         adding them doesn't disturb the indices we're walking, except in the rare case that a
+         copy sorts in among them. */
+      ssize_t i;
 
-      for (node = (*start)->next;  node != end;  node = node->next) {
+      for (i = *start + 1;  i < end;  i++) {
         control_point_t other_point;
+        ssize_t added;
 
-        other_point = node->point;
+        last = point_buffer_last(points);
+
+        point_buffer_get(points, i, &other_point);
         other_point.other_x = other_point.x;
-        other_point.x = points->last->point.x + (other_point.other_x - points->last->point.other_x) * (point->x - points->last->point.x) / (point->other_x - points->last->point.other_x);
+        other_point.x = points->x[last] + (other_point.other_x - points->other_x[last]) * (point->x - points->x[last]) / (point->other_x - points->other_x[last]);
         /* Don't copy it if the copy would exactly coincide with this control point. */
         if (other_point.x != point->x) {
-          if (list_add(points, &other_point, points->last) == -1) {
-            perror("list_add()");
+          if ((added = point_buffer_add(points, &other_point, last)) == -1) {
+            perror("point_buffer_add()");
             return -1;
           }
+          if (added <= i) {
+            i++;
+            end++;
+          } else if (added <= end) {
+            end++;
+          }
         }
       }
     }
@@ -385,15 +623,13 @@ int generate_both_eyes_can_see_control_points(list_t *points, float *greatest_ot
 }
 
 
-int generate_h_place_control_points(list_t *points, size_t row, heightmap_t *heightmap, float separation_min, float separation_max, float h_place, float *greatest_other_x, node_t **start, int *last_invalid) {
+int generate_h_place_control_points(point_buffer_t *points, size_t row, const heightmap_t *heightmap, float separation_max, int reflected, float h_place, float *greatest_other_x, ssize_t *start, int *last_invalid) {
   control_point_t point;
   float sep;
   float half_sep;
   float center;
 
-  if (get_separation(&sep, heightmap, row, h_place, separation_min, separation_max) == -1) {
-    return -1;
-  }
+  sep = heightmap_get_separation(heightmap, h_place, row, reflected);
 
   half_sep = 0.5f * sep;
 
@@ -419,7 +655,7 @@ int generate_h_place_control_points(list_t *points, size_t row, heightmap_t *hei
     if (generate_left_eye_cannot_see_control_points(points, separation_max, center, last_invalid, &point) == -1) {
       return -1;
     }
-  } else if (point.x <= points->last->point.x) {
+  } else if (point.x <= points->x[point_buffer_last(points)]) {
     /*
      * @       .       *
      *  @       .       *
@@ -443,9 +679,9 @@ int generate_h_place_control_points(list_t *points, size_t row, heightmap_t *hei
     }
   }
 
-  /* Finally, add this control point to the list. */
-  if (list_add(points, &point, points->last) == -1) {
-    perror("list_add()");
+  /* Finally, add this control point to the buffer. */
+  if (point_buffer_add(points, &point, point_buffer_last(points)) == -1) {
+    perror("point_buffer_add()");
     return -1;
   }
 
@@ -453,12 +689,12 @@ int generate_h_place_control_points(list_t *points, size_t row, heightmap_t *hei
 }
 
 
-int generate_right_half_control_points(list_t *points, size_t row, heightmap_t *heightmap, float separation_min, float separation_max) {
+int generate_right_half_control_points(point_buffer_t *points, size_t row, const heightmap_t *heightmap, float separation_max, int reflected) {
   float width;  /* width of the heightmap */
   float h_place;  /* current horizontal position in this row of the heightmap */
   float greatest_other_x;  /* right-most left x-position that has been linked to.  This is used to determine eye visibility. */
 
-  node_t *start;  /* We keep a 'bookmark' into the linked list of points to speed up insertions. */
+  ssize_t start;  /* We keep a 'bookmark' into the buffer of points to speed up searches. */
 
   int last_invalid;  /* Whether the previous control point didn't link with anything. */
 
@@ -466,13 +702,13 @@ int generate_right_half_control_points(list_t *points, size_t row, heightmap_t *
 
   /* Go from the center to the right side of the screen. */
   last_invalid = 0;
-  start = points->last->prev;
-  greatest_other_x = points->last->point.other_x;
+  start = point_buffer_last(points) - 1;
+  greatest_other_x = points->other_x[point_buffer_last(points)];
 
   /* We initialize h_place one pixel to the right of the midpoint because the calling code has already generated
      the initial two control points from the midpoint. */
   for (h_place = 0.5f * width + 1.0f;  h_place < width;  h_place += 1.0f) {
-    if (generate_h_place_control_points(points, row, heightmap, separation_min, separation_max, h_place, &greatest_other_x, &start, &last_invalid) == -1) {
+    if (generate_h_place_control_points(points, row, heightmap, separation_max, reflected, h_place, &greatest_other_x, &start, &last_invalid) == -1) {
       return -1;
     }
   }
@@ -481,7 +717,7 @@ int generate_right_half_control_points(list_t *points, size_t row, heightmap_t *
 }
 
 
-int generate_middle_control_points(list_t *points, size_t row, heightmap_t *heightmap, float separation_min, float separation_max, float width) {
+int generate_middle_control_points(point_buffer_t *points, size_t row, const heightmap_t *heightmap, int reflected, float width) {
   float h_place;
 
   control_point_t point;
@@ -492,9 +728,7 @@ int generate_middle_control_points(list_t *points, size_t row, heightmap_t *heig
 
   /* Make the initial two control points in the middle. */
   h_place = 0.5f * width;
-  if (get_separation(&sep, heightmap, row, h_place, separation_min, separation_max) == -1) {
-    return -1;
-  }
+  sep = heightmap_get_separation(heightmap, h_place, row, reflected);
 
   half_sep = 0.5f * sep;
 
@@ -504,15 +738,15 @@ int generate_middle_control_points(list_t *points, size_t row, heightmap_t *heig
   point.left_y = 0;
   point.right_x = 0.0f;
   point.right_y = 0;
-  if (list_add(points, &point, NULL) == -1) {
-    perror("list_add()");
+  if (point_buffer_add(points, &point, -1) == -1) {
+    perror("point_buffer_add()");
     return -1;
   }
 
   point.other_x = point.x;
   point.x = h_place + half_sep;
-  if (list_add(points, &point, NULL) == -1) {
-    perror("list_add()");
+  if (point_buffer_add(points, &point, -1) == -1) {
+    perror("point_buffer_add()");
     return -1;
   }
 
@@ -520,31 +754,30 @@ int generate_middle_control_points(list_t *points, size_t row, heightmap_t *heig
 }
 
 
-int generate_control_points(list_t *points, size_t row, heightmap_t *heightmap, float separation_min, float separation_max) {
+int generate_control_points(point_buffer_t *points, size_t row, const heightmap_t *heightmap, float separation_max) {
   float width;
 
 
   width = (float) heightmap_get_width(heightmap);
 
-  /* We're doing the left side first, so reflect the heightmap. */
-  heightmap_set_reflected(heightmap, 1);
+  /* We're doing the left side first, so read the heightmap reflected.  (The heightmap itself is
+     left alone, since other threads may be reading it for their own rows.) */
 
   /* Make the initial two control points. */
-  if (generate_middle_control_points(points, row, heightmap, separation_min, separation_max, width) == -1) {
+  if (generate_middle_control_points(points, row, heightmap, 1, width) == -1) {
     return -1;
   }
 
   /* Go from the center to the left side of the screen. */
-  if (generate_right_half_control_points(points, row, heightmap, separation_min, separation_max) == -1) {
+  if (generate_right_half_control_points(points, row, heightmap, separation_max, 1) == -1) {
     return -1;
   }
 
-  /* Unreflect the heightmap, and reflect the list. */
-  heightmap_set_reflected(heightmap, 0);
-  list_reflect(points, 0.5f * width);
+  /* Stop reflecting the heightmap, and reflect the points. */
+  point_buffer_reflect(points, 0.5f * width);
 
   /* Go from the center to the right side of the screen. */
-  if (generate_right_half_control_points(points, row, heightmap, separation_min, separation_max) == -1) {
+  if (generate_right_half_control_points(points, row, heightmap, separation_max, 0) == -1) {
     return -1;
   }
 
@@ -552,26 +785,17 @@ int generate_control_points(list_t *points, size_t row, heightmap_t *heightmap,
 }
 
 
-int add_color_for_range(image_t *texture, float left, float right, size_t row, float scale, float *accum) {
-  float r;
-  float g;
-  float b;
-  float a;
-
-  float tmp_right;
-
+int add_color_for_range(const texture_t *texture, float left, float right, size_t row, float scale, float *accum) {
   float width;
 
   float length;
 
-  float pixel[4];
+  float sum[4];
 
   if (scale <= 0.0f || scale > 1.0f) {
     fprintf(stderr, "Warning: add_color_for_range(): scale is %f\n", scale);
   }
 
-  r = g = b = a = 0.0f;
-
   /* Sanity check. */
   if (left < 0.0f || left > 1.0f) {
     fprintf(stderr, "left (%f) is outside the range (0..1]\n", left);
@@ -583,47 +807,137 @@ int add_color_for_range(image_t *texture, float left, float right, size_t row, f
   }
 
   /* Map the left..right range from 0..1 to 0..<texture width> */
-  width = (float) image_get_width(texture);
+  width = (float) texture_get_width(texture);
   left *= width;
   right *= width;
 
   length = right - left;
 
-  while (right - floorf(left) > 1.0f) {
-    /* We stradle the border between pixels. */
-    tmp_right = floorf(left) + 1.0f;
+  texture_integrate(texture, row, left, right, sum);
+
+  scale /= length;
+
+  accum[0] += sum[0] * scale;
+  accum[1] += sum[1] * scale;
+  accum[2] += sum[2] * scale;
+  accum[3] += sum[3] * scale;
+
+  return 0;
+}
+
 
-    image_get_pixel(texture, pixel, (size_t) floorf(left), row);
+/* Finished pixels of a row, held until they can go out together through the format's row
+   storer.  They nearly always come in order, left to right; one that doesn't starts a new run. */
+typedef struct {
+  image_store_row_t store;
+  void *row;
+  size_t start;
+  size_t count;
+  float pixels[4 * PIXEL_RUN_LENGTH];
+} pixel_run_t;
 
-    r += pixel[0] * (tmp_right - left);
-    g += pixel[1] * (tmp_right - left);
-    b += pixel[2] * (tmp_right - left);
-    a += pixel[3] * (tmp_right - left);
 
-    left = tmp_right;
+void pixel_run_flush(pixel_run_t *run) {
+  if (run->count) {
+    run->store(run->row, run->start, run->count, run->pixels);
   }
+  run->count = 0;
+}
 
-  /* Now we're fully contained within a single pixel. */
-  image_get_pixel(texture, pixel, (size_t) floorf(left), row);
 
-  r += pixel[0] * (right - left);
-  g += pixel[1] * (right - left);
-  b += pixel[2] * (right - left);
-  a += pixel[3] * (right - left);
+void pixel_run_put(pixel_run_t *run, size_t x, const float *pixel) {
+  if (run->count == PIXEL_RUN_LENGTH || x != run->start + run->count) {
+    pixel_run_flush(run);
+    run->start = x;
+  }
+  memcpy(&run->pixels[4 * run->count++], pixel, 4 * sizeof(*pixel));
+}
+
 
-  scale /= length;
+/* image holds the rows of the stereogram starting at first_row. */
+void apply_color_ramp_for_pattern_type(image_t *image, size_t first_row, size_t full_height, const color_ramp_t *color_ramp, pattern_t pattern_type) {
+  blend_method_t blend_method = pattern_type == PATTERN_TYPE_PERLIN ? BLEND_METHOD_ALPHA : BLEND_METHOD_OFFSET;
+  image_apply_color_ramp_band(image, color_ramp, blend_method, first_row, full_height);
+}
 
-  accum[0] += r * scale;
-  accum[1] += g * scale;
-  accum[2] += b * scale;
-  accum[3] += a * scale;
+
+/* For --ramp-on-texture, each worker draws from its own copy of the texture, whose rows are
+   colored as they're read with the color of the stereogram row being drawn.  A row that edge
+   echoes shift to is read from the same copy, so it gets that color too. */
+typedef struct {
+  const image_t *source;  /* the uncolored texture */
+  image_t *image;
+  texture_t *texture;
+  size_t *colored_for;  /* the stereogram row each row of image was last colored for */
+
+  const color_ramp_t *color_ramp;
+  pattern_t pattern_type;
+  size_t full_height;  /* of the stereogram */
+} ramped_texture_t;
+
+
+int ramped_texture_init(ramped_texture_t *ramped, const image_t *source, ssize_t edge_echo_offset, ssize_t max_shift,
+                        const color_ramp_t *color_ramp, pattern_t pattern_type, size_t full_height) {
+  size_t height = image_get_height(source);
+
+  ramped->source = source;
+  ramped->texture = NULL;
+  ramped->colored_for = NULL;
+  ramped->color_ramp = color_ramp;
+  ramped->pattern_type = pattern_type;
+  ramped->full_height = full_height;
+
+  if ((ramped->image = image_copy(source)) == NULL) return -1;
+
+  if ((ramped->texture = texture_create(ramped->image, edge_echo_offset, max_shift)) == NULL) goto bad;
+
+  if ((ramped->colored_for = malloc(height * sizeof(*ramped->colored_for))) == NULL) {
+    PERROR("ramped texture allocation");
+    goto bad;
+  }
+  for (size_t row = 0;  row < height;  row++) {
+    ramped->colored_for[row] = SIZE_MAX;
+  }
 
   return 0;
+
+ bad:
+  if (ramped->texture) texture_destroy(ramped->texture);
+  image_destroy(ramped->image);
+  return -1;
+}
+
+
+void ramped_texture_destroy(ramped_texture_t *ramped) {
+  free(ramped->colored_for);
+  texture_destroy(ramped->texture);
+  image_destroy(ramped->image);
+}
+
+
+size_t ramped_texture_get_memory_size(const ramped_texture_t *ramped) {
+  return texture_get_memory_size(ramped->texture) + texture_get_height(ramped->texture) * sizeof(*ramped->colored_for);
+}
+
+
+/* Colors texture_row of the copy for stereogram row row, unless it already is. */
+void ramped_texture_color_row(ramped_texture_t *ramped, size_t texture_row, size_t row) {
+  if (ramped->colored_for[texture_row] == row) return;
+
+  image_t row_image = { image_get_width(ramped->image), 1, ramped->image->format, image_get_row(ramped->image, texture_row) };
+
+  memcpy(row_image.pixels, image_get_row(ramped->source, texture_row), row_image.width * image_pixel_size(row_image.format));
+  apply_color_ramp_for_pattern_type(&row_image, row, ramped->full_height, ramped->color_ramp, ramped->pattern_type);
+  texture_update_row(ramped->texture, texture_row);
+
+  ramped->colored_for[texture_row] = row;
 }
 
 
-int color_row(image_t *sg, size_t row, image_t *texture, list_t *points, ssize_t edge_echo_offset) {
-  node_t *node;
+/* Stereogram row row is written to row sg_row of sg, which may be just a band of the stereogram.
+   ramped is the worker's colored copy of texture for --ramp-on-texture, or NULL. */
+int color_row(image_t *sg, size_t sg_row, size_t row, const texture_t *texture, ramped_texture_t *ramped, const point_buffer_t *points) {
+  size_t point;
 
   float width;
 
@@ -641,30 +955,37 @@ int color_row(image_t *sg, size_t row, image_t *texture, list_t *points, ssize_t
 
   float accum[4];
 
-  ssize_t texture_height;
-
   size_t texture_row;
-  ssize_t texture_row_used;
+  size_t texture_row_used;
+
+  pixel_run_t run;
 
-  ssize_t i;
+  run.store = image_row_storer(sg->format);
+  run.row = image_get_row(sg, sg_row);
+  run.start = 0;
+  run.count = 0;
 
   width = (float) image_get_width(sg);
 
-  texture_row = row % image_get_height(texture);
+  if (ramped) {
+    texture = ramped->texture;
+  }
+
+  texture_row = row % texture_get_height(texture);
 
   accum[0] = 0.0f;
   accum[1] = 0.0f;
   accum[2] = 0.0f;
   accum[3] = 0.0f;
 
-  for (node = points->first;  node->next;  node = node->next) {
-    left = node->point.x;
-    right = node->next->point.x;
+  for (point = 0;  point + 1 < points->count;  point++) {
+    left = points->x[point];
+    right = points->x[point + 1];
 
-    left_x = node->point.right_x;
-    left_y = node->point.right_y;
+    left_x = points->right_x[point];
+    left_y = points->right_y[point];
 
-    right_x = node->next->point.left_x;
+    right_x = points->left_x[point + 1];
 
     /* We can't do anything if we haven't yet gotten to the left edge of the image. */
     if (right <= 0.0f) {
@@ -676,23 +997,10 @@ int color_row(image_t *sg, size_t row, image_t *texture, list_t *points, ssize_t
       break;
     }
 
-    texture_height = (ssize_t) image_get_height(texture);
+    texture_row_used = texture_echo_row(texture, texture_row, left_y);
 
-    texture_row_used = texture_row;
-    for (i = 0;  i < left_y;  ++i) {
-      texture_row_used = (texture_row_used + edge_echo_offset) % texture_height;
-      if (texture_row_used == texture_row) {
-        --i;
-      }
-    }
-    for (i = 0;  i > left_y;  --i) {
-      texture_row_used = (texture_row_used - edge_echo_offset);
-      while (texture_row_used < 0) {
-        texture_row_used += texture_height;
-      }
-      if (texture_row_used == texture_row) {
-        ++i;
-      }
+    if (ramped) {
+      ramped_texture_color_row(ramped, texture_row_used, row);
     }
 
     while (right - floorf(left) > 1.0f) {
@@ -700,14 +1008,16 @@ int color_row(image_t *sg, size_t row, image_t *texture, list_t *points, ssize_t
       tmp_right = floorf(left) + 1.0f;
       tmp_right_x = left_x + (right_x - left_x) * (tmp_right - left) / (right - left);
 
-      if (left >= 0.0f) {
-        /* We're clear of the left edge of the screen, so we're actually in a pixel. */
+      if (left >= 0.0f && left < width) {
+        /* We're clear of both edges of the screen, so we're actually in a pixel.  (A range that
+           runs past the right edge would otherwise land in the next row, which may belong to
+           another thread.) */
         if (add_color_for_range(texture, left_x, tmp_right_x, texture_row_used, tmp_right - left, accum) == -1) {
           return -1;
         }
 
         /* We just finished up the color for a pixel, so apply that color to the final image. */
-        image_set_pixel(sg, accum, (size_t) left, row);
+        pixel_run_put(&run, (size_t) left, accum);
 
         /* Reset our accumulation buffer. */
         accum[0] = 0.0f;
@@ -730,9 +1040,9 @@ int color_row(image_t *sg, size_t row, image_t *texture, list_t *points, ssize_t
       /* We need to check for the special case where the right side of the range exactly coincides
          with an output image pixel boundary.  In that case, we need to write the pixel to the
          image. */
-      if (floorf(right) == right) {
+      if (floorf(right) == right && left < width) {
         /* We just finished up the color for a pixel, so apply that color to the final image. */
-        image_set_pixel(sg, accum, (size_t) left, row);
+        pixel_run_put(&run, (size_t) left, accum);
 
         /* Reset our accumulation buffer. */
         accum[0] = 0.0f;
@@ -743,27 +1053,90 @@ int color_row(image_t *sg, size_t row, image_t *texture, list_t *points, ssize_t
     }
   }
 
+  pixel_run_flush(&run);
+
+  return 0;
+}
+
+
+/* points is scratch space that the caller reuses from row to row.  color_ramp is NULL if the row
+   isn't to be colored. */
+int generate_row(image_t *sg, size_t sg_row, size_t row, const heightmap_t *heightmap, const texture_t *texture, ramped_texture_t *ramped, float separation_max,
+                 point_buffer_t *points, const color_ramp_t *color_ramp, pattern_t pattern_type) {
+  point_buffer_clear(points);
+
+  if (generate_control_points(points, row, heightmap, separation_max) == -1) return -1;
+
+  /* All right.  Now that we have all the control points for this row,
+     it's time to color the pixels. */
+  if (color_row(sg, sg_row, row, texture, ramped, points) == -1) return -1;
+
+  if (color_ramp) {
+    /* While the row is still in cache, rather than in a pass of its own over the whole image. */
+    image_t row_image = { image_get_width(sg), 1, sg->format, image_get_row(sg, sg_row) };
+
+    apply_color_ramp_for_pattern_type(&row_image, row, heightmap_get_height(heightmap), color_ramp, pattern_type);
+  }
+
   return 0;
 }
 
 
-int generate_row(image_t *sg, size_t row, heightmap_t *heightmap, image_t *texture, float separation_min, float separation_max, ssize_t edge_echo_offset) {
+typedef struct {
+  image_t *sg;
+  size_t first_row;  /* the stereogram row that sg starts at */
+  const heightmap_t *heightmap;
+  const texture_t *texture;
+  ramped_texture_t *ramped_textures;  /* one per worker, or NULL */
+  float separation_max;
+  point_buffer_t *points;  /* one per worker */
+  const color_ramp_t *color_ramp;  /* NULL if the rows aren't to be colored */
+  pattern_t pattern_type;
+} stereogram_job_t;
+
+
+int generate_row_task(void *arg, size_t index, unsigned worker) {
+  const stereogram_job_t *job = arg;
+
+  return generate_row(job->sg, index, job->first_row + index, job->heightmap, job->texture,
+                      job->ramped_textures ? &job->ramped_textures[worker] : NULL, job->separation_max, &job->points[worker],
+                      job->color_ramp, job->pattern_type);
+}
+
+
+/* Fills sg with the stereogram rows starting at first_row, colored with color_ramp unless it's
+   NULL.  The heightmap's separations must already have been computed for those rows.
+   ramped_textures, if it isn't NULL, has one colored copy of texture for each of pool's threads. */
+int render_stereogram_band(image_t *sg, size_t first_row, const heightmap_t *heightmap, const texture_t *texture, ramped_texture_t *ramped_textures,
+                           float separation_max, thread_pool_t *pool, const color_ramp_t *color_ramp, pattern_t pattern_type) {
+  point_buffer_t *points = NULL;
   int retval = 0;
-  list_t points;
 
-  if (list_init(&points) == -1) {
-    perror("list_init()");
-    return -1;
+  size_t width = image_get_width(sg);
+
+  unsigned thread_count = thread_pool_get_thread_count(pool);
+  unsigned initialized = 0;
+
+  /* A row usually ends up with a bit more than one control point per pixel.  The buffers grow
+     if a row needs more. */
+  if ((points = calloc(thread_count, sizeof(*points))) == NULL) goto bad;
+  for (initialized = 0;  initialized < thread_count;  initialized++) {
+    if (point_buffer_init(&points[initialized], 2 * width) == -1) goto bad;
   }
 
-  if (generate_control_points(&points, row, heightmap, separation_min, separation_max) == -1) goto bad;
+  /* Each row only reads the heightmap and the texture and only writes its own row of the
+     output, so the rows can be generated in any order, on any thread. */
+  stereogram_job_t job = { sg, first_row, heightmap, texture, ramped_textures, separation_max, points, color_ramp, pattern_type };
 
-  /* All right.  Now that we have all the control points for this row,
-     it's time to color the pixels. */
-  if (color_row(sg, row, texture, &points, edge_echo_offset) == -1) goto bad;
+  if (thread_pool_run(pool, image_get_height(sg), generate_row_task, &job) == -1) goto bad;
 
  cleanup:
-  list_destroy(&points);
+  if (points) {
+    for (unsigned i = 0;  i < initialized;  i++) {
+      point_buffer_destroy(&points[i]);
+    }
+    free(points);
+  }
 
   return retval;
 
@@ -773,37 +1146,32 @@ int generate_row(image_t *sg, size_t row, heightmap_t *heightmap, image_t *textu
 }
 
 
-image_t *create_stereogram(heightmap_t *heightmap, image_t *texture, float separation_min, float separation_max, ssize_t edge_echo_offset) {
+/* The heightmap's separations must already have been computed.  color_ramp is NULL if the
+   stereogram isn't to be colored. */
+image_t *create_stereogram(const heightmap_t *heightmap, const texture_t *texture, ramped_texture_t *ramped_textures, float separation_max, thread_pool_t *pool,
+                           image_pixel_format_t format, const color_ramp_t *color_ramp, pattern_t pattern_type) {
   image_t *sg;
 
-  unsigned long width;
-  unsigned long height;
-
-  width  = heightmap_get_width(heightmap);
-  height = heightmap_get_height(heightmap);
-
-  if ((sg = image_create(width, height)) == NULL) {
+  if ((sg = image_create_with_format(heightmap_get_width(heightmap), heightmap_get_height(heightmap), format)) == NULL) {
     perror("image_create() failed");
     return NULL;
   }
 
-  for (size_t row = 0;  row < height;  row++) {
-    if (generate_row(sg, row, heightmap, texture, separation_min, separation_max, edge_echo_offset) == -1 ) {
-      image_destroy(sg);
-      return NULL;
-    }
+  if (render_stereogram_band(sg, 0, heightmap, texture, ramped_textures, separation_max, pool, color_ramp, pattern_type) == -1) {
+    image_destroy(sg);
+    return NULL;
   }
 
   return sg;
 }
 
 
-int initialize_generated_texture_color_ramp(color_ramp_t *ramp) {
+int initialize_generated_texture_color_ramp(color_ramp_t *ramp, rng_t *rng) {
   color_t color;
 
-  float hue = rand_normal();
-  float saturation = rand_in_range(TEXTURE_COLOR_MIN_SATURATION, TEXTURE_COLOR_MAX_SATURATION);
-  float value = rand_in_range(TEXTURE_COLOR_MIN_VALUE, TEXTURE_COLOR_MAX_VALUE);
+  float hue = rand_normal(rng);
+  float saturation = rand_in_range(rng, TEXTURE_COLOR_MIN_SATURATION, TEXTURE_COLOR_MAX_SATURATION);
+  float value = rand_in_range(rng, TEXTURE_COLOR_MIN_VALUE, TEXTURE_COLOR_MAX_VALUE);
   color_from_hsv(&color, hue, saturation, value);
 
   color_ramp_init(ramp);
@@ -812,271 +1180,1986 @@ int initialize_generated_texture_color_ramp(color_ramp_t *ramp) {
 }
 
 
-void apply_color_ramp_for_pattern_type(image_t *image, const color_ramp_t *color_ramp, pattern_t pattern_type) {
-  blend_method_t blend_method = pattern_type == PATTERN_TYPE_PERLIN ? BLEND_METHOD_ALPHA : BLEND_METHOD_OFFSET;
-  image_apply_color_ramp(image, color_ramp, blend_method);
-}
+/* Renders the stereogram band_rows rows at a time, writing each band out before moving on to the
+   next, so the whole stereogram is never in memory at once.  color_ramp is NULL
+   if the stereogram isn't to be colored.  The heightmap's separations are computed here, a band
+   at a time. */
+int stream_stereogram(const char *filename, heightmap_t *heightmap, const texture_t *texture, ramped_texture_t *ramped_textures, float separation_min,
+                      float separation_max, thread_pool_t *pool, image_pixel_format_t format, size_t band_rows, const color_ramp_t *color_ramp,
+                      pattern_t pattern_type) {
+  image_writer_t *writer;
+  image_t *band = NULL;
+  int retval = 0;
 
+  size_t width = heightmap_get_width(heightmap);
+  size_t height = heightmap_get_height(heightmap);
 
-void print_usage_and_fail(const char *usage, const char *fmt, ...) {
-  va_list ap;
+  if ((writer = image_writer_open(filename, width, height)) == NULL) {
+    perror("image_writer_open()");
+    return -1;
+  }
 
-  fputs(usage, stderr);
-  fputc('\n', stderr);
+  for (size_t first_row = 0;  first_row < height;  first_row += band_rows) {
+    size_t row_count = height - first_row < band_rows ? height - first_row : band_rows;
 
-  va_start(ap, fmt);
-  vfprintf(stderr, fmt, ap);
-  va_end(ap);
+    /* A fresh band every time, so nothing from the last one shows through. */
+    if ((band = image_create_with_format(width, row_count, format)) == NULL) {
+      perror("image_create() failed");
+      goto bad;
+    }
 
-  fputs("\n\n", stderr);
+    if (heightmap_compute_separation_rows(heightmap, separation_min, separation_max, first_row, row_count) == -1) {
+      perror("heightmap_compute_separation_rows()");
+      goto bad;
+    }
 
-  exit(1);
+    if (render_stereogram_band(band, first_row, heightmap, texture, ramped_textures, separation_max, pool, color_ramp, pattern_type) == -1) goto bad;
+
+    if (image_writer_write_rows(writer, band) == -1) goto bad;
+
+    image_destroy(band);
+    band = NULL;
+  }
+
+ cleanup:
+  if (band) image_destroy(band);
+  if (image_writer_close(writer) == -1) retval = -1;
+
+  return retval;
+
+ bad:
+  retval = -1;
+  goto cleanup;
 }
 
 
-int main(int argc, char **argv) {
-  heightmap_t *heightmap;
-  image_t *texture;
-  image_t *output;
+/* Everything that describes one stereogram.  In batch mode every job starts from a copy of what
+   was given on the command line and overrides it with its own options. */
+typedef struct {
+  const char *heightmap_file;
+  const char *output_file;
+  const char *texture_file;
 
-  length_t separation_max = length_from_millimeters(SEPARATION_MAX_DEFAULT_MILLIS);
-  length_t separation_min = length_from_millimeters(SEPARATION_MIN_DEFAULT_MILLIS);
+  length_t separation_max;
+  length_t separation_min;
+  int separation_max_specified;
+  int separation_min_specified;
 
-  length_t display_width = length_from_inches(DISPLAY_WIDTH_DEFAULT_INCHES);
+  length_t display_width;
 
-  ssize_t edge_echo_offset;
+  int preserve_height;
+  int add_noise;
 
-  int separation_max_specified = 0;
-  int separation_min_specified = 0;
+  pattern_t pattern_type;
+  noise_kernel_t noise_kernel;
+  char color_ramp_spec[256];
+  int ramp_on_texture;  /* color the generated texture, rather than the stereogram */
 
-  int preserve_height = 0;
+  image_pixel_format_t pixel_format;
 
-  int add_noise = 0;
+  size_t max_memory;  /* 0 means render the whole stereogram at once */
 
-  pattern_t pattern_type = PATTERN_TYPE_RANDOM;
+  int seeded;
+  uint64_t seed;
 
-  char color_ramp_spec[256] = "";
+  /* With a sequence, the -i and -o filenames are patterns for the frame number. */
+  int sequence;
+  unsigned first_frame;
+  unsigned last_frame;
+} render_options_t;
 
-  const char *heightmap_file = NULL;
-  const char *output_file = NULL;
 
-  const char *texture_file = NULL;
+/* Options that apply to the whole process, and so can only be given on the command line. */
+typedef struct {
+  size_t thread_count;
+  const char *batch_file;
+  const char *serve_socket;
+  const char *texture_bank;  /* to take textures from */
+  const char *build_texture_bank;  /* to add textures to, instead of rendering */
+  int help;
+} process_options_t;
 
-  char *usagefmt = "\nUsage: %s [options] -i <depthmap_image> -o <output_image>\n"
-                   "\n"
-                   "Depthmap is an image that is one of two types:\n"
-                   " * Grayscale.  Brighter pixels represent shallower depth.\n"
-                   " * Rainbow.  Redder hues represent shallower depth.  This gives more depth\n"
-                   "   resolution than grayscale.\n"
-                   "\n"
-		   "For the -f, -n, and -w options (see below), the value is specified as a length with\n"
-		   "units.  Accepted units are meters, centimeters, millimeters, and inches.\n"
-		   "These can be abbreviated as m, cm, mm, and in, respectively.\n"
-		   "\n"
-                   "Options:\n"
-                   "\n"
-                   "  -f  maximum separation.  Default %s\n"
-                   "  -n  minimum separation.  Default %s\n"
-		   "  -w  physical width of target display device.  Set this if you're rendering for\n"
-		   "      a very large display such as a poster, or a very small one like a phone.\n"
-		   "      Default is %s, which is suitable for a typical laptop screen.\n"
-                   "  -t  optional texture image file to use.  If this option is not provided,\n"
-                   "      then a random texture will be generated.\n"
-                   "  -p  preserve the height of the texture.  Use this option if, for example,\n"
-                   "      your texture image is exactly the height of the stereogram and you want\n"
-                   "      to keep it that way in the final image.\n"
-                   "  -N  add noise to the texture image.\n"
-                   "  -P  type of texture pattern to generate when the -t option is omitted.\n"
-                   "      Valid values are 'perlin', 'polygons', 'ellipses', and 'dots'.  If omitted,\n"
-		   "      then a random pattern type will be selected for you.\n"
-		   "  -c  color ramp for the generated texture when the -t option is omitted.\n"
-		   "      Format is one of:\n"
-		   "      * <y>:<color>[,...]\n"
-		   "      * <color>\n"
-		   "      The first format specifies a color ramp.  The second specifies a single\n"
-		   "      color for the entire image.\n"
-		   "      <y> is a normalized floating point value between 0 and 1, where 0 is the\n"
-		   "      bottom of the image and 1 is the top.\n"
-		   "      Colors can be specified in several different ways:\n"
-		   "      * \"blue\"\n"
-		   "      * \"#0000ff\"\n"
-		   "      * \"rgb(0,0,255)\"\n"
-		   "      * \"cmyk(100,100,100,10)\"\n"
-		   "      For example, to make a color ramp from green at the bottom, white in the\n"
-		   "      middle, and blue at the top, you could put this:\n"
-		   "        0:green,0.5:white,1:blue\n"
-		   "      If empty or omitted, then a single random color will be used.\n"
-                   "  -h  print this usage text and exit.\n";
 
-  char usage[4096];
+static const struct option long_options[] = {
+  { "max-memory", required_argument, NULL, OPTION_MAX_MEMORY },
+  { "pixel-format", required_argument, NULL, OPTION_PIXEL_FORMAT },
+  { "seed", required_argument, NULL, OPTION_SEED },
+  { "batch", required_argument, NULL, OPTION_BATCH },
+  { "frames", required_argument, NULL, OPTION_FRAMES },
+  { "serve", required_argument, NULL, OPTION_SERVE },
+  { "texture-bank", required_argument, NULL, OPTION_TEXTURE_BANK },
+  { "build-texture-bank", required_argument, NULL, OPTION_BUILD_TEXTURE_BANK },
+  { "noise-kernel", required_argument, NULL, OPTION_NOISE_KERNEL },
+  { "ramp-on-texture", no_argument, NULL, OPTION_RAMP_ON_TEXTURE },
+  { NULL, 0, NULL, 0 }
+};
+
+
+void render_options_init(render_options_t *options) {
+  options->heightmap_file = NULL;
+  options->output_file = NULL;
+  options->texture_file = NULL;
+
+  options->separation_max = length_from_millimeters(SEPARATION_MAX_DEFAULT_MILLIS);
+  options->separation_min = length_from_millimeters(SEPARATION_MIN_DEFAULT_MILLIS);
+  options->separation_max_specified = 0;
+  options->separation_min_specified = 0;
+
+  options->display_width = length_from_inches(DISPLAY_WIDTH_DEFAULT_INCHES);
+
+  options->preserve_height = 0;
+  options->add_noise = 0;
 
+  options->pattern_type = PATTERN_TYPE_RANDOM;
+  options->noise_kernel = NOISE_KERNEL_PERLIN3D;
+  options->color_ramp_spec[0] = '\0';
+  options->ramp_on_texture = 0;
+
+  options->pixel_format = IMAGE_FORMAT_RGBA_FLOAT;
+
+  options->max_memory = 0;
+
+  options->seeded = 0;
+  options->seed = 0;
+
+  options->sequence = 0;
+  options->first_frame = 0;
+  options->last_frame = 0;
+}
+
+
+int option_error(char *error, size_t error_size, const char *fmt, ...) {
+  va_list ap;
+
+  va_start(ap, fmt);
+  vsnprintf(error, error_size, fmt, ap);
+  va_end(ap);
+
+  return -1;
+}
+
+
+/* Parses argv into options, and into process unless it's NULL, in which case the options that
+   belong to the whole process are refused.  Returns -1 with a message in error if argv doesn't
+   parse. */
+int parse_options(render_options_t *options, process_options_t *process, int argc, char **argv, char *error, size_t error_size) {
   int o;
 
-  char separation_max_default_str[50];
-  length_fmt_millimeters(separation_max, separation_max_default_str, sizeof(separation_max_default_str));
-  char separation_min_default_str[50];
-  length_fmt_millimeters(separation_min, separation_min_default_str, sizeof(separation_min_default_str));
-  char display_width_default_str[50];
-  length_fmt_centimeters(display_width, display_width_default_str, sizeof(display_width_default_str));
-  snprintf(usage, sizeof(usage), usagefmt, argv[0], separation_max_default_str, separation_min_default_str, display_width_default_str);
-  usage[sizeof(usage)-1] = '\0';  /* just in case */
+  optind = 0;  /* start over, since we may have parsed another argv already */
+
+  while ((o = getopt_long(argc, argv, "i:o:f:n:w:t:pNP:c:j:h", long_options, NULL)) != -1) {
+    if (process == NULL && (o == 'j' || o == 'h' || o == OPTION_BATCH || o == OPTION_SERVE
+                            || o == OPTION_TEXTURE_BANK || o == OPTION_BUILD_TEXTURE_BANK)) {
+      return option_error(error, error_size, "-j, -h, --batch, --serve and the texture bank options can only be given on the command line");
+    }
 
-  while ((o = getopt(argc, argv, "i:o:f:n:w:t:pNP:c:h")) != -1) {
     switch (o) {
       case 'i':
-        heightmap_file = optarg; break;
+        options->heightmap_file = optarg; break;
       case 'o':
-        output_file = optarg; break;
+        options->output_file = optarg; break;
       case 'f':
-        if (length_from_string(&separation_max, optarg) == -1) {
-          print_usage_and_fail(usage, "-f requires a valid positive length specifier");
+        if (length_from_string(&options->separation_max, optarg) == -1) {
+          return option_error(error, error_size, "-f requires a valid positive length specifier");
         }
-        separation_max_specified = 1;
+        options->separation_max_specified = 1;
         break;
       case 'n':
-        if (length_from_string(&separation_min, optarg) == -1) {
-          print_usage_and_fail(usage, "-n requires a valid positive length specifier less than maximum separation");
+        if (length_from_string(&options->separation_min, optarg) == -1) {
+          return option_error(error, error_size, "-n requires a valid positive length specifier less than maximum separation");
         }
-        separation_min_specified = 1;
+        options->separation_min_specified = 1;
         break;
       case 'w':
-        if (length_from_string(&display_width, optarg) == -1) {
-          print_usage_and_fail(usage, "-w requires a valid positive length specifier");
+        if (length_from_string(&options->display_width, optarg) == -1) {
+          return option_error(error, error_size, "-w requires a valid positive length specifier");
         }
         break;
       case 't':
-        texture_file = optarg; break;
+        options->texture_file = optarg; break;
       case 'p':
-        preserve_height = 1;  break;
+        options->preserve_height = 1;  break;
       case 'N':
-        add_noise = 1;  break;
+        options->add_noise = 1;  break;
       case 'P':
-        if ((pattern_type = image_pattern_type_from_name(optarg)) == -1) {
-          print_usage_and_fail(usage, "Invalid pattern type for -P: %s", optarg);
+        if ((options->pattern_type = image_pattern_type_from_name(optarg)) == -1) {
+          return option_error(error, error_size, "Invalid pattern type for -P: %s", optarg);
         }
         break;
       case 'c':
-	strncpy(color_ramp_spec, optarg, sizeof(color_ramp_spec));
-	break;
-      case 'h':
-        fputs(usage, stdout);
-        fputc('\n', stdout);
-        return 0;
+        strncpy(options->color_ramp_spec, optarg, sizeof(options->color_ramp_spec));
+        options->color_ramp_spec[sizeof(options->color_ramp_spec) - 1] = '\0';
+        break;
+      case 'j':
+        if (ascii_to_size_t(optarg, &process->thread_count) == -1 || process->thread_count > UINT_MAX) {
+          return option_error(error, error_size, "-j requires a non-negative thread count");
+        }
+        break;
+      case OPTION_MAX_MEMORY:
+        if (ascii_to_byte_size(optarg, &options->max_memory) == -1 || options->max_memory == 0) {
+          return option_error(error, error_size, "--max-memory requires a positive size, such as 512M");
+        }
+        break;
+      case OPTION_PIXEL_FORMAT:
+        if (image_pixel_format_from_name(&options->pixel_format, optarg) == -1) {
+          return option_error(error, error_size, "Invalid pixel format for --pixel-format: %s", optarg);
+        }
+        break;
+      case OPTION_NOISE_KERNEL:
+        if ((options->noise_kernel = image_noise_kernel_from_name(optarg)) == -1) {
+          return option_error(error, error_size, "Invalid noise kernel for --noise-kernel: %s", optarg);
+        }
+        break;
+      case OPTION_RAMP_ON_TEXTURE:
+        options->ramp_on_texture = 1;  break;
+      case OPTION_SEED:
+        if (ascii_to_uint64(optarg, &options->seed) == -1) {
+          return option_error(error, error_size, "--seed requires a non-negative integer");
+        }
+        options->seeded = 1;
         break;
+      case OPTION_BATCH:
+        process->batch_file = optarg; break;
+      case OPTION_SERVE:
+        process->serve_socket = optarg; break;
+      case OPTION_TEXTURE_BANK:
+        process->texture_bank = optarg; break;
+      case OPTION_BUILD_TEXTURE_BANK:
+        process->build_texture_bank = optarg; break;
+      case OPTION_FRAMES:
+        if (ascii_to_frame_range(optarg, &options->first_frame, &options->last_frame) == -1) {
+          return option_error(error, error_size, "--frames requires a range of frame numbers, such as 1-240");
+        }
+        options->sequence = 1;
+        break;
+      case 'h':
+        process->help = 1;  break;
       case '?':
       default:
-        fputs(usage, stderr);
-        return 1;
-        break;
+        /* getopt_long() has already said what was wrong. */
+        return option_error(error, error_size, "Invalid option");
     }
   }
 
-  argv += optind;
-  argc -= optind;
+  if (optind < argc) {
+    return option_error(error, error_size, "Unexpected argument: %s", argv[optind]);
+  }
 
-  /* Make sure the input makes sense. */
+  return 0;
+}
 
-  if (argc > 0) {
-    fputs(usage, stderr);
-    fputc('\n', stderr);
-    return 1;
+
+/* Checks a job's options: check_render_options() for a job that renders, or
+   check_texture_options() for one that only goes into a texture bank. */
+typedef int (*options_check_t)(const render_options_t *options, char *error, size_t error_size);
+
+
+/* Makes sure the options describe a texture we can make.  A texture bank build only needs
+   this much, since nothing is rendered or written to -o. */
+int check_texture_options(const render_options_t *options, char *error, size_t error_size) {
+  char separation_max_default_str[50];
+  char separation_min_default_str[50];
+  color_ramp_t color_ramp;
+
+  length_fmt_millimeters(length_from_millimeters(SEPARATION_MAX_DEFAULT_MILLIS), separation_max_default_str, sizeof(separation_max_default_str));
+  length_fmt_millimeters(length_from_millimeters(SEPARATION_MIN_DEFAULT_MILLIS), separation_min_default_str, sizeof(separation_min_default_str));
+
+  /* The texture's size follows the heightmap's. */
+  if (options->heightmap_file == NULL) {
+    return option_error(error, error_size, "Missing required parameter: -i");
   }
 
-  if (heightmap_file == NULL) {
-    print_usage_and_fail(usage, "Missing required parameter: -i");
+  if (options->sequence && !is_frame_pattern(options->heightmap_file)) {
+    return option_error(error, error_size, "--frames requires -i to contain one %%d for the frame number, such as depth%%04d.pgm");
   }
 
-  if (output_file == NULL) {
-    print_usage_and_fail(usage, "Missing required parameter: -o");
+  if (options->ramp_on_texture && options->texture_file) {
+    return option_error(error, error_size, "--ramp-on-texture can't be combined with -t, since only a generated texture is colored");
   }
 
-  if (length_meters(separation_max) <= 0.0f) {
-    print_usage_and_fail(usage, "-f requires a valid positive length specifier");
+  if (length_meters(options->separation_max) <= 0.0f) {
+    return option_error(error, error_size, "-f requires a valid positive length specifier");
   }
-  if (length_meters(separation_min) <= 0.0f) {
-    print_usage_and_fail(usage, "-n requires a valid positive length specifier");
+  if (length_meters(options->separation_min) <= 0.0f) {
+    return option_error(error, error_size, "-n requires a valid positive length specifier");
   }
-  if (length_cmp(separation_min, separation_max) >= 0) {
-    if (separation_max_specified && separation_min_specified) {
-      print_usage_and_fail(usage, "-f must be greater than -n");
-    } else if (separation_max_specified) {
-      print_usage_and_fail(usage, "-f must be greater than minimum separation (%s)", separation_min_default_str);
+  if (length_cmp(options->separation_min, options->separation_max) >= 0) {
+    if (options->separation_max_specified && options->separation_min_specified) {
+      return option_error(error, error_size, "-f must be greater than -n");
+    } else if (options->separation_max_specified) {
+      return option_error(error, error_size, "-f must be greater than minimum separation (%s)", separation_min_default_str);
     } else {
-      print_usage_and_fail(usage, "-n must be less than maximum separation (%s)", separation_max_default_str);
+      return option_error(error, error_size, "-n must be less than maximum separation (%s)", separation_max_default_str);
+    }
+  }
+
+  if (options->color_ramp_spec[0] && color_ramp_from_string(&color_ramp, options->color_ramp_spec) == -1) {
+    return option_error(error, error_size, "Invalid color ramp string \"%s\" for -c", options->color_ramp_spec);
+  }
+
+  return 0;
+}
+
+
+/* Makes sure the options describe a stereogram we can render. */
+int check_render_options(const render_options_t *options, char *error, size_t error_size) {
+  if (options->heightmap_file == NULL) {
+    return option_error(error, error_size, "Missing required parameter: -i");
+  }
+
+  if (options->output_file == NULL) {
+    return option_error(error, error_size, "Missing required parameter: -o");
+  }
+
+  if (options->sequence) {
+    if (!is_frame_pattern(options->heightmap_file) || !is_frame_pattern(options->output_file)) {
+      return option_error(error, error_size, "--frames requires -i and -o to each contain one %%d for the frame number, such as depth%%04d.pgm");
     }
+    if (options->max_memory) {
+      return option_error(error, error_size, "--frames can't be combined with --max-memory");
+    }
+  }
+
+  if (options->max_memory && !image_writer_supports(options->output_file)) {
+    return option_error(error, error_size, "--max-memory requires the output file to be a .ppm, .pam, .pfm or .qoi image");
+  }
+
+  return check_texture_options(options, error, error_size);
+}
+
+
+/* Everything rendering needs besides the heightmap itself.  It depends only on the options and
+   the heightmap's size, so every frame of a sequence can share one. */
+typedef struct {
+  color_ramp_t color_ramp;  /* for a generated texture */
+  pattern_t pattern_type;
+  image_pixel_format_t pixel_format;
+  uint64_t seed;  /* --seed, or a fresh one */
+
+  float separation_min_pixels;
+  float separation_max_pixels;
+
+  image_t *texture;
+  texture_t *prepared_texture;
+
+  /* For --ramp-on-texture, one colored copy of the texture for each of the pool's threads.
+     Otherwise NULL. */
+  ramped_texture_t *ramped_textures;
+  unsigned ramped_texture_count;
+
+  /* What the texture is stored under in a texture bank, if it can be banked at all. */
+  int bankable;
+  char bank_key[PATH_MAX + 256];
+
+  int texture_from_bank;  /* texture is bank_texture, a view of a bank's pixels */
+  image_t bank_texture;
+} render_setup_t;
+
+
+/* Where render_setup_init() looks for a texture before making one.  Either may be NULL. */
+typedef struct {
+  lru_cache_t *cache;
+  const texture_bank_t *bank;
+} texture_sources_t;
+
+
+void render_setup_destroy(render_setup_t *setup) {
+  for (unsigned i = 0;  i < setup->ramped_texture_count;  i++) {
+    ramped_texture_destroy(&setup->ramped_textures[i]);
+  }
+  free(setup->ramped_textures);
+  if (setup->prepared_texture) texture_destroy(setup->prepared_texture);
+  if (setup->texture && !setup->texture_from_bank) image_destroy(setup->texture);
+
+  setup->ramped_textures = NULL;
+  setup->ramped_texture_count = 0;
+  setup->prepared_texture = NULL;
+  setup->texture = NULL;
+}
+
+
+/* Returns how many bytes the prepared texture and any colored copies of it take up. */
+size_t render_setup_get_texture_memory_size(const render_setup_t *setup) {
+  size_t size = texture_get_memory_size(setup->prepared_texture);
+
+  for (unsigned i = 0;  i < setup->ramped_texture_count;  i++) {
+    size += ramped_texture_get_memory_size(&setup->ramped_textures[i]);
   }
 
-  srand(time(NULL));
+  return size;
+}
+
+
+/* Returns the seed a job's random choices and generated texture come from. */
+uint64_t job_seed(const render_options_t *options) {
+  return options->seeded ? options->seed : rng_fresh_seed();
+}
+
 
-  image_init();  /* initialize the image library */
+/* Picks the pattern, then the color ramp.  The pattern comes first so that, with a seed, it
+   doesn't depend on the ramp, and a stereogram can be recolored without rendering it again.
+   These take stream 1 of the seed, leaving stream 0 to the generated texture. */
+int choose_pattern_and_color_ramp(const render_options_t *options, uint64_t seed, pattern_t *pattern_type, color_ramp_t *color_ramp) {
+  rng_t rng;
 
-  color_ramp_t generated_texture_color_ramp;
-  if (color_ramp_spec[0]) {
-    if (color_ramp_from_string(&generated_texture_color_ramp, color_ramp_spec) == -1) {
-      print_usage_and_fail(usage, "Invalid color ramp string \"%s\" for -c", color_ramp_spec);
+  rng_seed_stream(&rng, seed, 1);
+
+  *pattern_type = options->pattern_type;
+  if (*pattern_type == PATTERN_TYPE_RANDOM) {
+    *pattern_type = (pattern_t) rand_index(&rng, PATTERN_TYPE_COUNT);
+  }
+
+  if (options->color_ramp_spec[0]) {
+    if (color_ramp_from_string(color_ramp, options->color_ramp_spec) == -1) {
+      fprintf(stderr, "Invalid color ramp string \"%s\" for -c\n", options->color_ramp_spec);
+      return -1;
     }
   } else {
-    if (initialize_generated_texture_color_ramp(&generated_texture_color_ramp) == -1) {
+    if (initialize_generated_texture_color_ramp(color_ramp, &rng) == -1) {
       fprintf(stderr, "Internal error: Failed to generate color ramp from single random color: %s\n", strerror(errno));
-      exit(1);
+      return -1;
     }
   }
 
-  if ((heightmap = heightmap_read(heightmap_file)) == NULL) {
-    return -1;
-  }
+  return 0;
+}
+
 
-  unsigned output_width = heightmap_get_width(heightmap);
-  unsigned output_height = heightmap_get_height(heightmap);
+/* Generated textures tile vertically, so however tall the stereogram is, they only need a few
+   times their width in rows to keep the repeats from showing. */
+size_t generated_texture_height(size_t height, float separation_average_pixels) {
+  size_t tile_height = (size_t) ceilf(GENERATED_TEXTURE_HEIGHT_RATIO * separation_average_pixels);
+
+  return tile_height < height ? tile_height : height;
+}
 
-  linear_density_t pixel_density = linear_density(output_width, display_width);
 
-  float separation_min_pixels = count_per_length(pixel_density, separation_min);
-  float separation_max_pixels = count_per_length(pixel_density, separation_max);
-  float separation_average_pixels = 0.5f * (separation_min_pixels + separation_max_pixels);
+/* Sets the setup's bank key to everything that goes into its finished texture, unless the
+   texture can't be banked: a generated texture, or noise, without a seed is meant to come out
+   different every time. */
+void set_bank_key(render_setup_t *setup, const render_options_t *options, size_t height, linear_density_t pixel_density, float texture_width) {
+  char file_key[PATH_MAX + 128];
+  int length;
 
-  if (pattern_type == PATTERN_TYPE_RANDOM) {
-    pattern_type = (pattern_t) ((rand() / (RAND_MAX + 1.0f)) * PATTERN_TYPE_COUNT);
+  if (options->texture_file) {
+    if ((options->add_noise && !options->seeded) || file_cache_key(options->texture_file, file_key, sizeof(file_key)) == -1) {
+      setup->bankable = 0;
+      return;
+    }
+    length = snprintf(setup->bank_key, sizeof(setup->bank_key), "file %s\t%a %d %" PRIu64 " %d %u",
+                      file_key, options->preserve_height ? 0.0f : texture_width, options->add_noise,
+                      options->add_noise ? options->seed : 0, (int) setup->pixel_format.type, setup->pixel_format.channels);
+  } else if (options->seeded) {
+    length = snprintf(setup->bank_key, sizeof(setup->bank_key), "generated %d %d %zu %zu %u %a %" PRIu64 " %d %d %u",
+                      (int) setup->pattern_type, (int) options->noise_kernel, (size_t) texture_width, height, pixel_density.count, pixel_density.length.meters,
+                      options->seed, options->add_noise, (int) setup->pixel_format.type, setup->pixel_format.channels);
+  } else {
+    length = -1;
   }
 
-  if ((texture = get_texture(texture_file, (size_t) separation_average_pixels, output_height, pixel_density, pattern_type)) == NULL) {
-    return 1;
+  setup->bankable = length >= 0 && (size_t) length < sizeof(setup->bank_key);
+}
+
+
+/* Picks the color ramp and pattern, and gets the texture ready, from sources if it's there. */
+int render_setup_init(render_setup_t *setup, const render_options_t *options, size_t width, size_t height, const texture_sources_t *sources, thread_pool_t *pool) {
+  ssize_t edge_echo_offset;
+  ssize_t max_shift;
+
+  setup->pixel_format = options->pixel_format;
+  setup->texture = NULL;
+  setup->prepared_texture = NULL;
+  setup->ramped_textures = NULL;
+  setup->ramped_texture_count = 0;
+  setup->texture_from_bank = 0;
+  setup->seed = job_seed(options);
+
+  if (choose_pattern_and_color_ramp(options, setup->seed, &setup->pattern_type, &setup->color_ramp) == -1) goto bad;
+
+  linear_density_t pixel_density = linear_density(width, options->display_width);
+
+  setup->separation_min_pixels = count_per_length(pixel_density, options->separation_min);
+  setup->separation_max_pixels = count_per_length(pixel_density, options->separation_max);
+  float separation_average_pixels = 0.5f * (setup->separation_min_pixels + setup->separation_max_pixels);
+
+  if (options->texture_file == NULL && setup->pattern_type == PATTERN_TYPE_PERLIN) {
+    /* The color ramp is blended in according to the texture's alpha, which has to survive
+       until then. */
+    setup->pixel_format.channels = 4;
   }
 
-  if (texture_file && !preserve_height) {
-    /* The user is providing us with a texture to use, and has not asked us to preserve the
-       height of the texture in the output.  The input texture could be any arbitrary size, but
-       in the output it will be horizontally scaled to between separation_min and separation_max.
-       We'd like to keep the aspect ratio of the texture for aesthetic purposes, so let's go ahead
-       and scale it vertically such that it will look good in the stereogram. */
-    if (scale_texture_height(texture, separation_average_pixels) == -1) {
-      return 1;
+  size_t texture_height = generated_texture_height(height, separation_average_pixels);
+
+  set_bank_key(setup, options, texture_height, pixel_density, separation_average_pixels);
+
+  if (setup->bankable && sources->bank && texture_bank_get(sources->bank, setup->bank_key, &setup->bank_texture) == 0) {
+    /* The bank has it finished already. */
+    setup->texture = &setup->bank_texture;
+    setup->texture_from_bank = 1;
+  } else {
+    if (options->texture_file == NULL && options->seeded && sources->cache) {
+      setup->texture = texture_cache_get(sources->cache, (size_t) separation_average_pixels, texture_height, pixel_density, setup->pattern_type, options->noise_kernel, options->seed, pool);
+    } else {
+      setup->texture = get_texture(options->texture_file, (size_t) separation_average_pixels, texture_height, pixel_density, setup->pattern_type, options->noise_kernel, setup->seed, pool);
+    }
+    if (setup->texture == NULL) goto bad;
+
+    if (options->texture_file && !options->preserve_height) {
+      /* The user is providing us with a texture to use, and has not asked us to preserve the
+         height of the texture in the output.  The input texture could be any arbitrary size, but
+         in the output it will be horizontally scaled to between separation_min and separation_max.
+         We'd like to keep the aspect ratio of the texture for aesthetic purposes, so let's go ahead
+         and scale it vertically such that it will look good in the stereogram. */
+      if (scale_texture_height(setup->texture, separation_average_pixels, pool) == -1) goto bad;
+    }
+
+    if (options->add_noise) {
+      if (image_add_noise(setup->texture, setup->seed, pool) == -1) goto bad;
     }
+
+    if (image_convert(setup->texture, setup->pixel_format) == -1) goto bad;
   }
 
-  if (add_noise) {
-    if (image_add_noise(texture) == -1) {
-      return 1;
+  edge_echo_offset = (ssize_t) (EDGE_ECHO_OFFSET_RATIO * setup->separation_max_pixels);
+  max_shift = max_edge_echo_shift(width, setup->separation_max_pixels);
+
+  if ((setup->prepared_texture = texture_create(setup->texture, edge_echo_offset, max_shift)) == NULL) goto bad;
+
+  if (options->ramp_on_texture) {
+    /* The ramp goes on copies, since the texture itself may be banked or shared, and rows are
+       colored as the workers draw them. */
+    unsigned thread_count = thread_pool_get_thread_count(pool);
+
+    if ((setup->ramped_textures = malloc(thread_count * sizeof(*setup->ramped_textures))) == NULL) {
+      PERROR("ramped texture allocation");
+      goto bad;
+    }
+    for (;  setup->ramped_texture_count < thread_count;  setup->ramped_texture_count++) {
+      if (ramped_texture_init(&setup->ramped_textures[setup->ramped_texture_count], setup->texture, edge_echo_offset, max_shift,
+                              &setup->color_ramp, setup->pattern_type, height) == -1) goto bad;
     }
   }
 
-  edge_echo_offset = (ssize_t) (EDGE_ECHO_OFFSET_RATIO * separation_max_pixels);
+  return 0;
+
+ bad:
+  render_setup_destroy(setup);
+  return -1;
+}
+
+
+/* The color ramp to apply to the stereogram, or NULL if it isn't to be colored.  A texture that
+   was generated from a pattern needs the ramp, unless --ramp-on-texture puts it on the texture
+   instead. */
+const color_ramp_t *render_setup_color_ramp(const render_setup_t *setup, const render_options_t *options) {
+  return options->texture_file || options->ramp_on_texture ? NULL : &setup->color_ramp;
+}
+
+
+/* Renders the stereogram described by options from its heightmap, which this takes ownership
+   of.  A streamed stereogram is written out here and *output is set to NULL; otherwise *output
+   is the finished image, for the caller to write. */
+int render_job(const render_options_t *options, heightmap_t *heightmap, thread_pool_t *pool, const texture_sources_t *sources, image_t **output) {
+  render_setup_t setup;
+  const color_ramp_t *color_ramp;
+  int retval = 0;
 
-  if ((output = create_stereogram(heightmap, texture, separation_min_pixels, separation_max_pixels, edge_echo_offset)) == NULL) {
+  size_t output_width = heightmap_get_width(heightmap);
+
+  *output = NULL;
+
+  if (render_setup_init(&setup, options, output_width, heightmap_get_height(heightmap), sources, pool) == -1) {
+    heightmap_destroy(heightmap);
     return -1;
   }
 
-  if (texture_file == NULL) {
-    /* The texture was generated from a pattern.
-       We need to apply the color ramp to it. */
-    apply_color_ramp_for_pattern_type(output, &generated_texture_color_ramp, pattern_type);
+  color_ramp = render_setup_color_ramp(&setup, options);
+
+  if (options->max_memory) {
+    /* Whatever's left after the heightmap, the texture and the per-thread control point buffers
+       goes to the band: its output pixels and its separations. */
+    size_t fixed_size = heightmap_get_memory_size(heightmap) + render_setup_get_texture_memory_size(&setup)
+                        + thread_pool_get_thread_count(pool) * 2 * output_width * sizeof(control_point_t);
+    size_t row_size = output_width * (image_pixel_size(setup.pixel_format) + sizeof(float));
+
+    if (options->max_memory < fixed_size + row_size) {
+      fprintf(stderr, "--max-memory is too small for this stereogram.  It needs at least %zu bytes.\n", fixed_size + row_size);
+      goto bad;
+    }
+
+    /* The separations are computed a band at a time, as the bands are rendered. */
+    if (stream_stereogram(options->output_file, heightmap, setup.prepared_texture, setup.ramped_textures, setup.separation_min_pixels, setup.separation_max_pixels, pool,
+                          setup.pixel_format, (options->max_memory - fixed_size) / row_size, color_ramp, setup.pattern_type) == -1) {
+      goto bad;
+    }
+  } else {
+    if (heightmap_compute_separations(heightmap, setup.separation_min_pixels, setup.separation_max_pixels) == -1) {
+      perror("heightmap_compute_separations()");
+      goto bad;
+    }
+
+    if ((*output = create_stereogram(heightmap, setup.prepared_texture, setup.ramped_textures, setup.separation_max_pixels, pool, setup.pixel_format,
+                                     color_ramp, setup.pattern_type)) == NULL) goto bad;
   }
 
-  if (image_write(output, output_file) == -1) {
-    return -1;
+ cleanup:
+  render_setup_destroy(&setup);
+  heightmap_destroy(heightmap);
+
+  return retval;
+
+ bad:
+  retval = -1;
+  goto cleanup;
+}
+
+
+typedef struct {
+  image_t *sg;
+  const heightmap_t *heightmap;
+  const texture_t *texture;
+  ramped_texture_t *ramped_textures;  /* one per worker, or NULL */
+  float separation_max;
+  point_buffer_t *points;  /* one per worker */
+
+  const size_t *rows;  /* the rows to render */
+  const color_ramp_t *color_ramp;  /* NULL if the rows aren't to be colored */
+  pattern_t pattern_type;
+} dirty_rows_job_t;
+
+
+int render_dirty_row_task(void *arg, size_t index, unsigned worker) {
+  const dirty_rows_job_t *job = arg;
+  size_t row = job->rows[index];
+
+  /* The row still holds the last frame, which mustn't show through. */
+  memset(image_get_row(job->sg, row), 0, image_get_width(job->sg) * image_pixel_size(job->sg->format));
+
+  return generate_row(job->sg, row, row, job->heightmap, job->texture, job->ramped_textures ? &job->ramped_textures[worker] : NULL,
+                      job->separation_max, &job->points[worker], job->color_ramp, job->pattern_type);
+}
+
+
+/* Renders and colors just the given rows of sg, which already holds the rest of the frame. */
+int render_dirty_rows(image_t *sg, const size_t *rows, size_t row_count, const heightmap_t *heightmap, const render_setup_t *setup,
+                      const color_ramp_t *color_ramp, thread_pool_t *pool) {
+  point_buffer_t *points = NULL;
+  int retval = 0;
+
+  unsigned thread_count = thread_pool_get_thread_count(pool);
+  unsigned initialized = 0;
+
+  if ((points = calloc(thread_count, sizeof(*points))) == NULL) goto bad;
+  for (initialized = 0;  initialized < thread_count;  initialized++) {
+    if (point_buffer_init(&points[initialized], 2 * image_get_width(sg)) == -1) goto bad;
   }
 
-  image_close();  /* close the image library */
+  dirty_rows_job_t job = { sg, heightmap, setup->prepared_texture, setup->ramped_textures, setup->separation_max_pixels, points, rows, color_ramp,
+                           setup->pattern_type };
 
-  return 0;
+  if (thread_pool_run(pool, row_count, render_dirty_row_task, &job) == -1) goto bad;
+
+ cleanup:
+  if (points) {
+    for (unsigned i = 0;  i < initialized;  i++) {
+      point_buffer_destroy(&points[i]);
+    }
+    free(points);
+  }
+
+  return retval;
+
+ bad:
+  retval = -1;
+  goto cleanup;
+}
+
+
+/* Renders every frame of an animation, whose heightmap and output filenames are the -i and -o
+   patterns with the frame number filled in.  Consecutive frames usually differ in only a few
+   rows, so each frame starts from the last one and only the rows whose separations changed are
+   rendered again.  That needs the texture to stay the same from frame to frame, so it's set up
+   just once. */
+int render_sequence(const render_options_t *options, thread_pool_t *pool, const texture_sources_t *sources) {
+  render_setup_t setup;
+  int setup_done = 0;
+  const color_ramp_t *color_ramp = NULL;
+  heightmap_t *previous = NULL;
+  heightmap_t *heightmap = NULL;
+  image_t *sg = NULL;
+  size_t *rows = NULL;
+  int retval = 0;
+
+  char filename[PATH_MAX];
+
+  size_t width = 0;
+  size_t height = 0;
+
+  for (unsigned frame = options->first_frame;  frame <= options->last_frame;  frame++) {
+    size_t row_count = 0;
+
+    if (frame_filename(filename, sizeof(filename), options->heightmap_file, frame) == -1) {
+      perror(options->heightmap_file);
+      goto bad;
+    }
+
+    if ((heightmap = heightmap_read(filename)) == NULL) goto bad;
+
+    if (previous == NULL) {
+      width = heightmap_get_width(heightmap);
+      height = heightmap_get_height(heightmap);
+
+      if (render_setup_init(&setup, options, width, height, sources, pool) == -1) goto bad;
+      setup_done = 1;
+      color_ramp = render_setup_color_ramp(&setup, options);
+
+      if ((sg = image_create_with_format(width, height, setup.pixel_format)) == NULL
+          || (rows = malloc(height * sizeof(*rows))) == NULL) {
+        PERROR("frame allocation");
+        goto bad;
+      }
+    } else if (heightmap_get_width(heightmap) != width || heightmap_get_height(heightmap) != height) {
+      fprintf(stderr, "%s is %zux%zu, but the first frame was %zux%zu\n", filename,
+              heightmap_get_width(heightmap), heightmap_get_height(heightmap), width, height);
+      goto bad;
+    }
+
+    if (heightmap_compute_separations(heightmap, setup.separation_min_pixels, setup.separation_max_pixels) == -1) {
+      perror("heightmap_compute_separations()");
+      goto bad;
+    }
+
+    for (size_t row = 0;  row < height;  row++) {
+      if (previous == NULL || !heightmap_separation_rows_equal(heightmap, previous, row)) {
+        rows[row_count++] = row;
+      }
+    }
+
+    if (render_dirty_rows(sg, rows, row_count, heightmap, &setup, color_ramp, pool) == -1) goto bad;
+
+    if (frame_filename(filename, sizeof(filename), options->output_file, frame) == -1) {
+      perror(options->output_file);
+      goto bad;
+    }
+
+    if (image_write(sg, filename) == -1) {
+      perror(filename);
+      goto bad;
+    }
+
+    if (previous) heightmap_destroy(previous);
+    previous = heightmap;
+    heightmap = NULL;
+  }
+
+ cleanup:
+  if (heightmap) heightmap_destroy(heightmap);
+  if (previous) heightmap_destroy(previous);
+  if (sg) image_destroy(sg);
+  free(rows);
+  if (setup_done) render_setup_destroy(&setup);
+
+  return retval;
+
+ bad:
+  retval = -1;
+  goto cleanup;
+}
+
+
+/* One line of a batch manifest. */
+typedef struct {
+  unsigned line;
+  int argc;
+  char **argv;  /* the line's members as command line arguments, owned */
+  render_options_t options;
+  int valid;
+} batch_job_t;
+
+
+typedef struct {
+  batch_job_t *job;
+  size_t capacity;
+  char *error;
+  size_t error_size;
+} manifest_args_t;
+
+
+int add_job_arg(manifest_args_t *args, const char *arg) {
+  batch_job_t *job = args->job;
+
+  /* Leave room for the NULL that ends argv. */
+  if ((size_t) job->argc + 2 > args->capacity) {
+    size_t capacity = args->capacity ? 2 * args->capacity : 16;
+    char **argv;
+
+    if ((argv = realloc(job->argv, capacity * sizeof(*argv))) == NULL) goto bad;
+    job->argv = argv;
+    args->capacity = capacity;
+  }
+
+  if ((job->argv[job->argc] = strdup(arg)) == NULL) goto bad;
+  job->argv[++job->argc] = NULL;
+
+  return 0;
+
+ bad:
+  return option_error(args->error, args->error_size, "%s", strerror(errno));
+}
+
+
+/* A member named after an option becomes that option: "i" gives -i and "max-memory" gives
+   --max-memory.  A string or number is the option's argument, true gives the option alone, and
+   false or null leaves it out. */
+int manifest_member_to_args(void *arg, const char *key, const json_value_t *value) {
+  manifest_args_t *args = arg;
+  char option[64];
+
+  if (value->type == JSON_FALSE || value->type == JSON_NULL) {
+    return 0;
+  }
+
+  if (key[0] == '\0' || strlen(key) + 3 > sizeof(option)) {
+    return option_error(args->error, args->error_size, "Invalid option name \"%s\"", key);
+  }
+  snprintf(option, sizeof(option), "%s%s", key[1] ? "--" : "-", key);
+
+  if (add_job_arg(args, option) == -1) return -1;
+  if (value->text && add_job_arg(args, value->text) == -1) return -1;
+
+  return 0;
+}
+
+
+void batch_job_destroy(batch_job_t *job) {
+  if (job->argv) {
+    for (int i = 0;  i < job->argc;  i++) {
+      free(job->argv[i]);
+    }
+    free(job->argv);
+  }
+}
+
+
+/* Turns a manifest line into a job, starting from the command line's options.  A job that
+   doesn't parse is reported and left invalid, so the rest of the batch can still run. */
+int parse_batch_job(batch_job_t *job, const char *manifest, unsigned line, const char *text, const render_options_t *defaults, options_check_t check) {
+  char error[512];
+  manifest_args_t args = { job, 0, error, sizeof(error) };
+
+  job->line = line;
+  job->argc = 0;
+  job->argv = NULL;
+  job->options = *defaults;
+  job->valid = 0;
+
+  /* getopt_long() skips argv[0]. */
+  if (add_job_arg(&args, "sgcreate") == -1
+      || json_parse_flat_object(text, manifest_member_to_args, &args, error, sizeof(error)) == -1
+      || parse_options(&job->options, NULL, job->argc, job->argv, error, sizeof(error)) == -1
+      || check(&job->options, error, sizeof(error)) == -1) {
+    fprintf(stderr, "%s:%u: %s\n", manifest, line, error);
+    return 0;
+  }
+
+  job->valid = 1;
+
+  return 0;
+}
+
+
+/* Reads every job in the manifest up front, so that a later job's heightmap can be read while an
+   earlier one renders.  Blank lines are skipped. */
+int read_batch_manifest(const char *manifest, const render_options_t *defaults, options_check_t check, batch_job_t **jobs, size_t *job_count) {
+  FILE *file;
+  char *text = NULL;
+  size_t text_size = 0;
+  size_t capacity = 0;
+  unsigned line = 0;
+  int retval = 0;
+
+  *jobs = NULL;
+  *job_count = 0;
+
+  if ((file = fopen(manifest, "r")) == NULL) {
+    perror(manifest);
+    return -1;
+  }
+
+  errno = 0;
+  while (getline(&text, &text_size, file) != -1) {
+    line++;
+
+    if (text[strspn(text, " \t\r\n")] == '\0') continue;
+
+    if (*job_count == capacity) {
+      batch_job_t *grown;
+
+      capacity = capacity ? 2 * capacity : 64;
+      if ((grown = realloc(*jobs, capacity * sizeof(*grown))) == NULL) {
+        PERROR("batch job allocation");
+        goto bad;
+      }
+      *jobs = grown;
+    }
+
+    parse_batch_job(&(*jobs)[*job_count], manifest, line, text, defaults, check);
+    (*job_count)++;
+  }
+
+  if (ferror(file)) {
+    perror(manifest);
+    goto bad;
+  }
+
+ cleanup:
+  free(text);
+  fclose(file);
+
+  return retval;
+
+ bad:
+  retval = -1;
+  goto cleanup;
+}
+
+
+/* A heightmap being read on its own thread while the previous job renders. */
+typedef struct {
+  pthread_t thread;
+  int running;
+  const batch_job_t *job;
+  heightmap_t *heightmap;
+} heightmap_prefetch_t;
+
+
+/* A finished stereogram being written on its own thread while the next job renders. */
+typedef struct {
+  pthread_t thread;
+  int running;
+  const batch_job_t *job;
+  image_t *image;
+  int result;
+} output_write_t;
+
+
+void *prefetch_heightmap_thread(void *arg) {
+  heightmap_prefetch_t *prefetch = arg;
+
+  prefetch->heightmap = heightmap_read(prefetch->job->options.heightmap_file);
+
+  return NULL;
+}
+
+
+void *write_output_thread(void *arg) {
+  output_write_t *write = arg;
+
+  write->result = image_write(write->image, write->job->options.output_file);
+  if (write->result == -1) {
+    perror("image_write()");
+  }
+
+  image_destroy(write->image);
+
+  return NULL;
+}
+
+
+/* Starts reading the job's heightmap.  If no thread can be started, the job's heightmap just
+   gets read when its turn comes. */
+void start_heightmap_prefetch(heightmap_prefetch_t *prefetch, const batch_job_t *job) {
+  prefetch->job = job;
+  prefetch->heightmap = NULL;
+  prefetch->running = pthread_create(&prefetch->thread, NULL, prefetch_heightmap_thread, prefetch) == 0;
+}
+
+
+/* Returns the job's heightmap, from the prefetch if that's where it's being read. */
+heightmap_t *take_heightmap(heightmap_prefetch_t *prefetch, const batch_job_t *job) {
+  if (prefetch->running && prefetch->job == job) {
+    pthread_join(prefetch->thread, NULL);
+    prefetch->running = 0;
+    return prefetch->heightmap;
+  }
+
+  return heightmap_read(job->options.heightmap_file);
+}
+
+
+/* Waits for the write in progress, if any, and reports whether it failed. */
+int finish_output_write(output_write_t *write, const char *manifest) {
+  if (!write->running) return 0;
+
+  pthread_join(write->thread, NULL);
+  write->running = 0;
+
+  if (write->result == -1) {
+    fprintf(stderr, "%s:%u: couldn't write %s\n", manifest, write->job->line, write->job->options.output_file);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/* Hands image off to be written while the next job renders.  Only one write is ever in flight,
+   so at most one finished stereogram waits in memory. */
+int start_output_write(output_write_t *write, const batch_job_t *job, image_t *image, const char *manifest) {
+  write->job = job;
+  write->image = image;
+  write->result = 0;
+
+  if (pthread_create(&write->thread, NULL, write_output_thread, write) == 0) {
+    write->running = 1;
+    return 0;
+  }
+
+  write->running = 0;
+  write_output_thread(write);
+  if (write->result == -1) {
+    fprintf(stderr, "%s:%u: couldn't write %s\n", manifest, job->line, job->options.output_file);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/* Renders every job in the manifest, carrying on past the ones that fail.  Returns how many
+   failed, or -1 if the manifest couldn't be read at all. */
+ssize_t run_batch(const char *manifest, const render_options_t *defaults, thread_pool_t *pool, const texture_bank_t *bank) {
+  batch_job_t *jobs;
+  size_t job_count;
+  lru_cache_t cache;
+  texture_sources_t sources = { &cache, bank };
+  heightmap_prefetch_t prefetch = { .running = 0 };
+  output_write_t write = { .running = 0 };
+  ssize_t failed = 0;
+
+  if (lru_cache_init(&cache, TEXTURE_CACHE_CAPACITY, destroy_cached_image) == -1) return -1;
+
+  if (read_batch_manifest(manifest, defaults, check_render_options, &jobs, &job_count) == -1) {
+    lru_cache_destroy(&cache);
+    return -1;
+  }
+
+  for (size_t i = 0;  i < job_count;  i++) {
+    batch_job_t *job = &jobs[i];
+    heightmap_t *heightmap;
+    image_t *output;
+
+    if (!job->valid) {
+      failed++;
+      continue;
+    }
+
+    if (job->options.sequence) {
+      if (render_sequence(&job->options, pool, &sources) == -1) {
+        fprintf(stderr, "%s:%u: couldn't render %s\n", manifest, job->line, job->options.output_file);
+        failed++;
+      }
+      continue;
+    }
+
+    if ((heightmap = take_heightmap(&prefetch, job)) == NULL) {
+      fprintf(stderr, "%s:%u: couldn't read %s\n", manifest, job->line, job->options.heightmap_file);
+      failed++;
+      continue;
+    }
+
+    /* Read the next job's heightmap while this one renders, unless this one is streaming to
+       stay under a memory limit. */
+    if (!job->options.max_memory) {
+      for (size_t next = i + 1;  next < job_count;  next++) {
+        if (jobs[next].valid) {
+          if (!jobs[next].options.sequence) {
+            start_heightmap_prefetch(&prefetch, &jobs[next]);
+          }
+          break;
+        }
+      }
+    }
+
+    if (render_job(&job->options, heightmap, pool, &sources, &output) == -1) {
+      fprintf(stderr, "%s:%u: couldn't render %s\n", manifest, job->line, job->options.output_file);
+      failed++;
+      continue;
+    }
+
+    if (finish_output_write(&write, manifest) == -1) failed++;
+
+    if (output && start_output_write(&write, job, output, manifest) == -1) failed++;
+  }
+
+  if (finish_output_write(&write, manifest) == -1) failed++;
+
+  /* Every prefetch is taken by the job it was started for, but don't leave a thread behind. */
+  if (prefetch.running) {
+    pthread_join(prefetch.thread, NULL);
+    if (prefetch.heightmap) heightmap_destroy(prefetch.heightmap);
+  }
+
+  lru_cache_destroy(&cache);
+
+  for (size_t i = 0;  i < job_count;  i++) {
+    batch_job_destroy(&jobs[i]);
+  }
+  free(jobs);
+
+  return failed;
+}
+
+
+/* A texture going into a new texture bank.  New textures belong to the build, and the rest are
+   views of the old bank's. */
+typedef struct {
+  char *key;
+  image_t *image;
+  int owned;
+} bank_build_entry_t;
+
+
+typedef struct {
+  bank_build_entry_t *entries;
+  size_t count;
+  size_t capacity;
+} bank_build_t;
+
+
+/* Takes ownership of key, and of image if owned is set, even if this fails. */
+int bank_build_add(bank_build_t *build, char *key, image_t *image, int owned) {
+  if (build->count == build->capacity) {
+    size_t capacity = build->capacity ? 2 * build->capacity : 16;
+    bank_build_entry_t *entries;
+
+    if ((entries = realloc(build->entries, capacity * sizeof(*entries))) == NULL) {
+      PERROR("texture bank build allocation");
+      free(key);
+      if (owned) image_destroy(image);
+      else free(image);
+      return -1;
+    }
+    build->entries = entries;
+    build->capacity = capacity;
+  }
+
+  build->entries[build->count].key = key;
+  build->entries[build->count].image = image;
+  build->entries[build->count].owned = owned;
+  build->count++;
+
+  return 0;
+}
+
+
+void bank_build_destroy(bank_build_t *build) {
+  for (size_t i = 0;  i < build->count;  i++) {
+    free(build->entries[i].key);
+    if (build->entries[i].owned) {
+      image_destroy(build->entries[i].image);
+    } else {
+      free(build->entries[i].image);
+    }
+  }
+  free(build->entries);
+}
+
+
+/* Gets the texture that options would render with ready, and adds it to build unless bank (which
+   may be NULL) has it already. */
+int add_job_texture_to_build(bank_build_t *build, const render_options_t *options, const texture_bank_t *bank, thread_pool_t *pool) {
+  const char *heightmap_file = options->heightmap_file;
+  char filename[PATH_MAX];
+  texture_sources_t sources = { NULL, bank };
+  render_setup_t setup;
+  heightmap_t *heightmap;
+  char *key;
+  int retval = 0;
+
+  if (options->sequence) {
+    /* Every frame uses the first frame's texture. */
+    if (frame_filename(filename, sizeof(filename), heightmap_file, options->first_frame) == -1) {
+      perror(heightmap_file);
+      return -1;
+    }
+    heightmap_file = filename;
+  }
+
+  /* The texture's size follows the heightmap's. */
+  if ((heightmap = heightmap_read(heightmap_file)) == NULL) return -1;
+  retval = render_setup_init(&setup, options, heightmap_get_width(heightmap), heightmap_get_height(heightmap), &sources, pool);
+  heightmap_destroy(heightmap);
+  if (retval == -1) return -1;
+
+  if (!setup.bankable) {
+    fputs("Only textures from a file, or generated with --seed, can go in a texture bank\n", stderr);
+    retval = -1;
+  } else if (!setup.texture_from_bank) {
+    if ((key = strdup(setup.bank_key)) == NULL) {
+      PERROR("texture bank key allocation");
+      retval = -1;
+    } else {
+      retval = bank_build_add(build, key, setup.texture, 1);
+      setup.texture = NULL;
+    }
+  }
+
+  render_setup_destroy(&setup);
+
+  return retval;
+}
+
+
+/* Adds the textures that every job would render with to the texture bank in filename, creating
+   it if need be.  The jobs are the manifest's, or just the command line's if manifest is NULL.
+   Returns how many jobs failed, or -1 if the bank couldn't be written. */
+ssize_t build_texture_bank(const char *filename, const char *manifest, const render_options_t *options, thread_pool_t *pool) {
+  texture_bank_t *existing;
+  bank_build_t build = { NULL, 0, 0 };
+  batch_job_t *jobs = NULL;
+  size_t job_count = 0;
+  size_t new_count;
+  const char **keys = NULL;
+  const image_t **images = NULL;
+  ssize_t failed = 0;
+
+  if ((existing = texture_bank_open(filename)) == NULL && errno != ENOENT) {
+    perror(filename);
+    return -1;
+  }
+
+  if (manifest) {
+    if (read_batch_manifest(manifest, options, check_texture_options, &jobs, &job_count) == -1) goto bad;
+
+    for (size_t i = 0;  i < job_count;  i++) {
+      if (!jobs[i].valid) {
+        failed++;
+      } else if (add_job_texture_to_build(&build, &jobs[i].options, existing, pool) == -1) {
+        fprintf(stderr, "%s:%u: couldn't make the texture\n", manifest, jobs[i].line);
+        failed++;
+      }
+    }
+  } else if (add_job_texture_to_build(&build, options, existing, pool) == -1) {
+    failed++;
+  }
+
+  new_count = build.count;
+  if (new_count == 0) goto cleanup;
+
+  /* The new textures come first, so they win if a key repeats. */
+  for (size_t i = 0;  existing && i < existing->count;  i++) {
+    image_t *view;
+    char *key;
+
+    if ((view = malloc(sizeof(*view))) == NULL) {
+      PERROR("texture bank build allocation");
+      goto bad;
+    }
+    if ((key = strdup(texture_bank_get_entry(existing, i, view))) == NULL) {
+      PERROR("texture bank key allocation");
+      free(view);
+      goto bad;
+    }
+    if (bank_build_add(&build, key, view, 0) == -1) goto bad;
+  }
+
+  if ((keys = malloc(build.count * sizeof(*keys))) == NULL || (images = malloc(build.count * sizeof(*images))) == NULL) {
+    PERROR("texture bank build allocation");
+    goto bad;
+  }
+  for (size_t i = 0;  i < build.count;  i++) {
+    keys[i] = build.entries[i].key;
+    images[i] = build.entries[i].image;
+  }
+
+  if (texture_bank_write(filename, build.count, keys, images) == -1) goto bad;
+
+  fprintf(stderr, "Added %zu texture%s to %s\n", new_count, new_count == 1 ? "" : "s", filename);
+
+ cleanup:
+  free(keys);
+  free(images);
+  bank_build_destroy(&build);
+
+  for (size_t i = 0;  i < job_count;  i++) {
+    batch_job_destroy(&jobs[i]);
+  }
+  free(jobs);
+
+  /* Only now, since the build may have been looking at its textures. */
+  if (existing) texture_bank_close(existing);
+
+  return failed;
+
+ bad:
+  failed = -1;
+  goto cleanup;
+}
+
+
+/* The daemon's caches, which live as long as it does. */
+typedef struct {
+  lru_cache_t heightmaps;  /* by file identity, with their samples kept */
+  lru_cache_t textures;  /* generated textures, as in batch mode */
+  lru_cache_t stereograms;  /* uncolored, by everything that goes into them but the color ramp */
+
+  texture_sources_t texture_sources;  /* the texture cache, and the bank if there is one */
+} serve_caches_t;
+
+
+/* A request is a job plus, optionally, the heightmap file's contents sent after it. */
+typedef struct {
+  manifest_args_t args;  /* must come first */
+  int has_heightmap_bytes;
+  size_t heightmap_bytes;
+} serve_request_t;
+
+
+static volatile sig_atomic_t serve_stopping = 0;
+
+
+void stop_serving(int signum) {
+  (void) signum;
+  serve_stopping = 1;
+}
+
+
+void destroy_cached_heightmap(void *heightmap) {
+  heightmap_destroy(heightmap);
+}
+
+
+int request_member_to_args(void *arg, const char *key, const json_value_t *value) {
+  serve_request_t *request = arg;
+
+  if (strcmp(key, "heightmap-bytes") == 0) {
+    if (value->type != JSON_NUMBER || ascii_to_size_t(value->text, &request->heightmap_bytes) == -1) {
+      return option_error(request->args.error, request->args.error_size, "heightmap-bytes must be a byte count");
+    }
+    request->has_heightmap_bytes = 1;
+    return 0;
+  }
+
+  return manifest_member_to_args(&request->args, key, value);
+}
+
+
+/* Copies count bytes from in to a new temporary file, whose name is left in filename. */
+int receive_heightmap(FILE *in, size_t count, char *filename, size_t filename_size) {
+  const char *directory = getenv("TMPDIR");
+  char buffer[65536];
+  FILE *file;
+  int fd;
+  int retval = 0;
+
+  snprintf(filename, filename_size, "%s/sgcreate-XXXXXX", directory ? directory : "/tmp");
+
+  if ((fd = mkstemp(filename)) == -1) {
+    perror(filename);
+    filename[0] = '\0';
+    return -1;
+  }
+
+  if ((file = fdopen(fd, "w")) == NULL) {
+    perror(filename);
+    close(fd);
+    return -1;
+  }
+
+  while (count > 0) {
+    size_t chunk = count < sizeof(buffer) ? count : sizeof(buffer);
+
+    if (fread(buffer, 1, chunk, in) != chunk) {
+      fputs("The client sent fewer heightmap bytes than it said it would\n", stderr);
+      goto bad;
+    }
+    if (fwrite(buffer, 1, chunk, file) != chunk) {
+      perror(filename);
+      goto bad;
+    }
+    count -= chunk;
+  }
+
+ cleanup:
+  if (fclose(file) == EOF) retval = -1;
+
+  return retval;
+
+ bad:
+  retval = -1;
+  goto cleanup;
+}
+
+
+/* Renders and writes one request's stereogram, using and filling the caches.  A request that
+   differs from an earlier one only in its color ramp just recolors the earlier stereogram.  The
+   heightmap is only cached if it came from a file that can be told apart from later versions of
+   itself. */
+int serve_render(serve_caches_t *caches, const render_options_t *options, int heightmap_cacheable, thread_pool_t *pool) {
+  char heightmap_key[PATH_MAX + 128];
+  char texture_key[PATH_MAX + 128] = "";
+  char stereogram_key[2 * sizeof(heightmap_key) + 256];
+  heightmap_t *heightmap = NULL;
+  int heightmap_owned = 0;
+  int stereogram_cacheable;
+  image_t *uncolored;
+  image_t *output = NULL;
+  render_setup_t setup;
+  pattern_t pattern_type;
+  color_ramp_t color_ramp;
+  int retval = 0;
+
+  if (options->sequence) {
+    return render_sequence(options, pool, &caches->texture_sources);
+  }
+
+  if (options->max_memory) {
+    /* Streaming is for stereograms too big to keep around anyway. */
+    if ((heightmap = heightmap_read(options->heightmap_file)) == NULL) return -1;
+    return render_job(options, heightmap, pool, &caches->texture_sources, &output);
+  }
+
+  heightmap_cacheable = heightmap_cacheable && file_cache_key(options->heightmap_file, heightmap_key, sizeof(heightmap_key)) == 0;
+
+  if (heightmap_cacheable) {
+    heightmap = lru_cache_get(&caches->heightmaps, heightmap_key);
+  }
+  if (heightmap == NULL) {
+    if ((heightmap = heightmap_read(options->heightmap_file)) == NULL) return -1;
+
+    heightmap_owned = !heightmap_cacheable || lru_cache_put(&caches->heightmaps, heightmap_key, heightmap) == -1;
+  }
+
+  size_t width = heightmap_get_width(heightmap);
+  size_t height = heightmap_get_height(heightmap);
+
+  /* Noise, and a generated texture, are different every time without a seed.  A texture with the
+     ramp on it colors the stereogram too, which the key doesn't cover. */
+  stereogram_cacheable = heightmap_cacheable && (!options->add_noise || options->seeded) && !options->ramp_on_texture
+                         && (options->texture_file ? file_cache_key(options->texture_file, texture_key, sizeof(texture_key)) == 0 : options->seeded);
+
+  if (stereogram_cacheable) {
+    int length = snprintf(stereogram_key, sizeof(stereogram_key), "%s\n%s\n%a %a %a %d %d %u %d %d %d %d %" PRIu64,
+                          heightmap_key, texture_key, length_meters(options->separation_max), length_meters(options->separation_min),
+                          length_meters(options->display_width), options->preserve_height, (int) options->pixel_format.type,
+                          options->pixel_format.channels, (int) options->pattern_type, (int) options->noise_kernel, options->add_noise, options->seeded, options->seed);
+
+    stereogram_cacheable = length >= 0 && (size_t) length < sizeof(stereogram_key);
+  }
+
+  if (stereogram_cacheable && (uncolored = lru_cache_get(&caches->stereograms, stereogram_key)) != NULL) {
+    if (choose_pattern_and_color_ramp(options, job_seed(options), &pattern_type, &color_ramp) == -1) goto bad;
+    if ((output = image_copy(uncolored)) == NULL) goto bad;
+  } else {
+    if (render_setup_init(&setup, options, width, height, &caches->texture_sources, pool) == -1) goto bad;
+
+    pattern_type = setup.pattern_type;
+    color_ramp = setup.color_ramp;
+
+    /* Computing the separations as rows keeps the samples, which later requests may need with
+       other separations. */
+    if (heightmap_compute_separation_rows(heightmap, setup.separation_min_pixels, setup.separation_max_pixels, 0, height) == -1) {
+      perror("heightmap_compute_separation_rows()");
+      render_setup_destroy(&setup);
+      goto bad;
+    }
+
+    /* A stereogram for the cache is kept uncolored, since the color ramp isn't part of its key.
+       Otherwise it's colored as it's rendered. */
+    output = create_stereogram(heightmap, setup.prepared_texture, setup.ramped_textures, setup.separation_max_pixels, pool, setup.pixel_format,
+                               stereogram_cacheable ? NULL : render_setup_color_ramp(&setup, options), pattern_type);
+    render_setup_destroy(&setup);
+    if (output == NULL) goto bad;
+
+    if (stereogram_cacheable && (uncolored = image_copy(output)) != NULL
+        && lru_cache_put(&caches->stereograms, stereogram_key, uncolored) == -1) {
+      image_destroy(uncolored);
+    }
+  }
+
+  if (stereogram_cacheable && options->texture_file == NULL) {
+    apply_color_ramp_for_pattern_type(output, 0, height, &color_ramp, pattern_type);
+  }
+
+  if (image_write(output, options->output_file) == -1) {
+    perror("image_write()");
+    goto bad;
+  }
+
+ cleanup:
+  if (output) image_destroy(output);
+  if (heightmap_owned) heightmap_destroy(heightmap);
+
+  return retval;
+
+ bad:
+  retval = -1;
+  goto cleanup;
+}
+
+
+int send_response(FILE *out, const char *error) {
+  if (error) {
+    fputs("{\"ok\": false, \"error\": ", out);
+    json_write_string(out, error);
+    fputs("}\n", out);
+  } else {
+    fputs("{\"ok\": true}\n", out);
+  }
+
+  return fflush(out) == EOF || ferror(out) ? -1 : 0;
+}
+
+
+/* Handles one request line, and the heightmap bytes after it if there are any.  Returns -1 if
+   the connection can't go on, because we've lost track of where the next request starts or the
+   client has gone away. */
+int serve_request(serve_caches_t *caches, const render_options_t *defaults, thread_pool_t *pool, const char *text, FILE *in, FILE *out) {
+  char error[512];
+  char temp_file[PATH_MAX] = "";
+  batch_job_t job = { 0, 0, NULL, *defaults, 0 };
+  serve_request_t request = { { &job, 0, error, sizeof(error) }, 0, 0 };
+  int in_sync = 1;
+  int retval;
+
+  if (add_job_arg(&request.args, "sgcreate") == -1
+      || json_parse_flat_object(text, request_member_to_args, &request, error, sizeof(error)) == -1) {
+    /* If it said heightmap bytes were coming, we can't tell how many. */
+    in_sync = 0;
+    goto bad;
+  }
+
+  if (request.has_heightmap_bytes && receive_heightmap(in, request.heightmap_bytes, temp_file, sizeof(temp_file)) == -1) {
+    in_sync = 0;
+    snprintf(error, sizeof(error), "couldn't receive the heightmap");
+    goto bad;
+  }
+
+  if (parse_options(&job.options, NULL, job.argc, job.argv, error, sizeof(error)) == -1) goto bad;
+
+  if (request.has_heightmap_bytes) {
+    if (job.options.heightmap_file || job.options.sequence) {
+      snprintf(error, sizeof(error), "heightmap-bytes replaces -i, and can't be used with --frames");
+      goto bad;
+    }
+    job.options.heightmap_file = temp_file;
+  }
+
+  if (check_render_options(&job.options, error, sizeof(error)) == -1) goto bad;
+
+  if (serve_render(caches, &job.options, !request.has_heightmap_bytes, pool) == -1) {
+    snprintf(error, sizeof(error), "couldn't render %s", job.options.output_file);
+    goto bad;
+  }
+
+  retval = send_response(out, NULL);
+
+ cleanup:
+  if (temp_file[0]) unlink(temp_file);
+  batch_job_destroy(&job);
+
+  return in_sync ? retval : -1;
+
+ bad:
+  fprintf(stderr, "Request failed: %s\n", error);
+  retval = send_response(out, error);
+  goto cleanup;
+}
+
+
+void serve_connection(serve_caches_t *caches, const render_options_t *defaults, thread_pool_t *pool, int connection) {
+  struct timeval timeout = { SERVE_RECEIVE_TIMEOUT_SECONDS, 0 };
+  FILE *in = NULL;
+  FILE *out = NULL;
+  char *text = NULL;
+  size_t text_size = 0;
+  int out_fd;
+
+  /* A client that goes quiet mustn't hold up everyone else for long. */
+  setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  if ((in = fdopen(connection, "r")) == NULL) {
+    perror("fdopen()");
+    close(connection);
+    return;
+  }
+
+  if ((out_fd = dup(connection)) == -1 || (out = fdopen(out_fd, "w")) == NULL) {
+    perror("fdopen()");
+    if (out_fd != -1) close(out_fd);
+    fclose(in);
+    return;
+  }
+
+  while (!serve_stopping && getline(&text, &text_size, in) != -1) {
+    if (text[strspn(text, " \t\r\n")] == '\0') continue;
+
+    if (serve_request(caches, defaults, pool, text, in, out) == -1) break;
+  }
+
+  free(text);
+  fclose(out);
+  fclose(in);
+}
+
+
+/* Listens on a Unix socket for render requests until SIGINT or SIGTERM, keeping caches of
+   heightmaps, textures and stereograms from one request to the next.  Connections are served one
+   at a time; each request is rendered with the whole thread pool.  SIGINT and SIGTERM must be
+   blocked when this is called, so that they come to this thread rather than a worker. */
+int serve(const char *socket_path, const render_options_t *defaults, thread_pool_t *pool, const texture_bank_t *bank) {
+  struct sockaddr_un address;
+  struct sigaction action;
+  struct stat st;
+  serve_caches_t caches;
+  int caches_initialized = 0;
+  int listener = -1;
+  int bound = 0;
+  sigset_t wait_signals;
+  int retval = 0;
+
+  if (strlen(socket_path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Socket path %s is too long\n", socket_path);
+    return -1;
+  }
+
+  caches.texture_sources.cache = &caches.textures;
+  caches.texture_sources.bank = bank;
+
+  if (lru_cache_init(&caches.heightmaps, SERVE_HEIGHTMAP_CACHE_CAPACITY, destroy_cached_heightmap) == -1) goto bad;
+  caches_initialized++;
+  if (lru_cache_init(&caches.textures, TEXTURE_CACHE_CAPACITY, destroy_cached_image) == -1) goto bad;
+  caches_initialized++;
+  if (lru_cache_init(&caches.stereograms, SERVE_STEREOGRAM_CACHE_CAPACITY, destroy_cached_image) == -1) goto bad;
+  caches_initialized++;
+
+  /* No SA_RESTART, so that pselect() gives up when we're told to stop. */
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = stop_serving;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  /* A client that hangs up before its response shouldn't take the daemon down with it. */
+  signal(SIGPIPE, SIG_IGN);
+
+  if ((listener = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+    perror("socket()");
+    goto bad;
+  }
+
+  /* Clear away a socket left over from an earlier daemon, but nothing else. */
+  if (lstat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+    unlink(socket_path);
+  }
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, socket_path);
+
+  if (bind(listener, (struct sockaddr *) &address, sizeof(address)) == -1) {
+    perror(socket_path);
+    goto bad;
+  }
+  bound = 1;
+
+  if (listen(listener, SOMAXCONN) == -1) {
+    perror("listen()");
+    goto bad;
+  }
+
+  /* A client can give up between pselect() saying it's there and accept(), which mustn't then
+     block. */
+  if (fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK) == -1) {
+    perror("fcntl()");
+    goto bad;
+  }
+
+  /* The stop signals stay blocked, as main() left them, except while pselect() waits.  It
+     unblocks them atomically, so one that arrives just after serve_stopping is checked still
+     ends the wait. */
+  pthread_sigmask(SIG_SETMASK, NULL, &wait_signals);
+  sigdelset(&wait_signals, SIGINT);
+  sigdelset(&wait_signals, SIGTERM);
+
+  while (!serve_stopping) {
+    fd_set ready;
+    int connection;
+
+    FD_ZERO(&ready);
+    FD_SET(listener, &ready);
+
+    if (pselect(listener + 1, &ready, NULL, NULL, NULL, &wait_signals) == -1) {
+      if (errno == EINTR) continue;
+      perror("pselect()");
+      goto bad;
+    }
+
+    if ((connection = accept(listener, NULL, NULL)) == -1) {
+      if (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN || errno == EWOULDBLOCK) continue;
+      /* Anything else, such as running out of file descriptors, would only fail again. */
+      perror("accept()");
+      goto bad;
+    }
+
+    /* Some systems hand the listener's O_NONBLOCK on to the connection. */
+    fcntl(connection, F_SETFL, fcntl(connection, F_GETFL) & ~O_NONBLOCK);
+
+    serve_connection(&caches, defaults, pool, connection);
+  }
+
+ cleanup:
+  if (listener != -1) close(listener);
+  if (bound) unlink(socket_path);
+
+  if (caches_initialized > 2) lru_cache_destroy(&caches.stereograms);
+  if (caches_initialized > 1) lru_cache_destroy(&caches.textures);
+  if (caches_initialized > 0) lru_cache_destroy(&caches.heightmaps);
+
+  return retval;
+
+ bad:
+  retval = -1;
+  goto cleanup;
+}
+
+
+void print_usage_and_fail(const char *usage, const char *fmt, ...) {
+  va_list ap;
+
+  fputs(usage, stderr);
+  fputc('\n', stderr);
+
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+
+  fputs("\n\n", stderr);
+
+  exit(1);
+}
+
+
+int main(int argc, char **argv) {
+  render_options_t options;
+  process_options_t process = { 1, NULL, NULL, NULL, NULL, 0 };
+  heightmap_t *heightmap;
+  image_t *output;
+  thread_pool_t *pool;
+  texture_bank_t *bank = NULL;
+  texture_sources_t sources = { NULL, NULL };
+  int status = 0;
+
+  char error[512];
+
+  char *usagefmt = "\nUsage: %s [options] -i <depthmap_image> -o <output_image>\n"
+                   "       %s [options] --batch <manifest>\n"
+                   "\n"
+                   "Depthmap is an image that is one of two types:\n"
+                   " * Grayscale.  Brighter pixels represent shallower depth.\n"
+                   " * Rainbow.  Redder hues represent shallower depth.  This gives more depth\n"
+                   "   resolution than grayscale.  Gray pixels in a rainbow depthmap, black and\n"
+                   "   white included, are placed at the farthest depth.\n"
+                   "Binary PGM, PPM and PFM depthmaps, and raw float32 depth files (see\n"
+                   "image_reader.h), are read directly.  Anything else goes through ImageMagick.\n"
+                   "\n"
+		   "For the -f, -n, and -w options (see below), the value is specified as a length with\n"
+		   "units.  Accepted units are meters, centimeters, millimeters, and inches.\n"
+		   "These can be abbreviated as m, cm, mm, and in, respectively.\n"
+		   "\n"
+                   "Options:\n"
+                   "\n"
+                   "  -f  maximum separation.  Default %s\n"
+                   "  -n  minimum separation.  Default %s\n"
+		   "  -w  physical width of target display device.  Set this if you're rendering for\n"
+		   "      a very large display such as a poster, or a very small one like a phone.\n"
+		   "      Default is %s, which is suitable for a typical laptop screen.\n"
+                   "  -t  optional texture image file to use.  If this option is not provided,\n"
+                   "      then a random texture will be generated.\n"
+                   "  -p  preserve the height of the texture.  Use this option if, for example,\n"
+                   "      your texture image is exactly the height of the stereogram and you want\n"
+                   "      to keep it that way in the final image.\n"
+                   "  -N  add noise to the texture image.\n"
+                   "  -P  type of texture pattern to generate when the -t option is omitted.\n"
+                   "      Valid values are 'perlin', 'polygons', 'ellipses', and 'dots'.  If omitted,\n"
+		   "      then a random pattern type will be selected for you.\n"
+		   "  -c  color ramp for the generated texture when the -t option is omitted.\n"
+		   "      Format is one of:\n"
+		   "      * <y>:<color>[,...]\n"
+		   "      * <color>\n"
+		   "      The first format specifies a color ramp.  The second specifies a single\n"
+		   "      color for the entire image.\n"
+		   "      <y> is a normalized floating point value between 0 and 1, where 0 is the\n"
+		   "      bottom of the image and 1 is the top.\n"
+		   "      Colors can be specified in several different ways:\n"
+		   "      * \"blue\"\n"
+		   "      * \"#0000ff\"\n"
+		   "      * \"rgb(0,0,255)\"\n"
+		   "      * \"cmyk(100,100,100,10)\"\n"
+		   "      For example, to make a color ramp from green at the bottom, white in the\n"
+		   "      middle, and blue at the top, you could put this:\n"
+		   "        0:green,0.5:white,1:blue\n"
+		   "      If empty or omitted, then a single random color will be used.\n"
+		   "  -j  number of threads to render with.  0 means one thread per CPU.\n"
+		   "      Default 1.\n"
+		   "  --max-memory <size>\n"
+		   "      render the stereogram a band of rows at a time, writing each band to the\n"
+		   "      output file as soon as it's done, so as to use no more than about this\n"
+		   "      much memory.  The size is in bytes, optionally followed by K, M, or G.\n"
+		   "      The output file must be a .ppm, .pam, .pfm or .qoi image.  Use this for\n"
+		   "      very large renders, such as posters.\n"
+		   "  --pixel-format <format>\n"
+		   "      how to store the texture and the stereogram while rendering.  One of\n"
+		   "      rgb8, rgba8, rgb16, rgba16, rgbh, rgbah (half float), rgbf, and rgbaf.\n"
+		   "      Narrower formats use less memory, at some cost in precision.  Default\n"
+		   "      rgbaf.\n"
+		   "  --seed <n>\n"
+		   "      seed for the random color, pattern type and generated texture, so that\n"
+		   "      the same options give the same stereogram every time.\n"
+		   "  --noise-kernel <kernel>\n"
+		   "      noise for the perlin pattern.  'perlin3d' wraps 3D Perlin noise around a\n"
+		   "      circle so that the texture tiles.  'simplex' does the same with simplex\n"
+		   "      noise, which is quicker.  'periodic' uses 2D noise that repeats every\n"
+		   "      texture width, which is quicker still.  Default perlin3d.\n"
+		   "  --ramp-on-texture\n"
+		   "      apply the -c color ramp to the generated texture instead of to the\n"
+		   "      stereogram, which is quicker since the texture is far narrower.  Can't be\n"
+		   "      used with -t.\n"
+		   "  --frames <first>-<last>\n"
+		   "      render an animation, one stereogram per frame.  -i and -o are then\n"
+		   "      filename patterns with a %%d (or %%04d, and so on) where the frame number\n"
+		   "      goes.  Only the rows whose depth changed since the last frame are\n"
+		   "      rendered again, and every frame uses the same texture.\n"
+		   "  --batch <manifest>\n"
+		   "      render every job in a manifest in this one process.  Each line of the\n"
+		   "      manifest is a JSON object whose members are options for one stereogram,\n"
+		   "      named as above without the dashes, for example:\n"
+		   "        {\"i\": \"cube.pgm\", \"o\": \"cube.png\", \"P\": \"dots\", \"seed\": 7}\n"
+		   "      true stands for an option that takes no value.  Options given on the\n"
+		   "      command line apply to every job unless the job overrides them.  Jobs\n"
+		   "      that fail are reported and skipped.  Generated textures with a seed are\n"
+		   "      reused by later jobs that would generate the same texture.\n"
+		   "  --serve <socket>\n"
+		   "      run as a daemon, taking render requests on a Unix socket until SIGINT or\n"
+		   "      SIGTERM.  Each request is a line in the same form as a --batch manifest\n"
+		   "      line, and gets a line back: {\"ok\": true}, or {\"ok\": false, \"error\": ...}.\n"
+		   "      Instead of \"i\", a request can give \"heightmap-bytes\": <n> and send the\n"
+		   "      heightmap file's n bytes right after its line.  Heightmaps, seeded\n"
+		   "      textures and stereograms are cached between requests, so a request that\n"
+		   "      only changes -c just recolors an earlier stereogram.\n"
+		   "  --texture-bank <file>\n"
+		   "      take finished textures from a texture bank built with\n"
+		   "      --build-texture-bank, rather than loading or generating them.  Textures\n"
+		   "      the bank doesn't have are made as usual.\n"
+		   "  --build-texture-bank <file>\n"
+		   "      instead of rendering, add the textures that these options (or every job\n"
+		   "      of a --batch manifest) would render with to a texture bank, creating it\n"
+		   "      if need be.  -o isn't needed, since nothing is rendered.  Only textures\n"
+		   "      from -t, or generated with --seed, can be banked.  Any number of\n"
+		   "      processes can share a bank.\n"
+                   "  -h  print this usage text and exit.\n";
+
+  char usage[8192];
+
+  char separation_max_default_str[50];
+  length_fmt_millimeters(length_from_millimeters(SEPARATION_MAX_DEFAULT_MILLIS), separation_max_default_str, sizeof(separation_max_default_str));
+  char separation_min_default_str[50];
+  length_fmt_millimeters(length_from_millimeters(SEPARATION_MIN_DEFAULT_MILLIS), separation_min_default_str, sizeof(separation_min_default_str));
+  char display_width_default_str[50];
+  length_fmt_centimeters(length_from_inches(DISPLAY_WIDTH_DEFAULT_INCHES), display_width_default_str, sizeof(display_width_default_str));
+  snprintf(usage, sizeof(usage), usagefmt, argv[0], argv[0], separation_max_default_str, separation_min_default_str, display_width_default_str);
+  usage[sizeof(usage)-1] = '\0';  /* just in case */
+
+  render_options_init(&options);
+
+  if (parse_options(&options, &process, argc, argv, error, sizeof(error)) == -1) {
+    print_usage_and_fail(usage, "%s", error);
+  }
+
+  if (process.help) {
+    fputs(usage, stdout);
+    fputc('\n', stdout);
+    return 0;
+  }
+
+  if (process.batch_file && process.serve_socket) {
+    print_usage_and_fail(usage, "--batch and --serve can't be combined");
+  }
+  if (process.build_texture_bank && process.serve_socket) {
+    print_usage_and_fail(usage, "--build-texture-bank and --serve can't be combined");
+  }
+
+  /* In batch and serve modes, the command line only supplies defaults, and each job is checked
+     on its own.  A texture bank build renders nothing, so it only needs what makes a texture. */
+  if (process.batch_file == NULL && process.serve_socket == NULL
+      && (process.build_texture_bank ? check_texture_options : check_render_options)(&options, error, sizeof(error)) == -1) {
+    print_usage_and_fail(usage, "%s", error);
+  }
+
+  if (process.serve_socket) {
+    /* The workers inherit this, which leaves the stop signals to the thread that serves. */
+    sigset_t stop_signals;
+
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+  }
+
+  if (process.texture_bank) {
+    if ((bank = texture_bank_open(process.texture_bank)) == NULL) {
+      perror(process.texture_bank);
+      return 1;
+    }
+    sources.bank = bank;
+  }
+
+  if ((pool = thread_pool_create((unsigned) process.thread_count)) == NULL) {
+    if (bank) texture_bank_close(bank);
+    return 1;
+  }
+
+  if (process.build_texture_bank) {
+    ssize_t failed = build_texture_bank(process.build_texture_bank, process.batch_file, &options, pool);
+
+    if (failed > 0) {
+      fprintf(stderr, "%zd job%s failed\n", failed, failed == 1 ? "" : "s");
+    }
+    status = failed == 0 ? 0 : 1;
+  } else if (process.serve_socket) {
+    if (serve(process.serve_socket, &options, pool, bank) == -1) {
+      status = 1;
+    }
+  } else if (process.batch_file) {
+    ssize_t failed = run_batch(process.batch_file, &options, pool, bank);
+
+    if (failed > 0) {
+      fprintf(stderr, "%zd job%s failed\n", failed, failed == 1 ? "" : "s");
+    }
+    status = failed == 0 ? 0 : 1;
+  } else if (options.sequence) {
+    if (render_sequence(&options, pool, &sources) == -1) {
+      status = 1;
+    }
+  } else {
+    if ((heightmap = heightmap_read(options.heightmap_file)) == NULL) {
+      status = 1;
+    } else if (render_job(&options, heightmap, pool, &sources, &output) == -1) {
+      status = 1;
+    } else if (output) {
+      if (image_write(output, options.output_file) == -1) {
+        status = 1;
+      }
+      image_destroy(output);
+    }
+  }
+
+  thread_pool_destroy(pool);
+
+  if (bank) texture_bank_close(bank);
+
+  image_close();  /* close the image library */
+
+  return status;
 }
@@ -0,0 +1,53 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <string.h>
+
+/* Short vectors built on GCC's vector extensions.  The compiler lowers them to SSE, AVX or NEON
+   instructions where the target has them and to plain scalar code where it doesn't, so kernels
+   written with them need no separate fallback. */
+
+typedef float v2sf __attribute__((vector_size(2 * sizeof(float))));
+typedef float v4sf __attribute__((vector_size(4 * sizeof(float))));
+typedef double v2df __attribute__((vector_size(2 * sizeof(double))));
+typedef int v4si __attribute__((vector_size(4 * sizeof(int))));
+typedef unsigned v4su __attribute__((vector_size(4 * sizeof(unsigned))));
+
+/* Unaligned loads and stores.  The memcpy() calls compile down to single vector moves. */
+
+static inline v4sf v4sf_load(const float *p) {
+  v4sf v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline void v4sf_store(float *p, v4sf v) {
+  memcpy(p, &v, sizeof(v));
+}
+
+static inline v4sf v4sf_splat(float f) {
+  v4sf v = { f, f, f, f };
+  return v;
+}
+
+/* Comparisons give all-ones lanes where they hold, so these pick lanes with masks: select takes a
+   where the mask is set and b elsewhere.  min and max return b in lanes where a is NaN. */
+
+static inline v4sf v4sf_select(v4si mask, v4sf a, v4sf b) {
+  return (v4sf) ((mask & (v4si) a) | (~mask & (v4si) b));
+}
+
+static inline v4sf v4sf_min(v4sf a, v4sf b) {
+  return v4sf_select(a < b, a, b);
+}
+
+static inline v4sf v4sf_max(v4sf a, v4sf b) {
+  return v4sf_select(a > b, a, b);
+}
+
+static inline v2df v2df_splat(double d) {
+  v2df v = { d, d };
+  return v;
+}
+
+#endif
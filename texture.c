@@ -0,0 +1,266 @@
+
+#include "texture.h"
+
+#include "util.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+
+/* Takes one edge echo step away from used, in the given direction, stepping over home. */
+static size_t echo_step(const texture_t *texture, size_t home, size_t used, int direction) {
+  ssize_t height = (ssize_t) image_get_height(texture->image);
+  ssize_t offset = texture->edge_echo_offset % height;
+  ssize_t next = (ssize_t) used;
+
+  if (offset == 0) {
+    /* Every step would land right back on home, so there's nowhere else to go. */
+    return home;
+  }
+
+  do {
+    if (direction > 0) {
+      next = (next + offset) % height;
+    } else {
+      next = (next - offset + height) % height;
+    }
+  } while (next == (ssize_t) home);
+
+  return (size_t) next;
+}
+
+
+/* Sample values as they go into the prefix sums: 8- and 16-bit samples stay integers. */
+#define SAMPLE_U8(samples, i) ((samples)[i])
+#define SAMPLE_U16(samples, i) ((samples)[i])
+#define SAMPLE_HALF(samples, i) (image_half_to_float((samples)[i]))
+#define SAMPLE_FLOAT(samples, i) ((samples)[i])
+
+/* Each format gets its own kernels, with the sample type, the sum type and the channel count
+   fixed at compile time.  Integer sums are kept modulo their type's range, which still gives the
+   exact sum of any run of at most max_run pixels, so longer runs are taken in pieces.  scale takes
+   a sample value to 0..1.  A format without alpha has no alpha sums, since its alpha is always 1. */
+#define TEXTURE_KERNELS(name, sample_t, sum_t, channels, sample, scale, max_run)         \
+  static void build_row_##name(texture_t *texture, size_t row) {                          \
+    size_t width = image_get_width(texture->image);                                       \
+    const sample_t *samples = image_get_row(texture->image, row);                         \
+    sum_t *sums = (sum_t *) texture->prefix_sums + (channels) * row * (width + 1);        \
+    for (int c = 0;  c < (channels);  c++) {                                              \
+      sums[c] = 0;                                                                        \
+    }                                                                                     \
+    for (size_t i = 0;  i < (channels) * width;  i++) {                                   \
+      sums[i + (channels)] = (sum_t) (sums[i] + sample(samples, i));                      \
+    }                                                                                     \
+  }                                                                                       \
+  static void integrate_##name(const texture_t *texture, size_t row, float left, float right, float sum[4]) { \
+    size_t width = texture_get_width(texture);                                            \
+    const sample_t *samples = image_get_row(texture->image, row);                         \
+    const sum_t *sums = (const sum_t *) texture->prefix_sums + (channels) * row * (width + 1); \
+    size_t first = (size_t) floorf(left);                                                 \
+    size_t last = (size_t) floorf(right);                                                 \
+    if (right - floorf(left) <= 1.0f) {                                                   \
+      /* The range falls inside a single pixel. */                                        \
+      for (int c = 0;  c < (channels);  c++) {                                            \
+        sum[c] = sample(samples, (channels) * first + c) * (scale) * (right - left);      \
+      }                                                                                   \
+      if ((channels) == 3) {                                                              \
+        sum[3] = right - left;                                                            \
+      }                                                                                   \
+      return;                                                                             \
+    }                                                                                     \
+    /* The whole pixels come from the prefix sums, and the partly covered ones at either  \
+       end are weighted by how much of them is covered.  A range that ends exactly on a   \
+       pixel boundary covers none of the pixel that starts there, which may be past the   \
+       end of the row. */                                                                 \
+    float first_fraction = (float) (first + 1) - left;                                    \
+    float last_fraction = right - (float) last;                                           \
+    for (int c = 0;  c < (channels);  c++) {                                              \
+      float whole = 0.0f;                                                                 \
+      for (size_t a = first + 1, b;  a < last;  a = b) {                                  \
+        b = last - a > (max_run) ? a + (max_run) : last;                                  \
+        whole += (sum_t) (sums[(channels) * b + c] - sums[(channels) * a + c]);           \
+      }                                                                                   \
+      sum[c] = whole * (scale) + first_fraction * (sample(samples, (channels) * first + c) * (scale)); \
+      if (last < width) {                                                                 \
+        sum[c] += last_fraction * (sample(samples, (channels) * last + c) * (scale));     \
+      }                                                                                   \
+    }                                                                                     \
+    if ((channels) == 3) {                                                                \
+      sum[3] = (float) (last - first - 1) + first_fraction;                               \
+      if (last < width) {                                                                 \
+        sum[3] += last_fraction;                                                          \
+      }                                                                                   \
+    }                                                                                     \
+  }
+
+TEXTURE_KERNELS(rgb8, uint8_t, uint16_t, 3, SAMPLE_U8, 1.0f / 255.0f, UINT16_MAX / UINT8_MAX)
+TEXTURE_KERNELS(rgba8, uint8_t, uint16_t, 4, SAMPLE_U8, 1.0f / 255.0f, UINT16_MAX / UINT8_MAX)
+TEXTURE_KERNELS(rgb16, uint16_t, uint32_t, 3, SAMPLE_U16, 1.0f / 65535.0f, UINT32_MAX / UINT16_MAX)
+TEXTURE_KERNELS(rgba16, uint16_t, uint32_t, 4, SAMPLE_U16, 1.0f / 65535.0f, UINT32_MAX / UINT16_MAX)
+TEXTURE_KERNELS(rgbh, uint16_t, float, 3, SAMPLE_HALF, 1.0f, SIZE_MAX)
+TEXTURE_KERNELS(rgbah, uint16_t, float, 4, SAMPLE_HALF, 1.0f, SIZE_MAX)
+TEXTURE_KERNELS(rgbf, float, float, 3, SAMPLE_FLOAT, 1.0f, SIZE_MAX)
+TEXTURE_KERNELS(rgbaf, float, float, 4, SAMPLE_FLOAT, 1.0f, SIZE_MAX)
+
+
+static const struct {
+  image_pixel_format_t format;
+  size_t sum_size;
+  texture_build_row_t build_row;
+  texture_integrate_t integrate;
+} texture_kernels[] = {
+  { { IMAGE_SAMPLE_U8,    3 }, sizeof(uint16_t), build_row_rgb8,   integrate_rgb8 },
+  { { IMAGE_SAMPLE_U8,    4 }, sizeof(uint16_t), build_row_rgba8,  integrate_rgba8 },
+  { { IMAGE_SAMPLE_U16,   3 }, sizeof(uint32_t), build_row_rgb16,  integrate_rgb16 },
+  { { IMAGE_SAMPLE_U16,   4 }, sizeof(uint32_t), build_row_rgba16, integrate_rgba16 },
+  { { IMAGE_SAMPLE_HALF,  3 }, sizeof(float),    build_row_rgbh,   integrate_rgbh },
+  { { IMAGE_SAMPLE_HALF,  4 }, sizeof(float),    build_row_rgbah,  integrate_rgbah },
+  { { IMAGE_SAMPLE_FLOAT, 3 }, sizeof(float),    build_row_rgbf,   integrate_rgbf },
+  { { IMAGE_SAMPLE_FLOAT, 4 }, sizeof(float),    build_row_rgbaf,  integrate_rgbaf },
+};
+
+#define TEXTURE_KERNEL_COUNT (sizeof(texture_kernels) / sizeof(texture_kernels[0]))
+
+
+static int build_prefix_sums(texture_t *texture) {
+  const image_t *image = texture->image;
+  size_t width = image_get_width(image);
+  size_t height = image_get_height(image);
+  size_t k;
+
+  for (k = 0;  k < TEXTURE_KERNEL_COUNT;  k++) {
+    if (texture_kernels[k].format.type == image->format.type && texture_kernels[k].format.channels == image->format.channels) break;
+  }
+  if (k == TEXTURE_KERNEL_COUNT) {
+    fprintf(stderr, "Unknown texture pixel format (type %d, %u channels)\n", image->format.type, image->format.channels);
+    return -1;
+  }
+
+  texture->sum_size = texture_kernels[k].sum_size;
+  texture->build_row = texture_kernels[k].build_row;
+  texture->integrate = texture_kernels[k].integrate;
+
+  if ((texture->prefix_sums = malloc(height * (width + 1) * image->format.channels * texture->sum_size)) == NULL) {
+    PERROR("prefix sum allocation");
+    return -1;
+  }
+
+  /* Sums restart on every row, so float sums never grow past the texture width and keep their
+     precision. */
+  for (size_t row = 0;  row < height;  row++) {
+    texture->build_row(texture, row);
+  }
+
+  return 0;
+}
+
+
+texture_t *texture_create(const image_t *image, ssize_t edge_echo_offset, ssize_t max_shift) {
+  texture_t *texture;
+  size_t height = image_get_height(image);
+  size_t stride;
+
+  if (max_shift < 0) {
+    max_shift = 0;
+  }
+  stride = 2 * (size_t) max_shift + 1;
+
+  if ((texture = malloc(sizeof(*texture))) == NULL) {
+    PERROR("texture allocation");
+    return NULL;
+  }
+
+  texture->image = image;
+  texture->edge_echo_offset = edge_echo_offset;
+  texture->max_shift = max_shift;
+
+  texture->prefix_sums = NULL;
+
+  if ((texture->echo_rows = malloc(height * stride * sizeof(*texture->echo_rows))) == NULL) {
+    PERROR("edge echo table allocation");
+    free(texture);
+    return NULL;
+  }
+
+  if (build_prefix_sums(texture) == -1) {
+    texture_destroy(texture);
+    return NULL;
+  }
+
+  /* Each entry is one step on from its neighbor nearer the middle, so every row's entries take
+     O(max_shift) to fill rather than O(max_shift^2). */
+  for (size_t row = 0;  row < height;  row++) {
+    unsigned *entry = &texture->echo_rows[row * stride + max_shift];
+
+    entry[0] = row;
+    for (ssize_t shift = 1;  shift <= max_shift;  shift++) {
+      entry[shift] = echo_step(texture, row, entry[shift - 1], 1);
+      entry[-shift] = echo_step(texture, row, entry[1 - shift], -1);
+    }
+  }
+
+  return texture;
+}
+
+
+void texture_destroy(texture_t *texture) {
+  free(texture->prefix_sums);
+  free(texture->echo_rows);
+  free(texture);
+}
+
+
+size_t texture_get_width(const texture_t *texture) {
+  return image_get_width(texture->image);
+}
+
+
+size_t texture_get_height(const texture_t *texture) {
+  return image_get_height(texture->image);
+}
+
+
+size_t texture_get_memory_size(const texture_t *texture) {
+  size_t width = texture_get_width(texture);
+  size_t height = texture_get_height(texture);
+
+  return height * (width * image_pixel_size(texture->image->format)
+                   + texture->image->format.channels * (width + 1) * texture->sum_size
+                   + (2 * texture->max_shift + 1) * sizeof(*texture->echo_rows));
+}
+
+
+size_t texture_echo_row(const texture_t *texture, size_t row, ssize_t shift) {
+  ssize_t max_shift = texture->max_shift;
+  ssize_t table_shift = shift;
+  size_t used;
+
+  if (table_shift > max_shift) {
+    table_shift = max_shift;
+  } else if (table_shift < -max_shift) {
+    table_shift = -max_shift;
+  }
+
+  used = texture->echo_rows[row * (2 * max_shift + 1) + max_shift + table_shift];
+
+  /* Walk the rest of the way if the shift is bigger than the table. */
+  for (;  table_shift < shift;  table_shift++) {
+    used = echo_step(texture, row, used, 1);
+  }
+  for (;  table_shift > shift;  table_shift--) {
+    used = echo_step(texture, row, used, -1);
+  }
+
+  return used;
+}
+
+
+void texture_update_row(texture_t *texture, size_t row) {
+  texture->build_row(texture, row);
+}
+
+
+void texture_integrate(const texture_t *texture, size_t row, float left, float right, float sum[4]) {
+  texture->integrate(texture, row, left, right, sum);
+}
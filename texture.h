@@ -0,0 +1,59 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include "image.h"
+
+#include <stdlib.h>
+
+struct texture_tag;
+
+typedef void (*texture_build_row_t)(struct texture_tag *texture, size_t row);
+typedef void (*texture_integrate_t)(const struct texture_tag *texture, size_t row, float left, float right, float sum[4]);
+
+/* A texture image prepared for rendering, along with lookup tables built from it.  Nothing in it
+   changes after texture_create() unless texture_update_row() is called, so one texture can be
+   shared by every row and every thread. */
+typedef struct texture_tag {
+  const image_t *image;  /* not owned */
+  texture_build_row_t build_row;  /* for the image's pixel format */
+  texture_integrate_t integrate;
+
+  ssize_t edge_echo_offset;
+
+  /* echo_rows[row * (2 * max_shift + 1) + max_shift + shift] is the row that shift edge echo
+     offsets away from row lands on. */
+  ssize_t max_shift;
+  unsigned *echo_rows;
+
+  /* prefix_sums[(row * (width + 1) + i) * channels + channel] is the sum of that channel's samples
+     over the first i pixels of the row: 16-bit integers for 8-bit samples, 32-bit integers for
+     16-bit samples, and floats otherwise. */
+  void *prefix_sums;
+  size_t sum_size;
+} texture_t;
+
+/* max_shift is the largest edge echo shift (in either direction) that should be answered from
+   the table.  Larger shifts still work, just more slowly. */
+texture_t *texture_create(const image_t *image, ssize_t edge_echo_offset, ssize_t max_shift);
+
+void texture_destroy(texture_t *texture);
+
+size_t texture_get_width(const texture_t *texture);
+size_t texture_get_height(const texture_t *texture);
+
+/* Returns how many bytes the texture image and its tables take up. */
+size_t texture_get_memory_size(const texture_t *texture);
+
+/* Returns the texture row to use in place of row when that part of the stereogram has been
+   shifted by shift edge echo offsets.  Stepping never lands back on row itself, so that a shifted
+   range can't repeat the texture it's meant to differ from. */
+size_t texture_echo_row(const texture_t *texture, size_t row, ssize_t shift);
+
+/* Rebuilds the tables for the given row after the owner of the image has changed its pixels. */
+void texture_update_row(texture_t *texture, size_t row);
+
+/* Sets sum to the integral of the texture's color over left..right on the given row, where left
+   and right are measured in pixels (0 .. width).  Costs the same however wide the range is. */
+void texture_integrate(const texture_t *texture, size_t row, float left, float right, float sum[4]);
+
+#endif
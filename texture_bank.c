@@ -0,0 +1,327 @@
+
+#include "texture_bank.h"
+
+#include "util.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+#define BYTE_ORDER_MARK (0x01020304u)
+#define PIXELS_ALIGNMENT (64)
+#define TEMP_FILE_ATTEMPTS (100)  /* names tried for the file a bank is written to first */
+
+
+typedef struct {
+  char magic[8];
+  uint32_t byte_order;
+  uint32_t count;
+} header_t;
+
+
+static size_t record_pixels_size(const texture_bank_record_t *record) {
+  image_pixel_format_t format = { record->type, record->channels };
+
+  return (size_t) record->width * record->height * image_pixel_size(format);
+}
+
+
+/* Makes sure a record only points at what's inside the mapping. */
+static int record_is_valid(const texture_bank_t *bank, const texture_bank_record_t *record) {
+  if (record->type > IMAGE_SAMPLE_FLOAT || (record->channels != 3 && record->channels != 4)) {
+    return 0;
+  }
+
+  if (record->key_offset >= bank->size || record->key_length >= bank->size - record->key_offset
+      || bank->mapping[record->key_offset + record->key_length] != '\0') {
+    return 0;
+  }
+
+  if (record->width == 0 || record->height == 0 || record->height > SIZE_MAX / 16 / record->width) {
+    return 0;
+  }
+
+  return record->pixels_offset % PIXELS_ALIGNMENT == 0
+         && record->pixels_offset <= bank->size && record_pixels_size(record) <= bank->size - record->pixels_offset;
+}
+
+
+texture_bank_t *texture_bank_open(const char *filename) {
+  texture_bank_t *bank;
+  const header_t *header;
+  struct stat st;
+  void *mapping;
+  int fd;
+
+  if ((fd = open(filename, O_RDONLY)) == -1) {
+    return NULL;
+  }
+
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return NULL;
+  }
+
+  if ((size_t) st.st_size < sizeof(header_t)) {
+    close(fd);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (mapping == MAP_FAILED) {
+    return NULL;
+  }
+
+  if ((bank = malloc(sizeof(*bank))) == NULL) {
+    munmap(mapping, st.st_size);
+    return NULL;
+  }
+
+  bank->mapping = mapping;
+  bank->size = st.st_size;
+
+  header = mapping;
+  if (memcmp(header->magic, TEXTURE_BANK_MAGIC, sizeof(header->magic)) != 0 || header->byte_order != BYTE_ORDER_MARK
+      || header->count > (bank->size - sizeof(*header)) / sizeof(texture_bank_record_t)) {
+    goto bad;
+  }
+
+  bank->records = (const texture_bank_record_t *) (bank->mapping + sizeof(*header));
+  bank->count = header->count;
+
+  for (size_t i = 0;  i < bank->count;  i++) {
+    if (!record_is_valid(bank, &bank->records[i])) goto bad;
+
+    /* texture_bank_get() finds keys by binary search. */
+    if (i > 0 && strcmp((const char *) bank->mapping + bank->records[i - 1].key_offset,
+                        (const char *) bank->mapping + bank->records[i].key_offset) >= 0) goto bad;
+  }
+
+  return bank;
+
+ bad:
+  texture_bank_close(bank);
+  errno = EINVAL;
+  return NULL;
+}
+
+
+void texture_bank_close(texture_bank_t *bank) {
+  munmap((void *) bank->mapping, bank->size);
+  free(bank);
+}
+
+
+static void record_to_image(const texture_bank_t *bank, const texture_bank_record_t *record, image_t *image) {
+  image->width = record->width;
+  image->height = record->height;
+  image->format.type = record->type;
+  image->format.channels = record->channels;
+  image->pixels = (void *) (bank->mapping + record->pixels_offset);
+}
+
+
+int texture_bank_get(const texture_bank_t *bank, const char *key, image_t *image) {
+  size_t low = 0;
+  size_t high = bank->count;
+
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    const texture_bank_record_t *record = &bank->records[middle];
+    int cmp = strcmp(key, (const char *) bank->mapping + record->key_offset);
+
+    if (cmp == 0) {
+      record_to_image(bank, record, image);
+      return 0;
+    } else if (cmp < 0) {
+      high = middle;
+    } else {
+      low = middle + 1;
+    }
+  }
+
+  return -1;
+}
+
+
+const char *texture_bank_get_entry(const texture_bank_t *bank, size_t index, image_t *image) {
+  const texture_bank_record_t *record = &bank->records[index];
+
+  record_to_image(bank, record, image);
+
+  return (const char *) bank->mapping + record->key_offset;
+}
+
+
+typedef struct {
+  const char *key;
+  size_t index;  /* into the keys and images being written */
+} key_index_t;
+
+
+static int compare_key_indices(const void *a, const void *b) {
+  const key_index_t *i = a;
+  const key_index_t *j = b;
+  int cmp = strcmp(i->key, j->key);
+
+  /* Keep repeats in their original order, so the first one can win. */
+  if (cmp == 0) {
+    return i->index < j->index ? -1 : i->index > j->index;
+  }
+  return cmp;
+}
+
+
+static int write_padding(FILE *file, uint64_t *offset, size_t alignment) {
+  while (*offset % alignment) {
+    if (fputc(0, file) == EOF) return -1;
+    (*offset)++;
+  }
+  return 0;
+}
+
+
+int texture_bank_write(const char *filename, size_t count, const char *const *keys, const image_t *const *images) {
+  header_t header;
+  texture_bank_record_t *records = NULL;
+  key_index_t *order = NULL;
+  size_t unique = 0;
+  char temp_filename[PATH_MAX];
+  int temp_created = 0;
+  FILE *file = NULL;
+  int fd;
+  uint64_t offset;
+  uint64_t keys_end;
+  int retval = 0;
+
+  if ((order = malloc((count ? count : 1) * sizeof(*order))) == NULL
+      || (records = calloc(count ? count : 1, sizeof(*records))) == NULL) {
+    PERROR("texture bank index allocation");
+    goto bad;
+  }
+
+  for (size_t i = 0;  i < count;  i++) {
+    order[i].key = keys[i];
+    order[i].index = i;
+  }
+  qsort(order, count, sizeof(*order), compare_key_indices);
+
+  for (size_t i = 0;  i < count;  i++) {
+    if (unique == 0 || strcmp(order[i].key, order[unique - 1].key) != 0) {
+      order[unique++] = order[i];
+    }
+  }
+
+  /* The header and the records only have 32 bits for these. */
+  if (unique > UINT32_MAX) {
+    fprintf(stderr, "%s: a texture bank can't hold more than %" PRIu32 " textures\n", filename, UINT32_MAX);
+    goto bad;
+  }
+  for (size_t i = 0;  i < unique;  i++) {
+    const image_t *image = images[order[i].index];
+
+    if (strlen(order[i].key) > UINT32_MAX || image->width > UINT32_MAX || image->height > UINT32_MAX) {
+      fprintf(stderr, "%s: texture %s is too big for a texture bank\n", filename, order[i].key);
+      goto bad;
+    }
+  }
+
+  /* Lay the file out: the index, then the keys, then the pixels. */
+  offset = sizeof(header) + unique * sizeof(*records);
+  for (size_t i = 0;  i < unique;  i++) {
+    records[i].key_offset = offset;
+    records[i].key_length = strlen(order[i].key);
+    offset += records[i].key_length + 1;
+  }
+  keys_end = offset;
+
+  for (size_t i = 0;  i < unique;  i++) {
+    const image_t *image = images[order[i].index];
+
+    offset = (offset + PIXELS_ALIGNMENT - 1) / PIXELS_ALIGNMENT * PIXELS_ALIGNMENT;
+    records[i].pixels_offset = offset;
+    records[i].width = image->width;
+    records[i].height = image->height;
+    records[i].type = image->format.type;
+    records[i].channels = image->format.channels;
+    offset += record_pixels_size(&records[i]);
+  }
+
+  /* Write it next to where it's going, so that the rename can't cross file systems.  Not with
+     mkstemp(), which would make the bank private: it's for sharing, as far as the umask allows. */
+  for (unsigned attempt = 0;  ;  attempt++) {
+    if (snprintf(temp_filename, sizeof(temp_filename), "%s.%ld.%u", filename, (long) getpid(), attempt) >= (int) sizeof(temp_filename)) {
+      errno = ENAMETOOLONG;
+      perror(filename);
+      goto bad;
+    }
+    if ((fd = open(temp_filename, O_WRONLY | O_CREAT | O_EXCL, 0666)) != -1) break;
+    if (errno != EEXIST || attempt + 1 == TEMP_FILE_ATTEMPTS) {
+      perror(temp_filename);
+      goto bad;
+    }
+  }
+  temp_created = 1;
+
+  if ((file = fdopen(fd, "w")) == NULL) {
+    perror(temp_filename);
+    close(fd);
+    goto bad;
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, TEXTURE_BANK_MAGIC, sizeof(header.magic));
+  header.byte_order = BYTE_ORDER_MARK;
+  header.count = unique;
+
+  if (fwrite(&header, sizeof(header), 1, file) != 1) goto bad_write;
+  if (fwrite(records, sizeof(*records), unique, file) != unique) goto bad_write;
+
+  for (size_t i = 0;  i < unique;  i++) {
+    if (fwrite(order[i].key, 1, records[i].key_length + 1, file) != records[i].key_length + 1) goto bad_write;
+  }
+
+  offset = keys_end;
+  for (size_t i = 0;  i < unique;  i++) {
+    size_t size = record_pixels_size(&records[i]);
+
+    if (write_padding(file, &offset, PIXELS_ALIGNMENT) == -1) goto bad_write;
+    if (fwrite(images[order[i].index]->pixels, 1, size, file) != size) goto bad_write;
+    offset += size;
+  }
+
+  if (fclose(file) == EOF) {
+    file = NULL;
+    goto bad_write;
+  }
+  file = NULL;
+
+  if (rename(temp_filename, filename) == -1) {
+    perror(filename);
+    goto bad;
+  }
+  temp_created = 0;
+
+ cleanup:
+  if (file) fclose(file);
+  if (temp_created) unlink(temp_filename);
+  free(order);
+  free(records);
+
+  return retval;
+
+ bad_write:
+  perror(temp_filename);
+ bad:
+  retval = -1;
+  goto cleanup;
+}
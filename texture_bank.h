@@ -0,0 +1,54 @@
+#ifndef TEXTURE_BANK_H
+#define TEXTURE_BANK_H
+
+#include "image.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+
+/* A texture bank file is a header, an index of records sorted by key, the keys, and then the
+   textures' pixels, each starting on a 64-byte boundary.  Everything is in the byte order of the
+   machine that wrote it, which the header records. */
+#define TEXTURE_BANK_MAGIC "SGTBANK1"
+
+
+typedef struct texture_bank_record_tag {
+  uint64_t key_offset;  /* of a NUL-terminated string */
+  uint64_t pixels_offset;
+  uint32_t key_length;
+  uint32_t width;
+  uint32_t height;
+  uint32_t type;  /* an image_sample_type_t */
+  uint32_t channels;
+  uint32_t reserved;
+} texture_bank_record_t;
+
+
+/* A bank mapped read-only, so that every process using it shares one copy of the textures. */
+typedef struct texture_bank_tag {
+  const unsigned char *mapping;
+  size_t size;
+
+  const texture_bank_record_t *records;
+  size_t count;
+} texture_bank_t;
+
+
+texture_bank_t *texture_bank_open(const char *filename);
+void texture_bank_close(texture_bank_t *bank);
+
+/* Sets image to a view of the texture stored under key, whose pixels stay in the bank.  It must
+   not be changed or passed to image_destroy(), and it's only good until the bank is closed.
+   Returns -1 if there's no such texture. */
+int texture_bank_get(const texture_bank_t *bank, const char *key, image_t *image);
+
+/* The same for the index'th texture, along with its key. */
+const char *texture_bank_get_entry(const texture_bank_t *bank, size_t index, image_t *image);
+
+/* Writes a new bank holding the given textures, replacing any file already there.  The new file
+   is renamed into place once it's complete, so processes that have the old one mapped keep
+   seeing the old one.  Where keys repeat, the first texture wins. */
+int texture_bank_write(const char *filename, size_t count, const char *const *keys, const image_t *const *images);
+
+#endif
@@ -0,0 +1,280 @@
+
+#include "thread_pool.h"
+
+#include "util.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+#define CACHE_LINE_SIZE (64)
+
+
+/* The indices a worker has yet to run.  The owner takes from the front, thieves take from the
+   back.  Each range sits on its own cache line so that workers don't contend over neighbors. */
+typedef struct {
+  pthread_mutex_t lock;
+  size_t begin;
+  size_t end;
+} __attribute__((aligned(CACHE_LINE_SIZE))) work_range_t;
+
+
+typedef struct {
+  thread_pool_t *pool;
+  unsigned worker;
+} worker_arg_t;
+
+
+struct thread_pool_tag {
+  unsigned thread_count;
+
+  pthread_t *threads;  /* thread_count - 1 helpers; the caller of thread_pool_run() is worker 0 */
+  worker_arg_t *worker_args;
+  work_range_t *ranges;
+
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+
+  unsigned long generation;  /* bumped once per thread_pool_run() */
+  unsigned busy;  /* helpers that haven't finished the current run yet */
+  int shutdown;
+
+  thread_pool_task_t task;
+  void *arg;
+  atomic_int failed;
+};
+
+
+static int take_index(work_range_t *range, size_t *index) {
+  int found = 0;
+
+  pthread_mutex_lock(&range->lock);
+  if (range->begin < range->end) {
+    *index = range->begin++;
+    found = 1;
+  }
+  pthread_mutex_unlock(&range->lock);
+
+  return found;
+}
+
+
+/* Moves the back half of some other worker's remaining indices into the thief's own range.
+   Returns 0 if there was nothing left to steal. */
+static int steal_range(thread_pool_t *pool, unsigned thief) {
+  for (unsigned i = 1;  i < pool->thread_count;  i++) {
+    work_range_t *victim = &pool->ranges[(thief + i) % pool->thread_count];
+    size_t begin;
+    size_t end;
+
+    pthread_mutex_lock(&victim->lock);
+    end = victim->end;
+    begin = end - (end - victim->begin + 1) / 2;
+    victim->end = begin;
+    pthread_mutex_unlock(&victim->lock);
+
+    if (begin < end) {
+      work_range_t *own = &pool->ranges[thief];
+
+      pthread_mutex_lock(&own->lock);
+      own->begin = begin;
+      own->end = end;
+      pthread_mutex_unlock(&own->lock);
+
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+
+static void run_worker(thread_pool_t *pool, unsigned worker) {
+  size_t index;
+
+  while (!atomic_load_explicit(&pool->failed, memory_order_relaxed)) {
+    if (!take_index(&pool->ranges[worker], &index)) {
+      if (!steal_range(pool, worker)) {
+        break;
+      }
+      continue;
+    }
+
+    if (pool->task(pool->arg, index, worker) == -1) {
+      atomic_store(&pool->failed, 1);
+    }
+  }
+}
+
+
+static void *worker_main(void *p) {
+  worker_arg_t *worker_arg = p;
+  thread_pool_t *pool = worker_arg->pool;
+  unsigned long seen_generation = 0;
+
+  pthread_mutex_lock(&pool->lock);
+
+  for (;;) {
+    while (!pool->shutdown && pool->generation == seen_generation) {
+      pthread_cond_wait(&pool->start, &pool->lock);
+    }
+    if (pool->shutdown) {
+      break;
+    }
+    seen_generation = pool->generation;
+
+    pthread_mutex_unlock(&pool->lock);
+    run_worker(pool, worker_arg->worker);
+    pthread_mutex_lock(&pool->lock);
+
+    if (--pool->busy == 0) {
+      pthread_cond_signal(&pool->done);
+    }
+  }
+
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+
+static void stop_threads(thread_pool_t *pool, unsigned started) {
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = 1;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (unsigned i = 0;  i < started;  i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+}
+
+
+thread_pool_t *thread_pool_create(unsigned thread_count) {
+  thread_pool_t *pool;
+  unsigned started = 0;
+
+  if (thread_count == 0) {
+    long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    thread_count = cpu_count > 0 ? (unsigned) cpu_count : 1;
+  }
+
+  if ((pool = calloc(1, sizeof(*pool))) == NULL) {
+    PERROR("thread pool allocation");
+    return NULL;
+  }
+
+  pool->thread_count = thread_count;
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  atomic_init(&pool->failed, 0);
+
+  if ((pool->ranges = aligned_alloc(CACHE_LINE_SIZE, thread_count * sizeof(*pool->ranges))) == NULL) goto bad;
+  for (unsigned i = 0;  i < thread_count;  i++) {
+    pthread_mutex_init(&pool->ranges[i].lock, NULL);
+    pool->ranges[i].begin = pool->ranges[i].end = 0;
+  }
+
+  if ((pool->threads = calloc(thread_count, sizeof(*pool->threads))) == NULL) goto bad;
+  if ((pool->worker_args = calloc(thread_count, sizeof(*pool->worker_args))) == NULL) goto bad;
+
+  for (unsigned i = 1;  i < thread_count;  i++) {
+    pool->worker_args[i].pool = pool;
+    pool->worker_args[i].worker = i;
+    if ((errno = pthread_create(&pool->threads[started], NULL, worker_main, &pool->worker_args[i])) != 0) {
+      PERROR("thread creation");
+      goto bad;
+    }
+    started++;
+  }
+
+  return pool;
+
+ bad:
+  stop_threads(pool, started);
+  thread_pool_destroy(pool);
+  return NULL;
+}
+
+
+void thread_pool_destroy(thread_pool_t *pool) {
+  if (pool->threads && !pool->shutdown) {
+    stop_threads(pool, pool->thread_count - 1);
+  }
+
+  if (pool->ranges) {
+    for (unsigned i = 0;  i < pool->thread_count;  i++) {
+      pthread_mutex_destroy(&pool->ranges[i].lock);
+    }
+  }
+
+  pthread_cond_destroy(&pool->done);
+  pthread_cond_destroy(&pool->start);
+  pthread_mutex_destroy(&pool->lock);
+
+  free(pool->worker_args);
+  free(pool->threads);
+  free(pool->ranges);
+  free(pool);
+}
+
+
+unsigned thread_pool_get_thread_count(const thread_pool_t *pool) {
+  return pool->thread_count;
+}
+
+
+int thread_pool_run(thread_pool_t *pool, size_t count, thread_pool_task_t task, void *arg) {
+  unsigned thread_count = pool->thread_count;
+
+  if (count == 0) {
+    return 0;
+  }
+
+  if (thread_count > count) {
+    thread_count = count;
+  }
+
+  pool->task = task;
+  pool->arg = arg;
+  atomic_store(&pool->failed, 0);
+
+  /* Hand each worker a contiguous share to start with.  Workers beyond thread_count get an
+     empty share and go straight to stealing. */
+  for (unsigned i = 0;  i < pool->thread_count;  i++) {
+    pthread_mutex_lock(&pool->ranges[i].lock);
+    if (i < thread_count) {
+      pool->ranges[i].begin = count * i / thread_count;
+      pool->ranges[i].end = count * (i + 1) / thread_count;
+    } else {
+      pool->ranges[i].begin = pool->ranges[i].end = 0;
+    }
+    pthread_mutex_unlock(&pool->ranges[i].lock);
+  }
+
+  if (pool->thread_count == 1) {
+    run_worker(pool, 0);
+    return atomic_load(&pool->failed) ? -1 : 0;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->generation++;
+  pool->busy = pool->thread_count - 1;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  run_worker(pool, 0);
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->busy > 0) {
+    pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return atomic_load(&pool->failed) ? -1 : 0;
+}
@@ -0,0 +1,30 @@
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stddef.h>
+
+
+/* A task is called once for every index handed to thread_pool_run().  worker identifies the
+   calling thread (0 .. thread count - 1), so that a task can keep per-thread scratch space.
+   Returns 0 on success, -1 on error. */
+typedef int (*thread_pool_task_t)(void *arg, size_t index, unsigned worker);
+
+typedef struct thread_pool_tag thread_pool_t;
+
+/* Creates a pool of thread_count workers.  The thread calling thread_pool_run() counts as one
+   of them.  A thread_count of 0 means one worker per online CPU. */
+thread_pool_t *thread_pool_create(unsigned thread_count);
+
+void thread_pool_destroy(thread_pool_t *pool);
+
+unsigned thread_pool_get_thread_count(const thread_pool_t *pool);
+
+/* Calls task for every index in 0 .. count - 1 and waits for all of them to finish.  Each worker
+   starts out with a contiguous share of the indices and steals half of a busier worker's
+   remaining share when it runs out, so uneven tasks still keep every thread busy.
+   Returns -1 if any task failed, in which case the remaining indices may not have been run.
+   Only one run may be in progress on a pool at a time, and tasks must not start runs of their own. */
+int thread_pool_run(thread_pool_t *pool, size_t count, thread_pool_task_t task, void *arg);
+
+#endif
@@ -1,4 +1,6 @@
 
+#define _GNU_SOURCE  /* for strchrnul() */
+
 #include "util.h"
 
 
@@ -6,33 +8,28 @@
 #include <stdlib.h>
 
 
-float rand_in_range(float min, float max) { 
-  return min + rand() / (RAND_MAX + 1.0f) * (max - min);
-}
-
-
-float rand_r_in_range(unsigned int *seed, float min, float max) {
-    return min + rand_r(seed) / (RAND_MAX + 1.0f) * (max - min);
+float rand_in_range(rng_t *rng, float min, float max) {
+  return min + rng_float(rng) * (max - min);
 }
 
 
-float rand_normal(void) {
-  return rand() / (RAND_MAX + 1.0f);
+float rand_normal(rng_t *rng) {
+  return rng_float(rng);
 }
 
 
-int rand_in_range_int(int min, int max) { 
-  return min + (int) (floorf(rand_normal() * (max - min + 1)));
+int rand_in_range_int(rng_t *rng, int min, int max) {
+  return min + (int) (floorf(rand_normal(rng) * (max - min + 1)));
 }
 
 
-size_t rand_index(size_t length) {
-  return (size_t) (rand_normal() * length);
+size_t rand_index(rng_t *rng, size_t length) {
+  return (size_t) (rand_normal(rng) * length);
 }
 
 
-int rand_bool(void) {
-  return rand() <= RAND_MAX / 2;
+int rand_bool(rng_t *rng) {
+  return rng_next(rng) >> 63;
 }
 
 
@@ -68,9 +65,9 @@ float lerp_float(float a, float b, float t) {
 }
 
 
-float jitter(float value, float max_jitter) {
-  float jitter_fraction = powf(rand_normal(), 2);
-  if (rand_bool()) {
+float jitter(rng_t *rng, float value, float max_jitter) {
+  float jitter_fraction = powf(rand_normal(rng), 2);
+  if (rand_bool(rng)) {
     jitter_fraction = -jitter_fraction;
   }
 
@@ -78,12 +75,12 @@ float jitter(float value, float max_jitter) {
 }
 
 
-float jitter_with_cap(float value, float max_jitter, float min, float max) {
-  return cap_float(jitter(value, max_jitter), min, max);
+float jitter_with_cap(rng_t *rng, float value, float max_jitter, float min, float max) {
+  return cap_float(jitter(rng, value, max_jitter), min, max);
 }
 
-float jitter_with_wrap(float value, float max_jitter, float min, float max) {
-  return wrap_float(jitter(value, max_jitter), min, max);
+float jitter_with_wrap(rng_t *rng, float value, float max_jitter, float min, float max) {
+  return wrap_float(jitter(rng, value, max_jitter), min, max);
 }
 
 
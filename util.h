@@ -3,30 +3,31 @@
 #define UTIL_H
 
 
+#include "rng.h"
+
 #include <errno.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 
 
-#define rand_float(max) rand_in_range(0, max)
+#define rand_float(rng, max) rand_in_range(rng, 0, max)
 
 
-float rand_in_range(float min, float max);
-float rand_r_in_range(unsigned int *seed, float min, float max);
-int rand_in_range_int(int min, int max);
-float rand_normal(void);
-size_t rand_index(size_t length);
-int rand_bool(void);
+float rand_in_range(rng_t *rng, float min, float max);
+int rand_in_range_int(rng_t *rng, int min, int max);
+float rand_normal(rng_t *rng);
+size_t rand_index(rng_t *rng, size_t length);
+int rand_bool(rng_t *rng);
 
 float cap_float(float value, float min, float max);
 float wrap_float(float value, float min, float max);
 
 float lerp_float(float a, float b, float t);
 
-float jitter(float value, float max_jitter);
-float jitter_with_cap(float value, float max_jitter, float min, float max);
-float jitter_with_wrap(float value, float max_jitter, float min, float max);
+float jitter(rng_t *rng, float value, float max_jitter);
+float jitter_with_cap(rng_t *rng, float value, float max_jitter, float min, float max);
+float jitter_with_wrap(rng_t *rng, float value, float max_jitter, float min, float max);
 
 const char *next_token(char *dest, size_t capacity, const char *s, int delim);
 